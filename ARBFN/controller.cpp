@@ -0,0 +1,1310 @@
+/**
+ * @brief Defines the reusable controller-side server
+ * @author J Dehmel, J Schiffbauer, 2024, MIT License
+ */
+
+#include "controller.h"
+#include "interchange.h"
+#include <algorithm>
+#include <atomic>
+#include <boost/json.hpp>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+
+/**
+ * @brief Transcribes the atoms of a JSON request into columns
+ * @param _json The request
+ * @param _fields The fields which the worker announced
+ * @param _into The buffer to write the atoms into
+ * @return True on success, false on a malformed request
+ */
+static bool stage_json(const boost::json::object &_json, const uint64_t &_fields,
+                       AtomBuffer &_into)
+{
+  const boost::json::value *const atoms = _json.if_contains("atoms");
+  if (atoms == nullptr || !atoms->is_array()) {
+    std::cerr << "Worker sent request without atoms\n";
+    return false;
+  }
+  const boost::json::array &list = atoms->as_array();
+
+  _into.resize(list.size(), _fields);
+  for (uint64_t field = 1; field <= _fields; field <<= 1) {
+    if (!(_fields & field)) { continue; }
+    for (size_t c = 0; c < field_width(field); ++c) {
+      const char *const key = field_key(field, c);
+      double *const column = _into.column((ARBFNField) field, c);
+      for (size_t i = 0; i < list.size(); ++i) {
+        const boost::json::value *const value = list[i].as_object().if_contains(key);
+        if (value == nullptr || !value->is_number()) {
+          std::cerr << "Worker sent atom without numeric '" << key << "'\n";
+          return false;
+        }
+        column[i] = value->to_number<double>();
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Appends a double to some JSON text, as by `format_double`
+ * @param _into The text to append to
+ * @param _what The value to append
+ */
+static void append_double(std::string &_into, const double &_what)
+{
+  char buffer[ARBFN_MAX_DOUBLE_CHARS];
+  _into.append(buffer, format_double(buffer, _what));
+}
+
+/**
+ * @brief Reads the fields announced in a registration, or in one of
+ * its parts. Workers which predate field selection send the defaults.
+ * @param _json The registration or part
+ * @return Bitwise OR of the `ARBFNField`s announced
+ */
+static uint64_t fields_of(const boost::json::object &_json)
+{
+  const boost::json::value *const fields = _json.if_contains("fields");
+  if (fields == nullptr || !fields->is_array()) { return ARBFN_DEFAULT_FIELDS; }
+
+  uint64_t result = 0;
+  for (const boost::json::value &name : fields->as_array()) {
+    if (name.is_string()) { result |= field_from_name(name.as_string().c_str()); }
+  }
+  return result;
+}
+
+/**
+ * @brief Reads the terms asked for in a registration, or in one of
+ * its parts
+ * @param _json The registration or part
+ * @return Bitwise OR of the `ARBFNTerm`s asked for
+ */
+static uint64_t terms_of(const boost::json::object &_json)
+{
+  uint64_t result = 0;
+  for (uint64_t term = ARBFN_TERM_RATES; term <= ARBFN_TERM_VIRIAL; term <<= 1) {
+    const boost::json::value *const asked = _json.if_contains(term_name(term));
+    if (asked != nullptr && *asked == true) { result |= term; }
+  }
+  return result;
+}
+
+/**
+ * @brief Appends the terms agreed to an `ack`, or to one of its parts
+ * @param _into The text to append to, within an object
+ * @param _terms Bitwise OR of the `ARBFNTerm`s agreed to
+ */
+static void append_terms(std::string &_into, const uint64_t &_terms)
+{
+  for (uint64_t term = ARBFN_TERM_RATES; term <= ARBFN_TERM_VIRIAL; term <<= 1) {
+    if (_terms & term) { _into += ",\"" + std::string(term_name(term)) + "\":true"; }
+  }
+}
+
+/**
+ * @brief Appends the list of fixes of a JSON response
+ * @param _into The text to append to
+ * @param _fixes The fixes to list
+ */
+static void append_json_fixes(std::string &_into, const FixBuffer &_fixes)
+{
+  const double *const dfx = _fixes.column(0);
+  const double *const dfy = _fixes.column(1);
+  const double *const dfz = _fixes.column(2);
+
+  _into += '[';
+  for (size_t i = 0; i < _fixes.n; ++i) {
+    _into += (i == 0 ? "{\"dfx\":" : ",{\"dfx\":");
+    append_double(_into, dfx[i]);
+    _into += ",\"dfy\":";
+    append_double(_into, dfy[i]);
+    _into += ",\"dfz\":";
+    append_double(_into, dfz[i]);
+    size_t column = 3;
+    for (uint64_t term = ARBFN_TERM_RATES; term <= _fixes.terms; term <<= 1) {
+      if (!(_fixes.terms & term)) { continue; }
+      for (size_t c = 0; c < term_width(term); ++c, ++column) {
+        _into += ",\"";
+        _into += term_key(term, c);
+        _into += "\":";
+        append_double(_into, _fixes.column(column)[i]);
+      }
+    }
+    _into += '}';
+  }
+  _into += ']';
+}
+
+/**
+ * @brief Sizes a fix buffer to match some atoms, then zeroes it for
+ * the handler
+ * @param _fixes The fix buffer
+ * @param _n The number of atoms
+ */
+static void zero_fixes(FixBuffer &_fixes, const size_t &_n)
+{
+  _fixes.resize(_n);
+  std::fill(_fixes.column(0), _fixes.column(0) + _fixes.width * _fixes.n, 0.0);
+}
+
+ThreadPool::ThreadPool(const size_t &_num_threads) :
+    next_queue(0), num_queued(0), num_unfinished(0), quitting(false)
+{
+  for (size_t i = 0; i < _num_threads; ++i) { queues.emplace_back(new Queue()); }
+  for (size_t i = 0; i < _num_threads; ++i) { threads.emplace_back(&ThreadPool::work, this, i); }
+}
+
+ThreadPool::~ThreadPool()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quitting = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads) { thread.join(); }
+}
+
+void ThreadPool::submit(const std::function<void()> &_task)
+{
+  // Spread tasks over the queues; stealing evens out the rest
+  Queue &queue = *queues[next_queue++ % queues.size()];
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++num_unfinished;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(_task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++num_queued;
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+  std::function<void()> task;
+
+  while (take(0, task)) { run(task); }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return num_unfinished == 0; });
+}
+
+bool ThreadPool::take(const size_t &_home, std::function<void()> &_into)
+{
+  // Tasks are taken oldest first, even when stolen, so that replies
+  // go out in roughly the order their requests came in
+  for (size_t k = 0; k < queues.size(); ++k) {
+    Queue &queue = *queues[(_home + k) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      _into = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --num_queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(std::function<void()> &_task)
+{
+  _task();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (--num_unfinished == 0) { finished.notify_all(); }
+}
+
+void ThreadPool::work(const size_t &_home)
+{
+  std::function<void()> task;
+
+  while (true) {
+    if (take(_home, task)) {
+      run(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [this] { return quitting || num_queued > 0; });
+    if (quitting && num_queued == 0) { return; }
+  }
+}
+
+Controller::Controller(const bool &_allow_binary, const size_t &_num_threads) :
+    peers(MPI_COMM_NULL), requests(0), tile_size(8), allow_binary(_allow_binary),
+    num_expected(0), serving_bulk(false)
+{
+  if (_num_threads > 1) { pool.reset(new ThreadPool(_num_threads)); }
+
+  // Comm split 1 (LAMMPS internal: junk_comm is useless)
+  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+
+  // Comm split 2 (ARBFN alignment: Produced real comm)
+  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, ARBFN_MPI_KEY_CONTROLLER, &comm);
+
+  // Learn how many workers to expect, and connect to the other
+  // controllers, which hold the lowest ranks
+  uint num_controllers;
+  num_expected = discover_workers(comm, num_controllers);
+  connect_peers(num_controllers);
+}
+
+Controller::~Controller()
+{
+  if (group.comm != MPI_COMM_NULL) { MPI_Comm_free(&group.comm); }
+  if (peers != MPI_COMM_NULL) { MPI_Comm_free(&peers); }
+  MPI_Comm_free(&comm);
+  MPI_Comm_free(&junk_comm);
+}
+
+bool Controller::serve(const RequestHandler &_handler)
+{
+  std::vector<WorkerRequest> batch;
+  int source;
+  bool is_request;
+
+  if (pool) { return serve_pooled(_handler); }
+
+  while (!finished()) {
+    if (!receive(source, is_request)) { return false; }
+    if (!is_request) { continue; }
+
+    Worker &worker = workers.at(source);
+    batch.clear();
+    add_requests(source, worker, batch);
+    for (WorkerRequest &request : batch) { _handler(request); }
+    respond(source, worker);
+  }
+
+  // Final barrier, mirroring LAMMPS's own shutdown
+  finish_pushes();
+  MPI_Barrier(MPI_COMM_WORLD);
+  return true;
+}
+
+bool Controller::serve_bulk(const BulkRequestHandler &_handler)
+{
+  Waiter waiter(ARBFN_WAIT_BACKOFF);
+  std::vector<WorkerRequest> batch;
+  int source, flag;
+  bool is_request;
+
+  serving_bulk = true;
+  waiter.start(0.0);
+  while (!finished()) {
+    // Collective workers send nothing over the ARBFN comm while in
+    // their group, so once it is made, both are polled
+    if (group.comm == MPI_COMM_NULL) {
+      if (!receive(source, is_request)) { return false; }
+    } else {
+      MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, MPI_STATUS_IGNORE);
+      if (flag) {
+        if (!receive(source, is_request)) { return false; }
+      } else {
+        MPI_Test(&group.request, &flag, MPI_STATUS_IGNORE);
+        if (!flag) {
+          waiter.idle();
+          continue;
+        }
+        if (!gather_group()) { return false; }
+        is_request = false;
+      }
+      waiter.progress();
+    }
+
+    // Requests are held until every worker which picked this
+    // controller has registered and sent one (workers in grid mode
+    // never do). Registrations and deregistrations may also
+    // complete a batch.
+    size_t num_pending = 0, num_requesting = 0;
+    for (const auto &p : workers) {
+      if (p.second.has_request) { ++num_pending; }
+      if (p.second.mode != ARBFN_MODE_GRID) { ++num_requesting; }
+    }
+    if (num_pending == 0) {
+      continue;
+    } else if (num_pending != num_requesting || !all_registered()) {
+      if (is_request) { send_waiting(source, workers.at(source)); }
+      continue;
+    }
+
+    batch.clear();
+    for (auto &p : workers) {
+      if (p.second.mode != ARBFN_MODE_GRID) { add_requests(p.first, p.second, batch); }
+    }
+    _handler(batch);
+    for (auto &p : workers) {
+      if (p.second.mode != ARBFN_MODE_GRID && p.second.format != ARBFN_FORMAT_COLLECTIVE) {
+        respond(p.first, p.second);
+      }
+    }
+    if (group.comm != MPI_COMM_NULL) { scatter_group(); }
+  }
+  waiter.stop();
+  serving_bulk = false;
+
+  // Final barrier, mirroring LAMMPS's own shutdown
+  finish_pushes();
+  MPI_Barrier(MPI_COMM_WORLD);
+  return true;
+}
+
+bool Controller::serve_pooled(const RequestHandler &_handler)
+{
+  Waiter waiter(ARBFN_WAIT_BACKOFF);
+  std::mutex ready_mutex;
+  std::vector<int> ready, sending;
+  size_t num_in_flight = 0;
+  int source, flag;
+  bool is_request, result = true;
+
+  // This thread does all the MPI, so must poll both MPI and the pool
+  waiter.start(0.0);
+  do {
+    // Hand new requests to the pool. A worker sends nothing more
+    // until it is answered, so its buffers are free for the handler.
+    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, MPI_STATUS_IGNORE);
+    if (flag) {
+      if (!receive(source, is_request)) {
+        result = false;
+        break;
+      }
+      if (is_request) {
+        Worker *const worker = &workers.at(source);
+        ++num_in_flight;
+        pool->submit([this, &_handler, &ready_mutex, &ready, worker, source]() {
+          std::vector<WorkerRequest> batch;
+          add_requests(source, *worker, batch);
+          for (WorkerRequest &request : batch) { _handler(request); }
+
+          std::lock_guard<std::mutex> lock(ready_mutex);
+          ready.push_back(source);
+        });
+      }
+      waiter.progress();
+      continue;
+    }
+
+    // Reply to whichever workers' fixes are ready
+    {
+      std::lock_guard<std::mutex> lock(ready_mutex);
+      sending.swap(ready);
+    }
+    if (!sending.empty()) {
+      for (const int &rank : sending) { respond(rank, workers.at(rank)); }
+      num_in_flight -= sending.size();
+      sending.clear();
+      waiter.progress();
+      continue;
+    }
+
+    waiter.idle();
+  } while (!finished() || num_in_flight > 0);
+  waiter.stop();
+
+  // No task may outlive the state it refers to
+  pool->wait();
+  if (!result) { return false; }
+
+  // Final barrier, mirroring LAMMPS's own shutdown
+  finish_pushes();
+  MPI_Barrier(MPI_COMM_WORLD);
+  return true;
+}
+
+bool Controller::all_registered() const { return known_workers.size() >= num_expected; }
+
+bool Controller::finished() const { return all_registered() && workers.empty(); }
+
+void Controller::connect_peers(const uint &_num_controllers)
+{
+  MPI_Group everyone, controllers;
+  std::vector<int> ranks(_num_controllers);
+  for (uint i = 0; i < _num_controllers; ++i) { ranks[i] = i; }
+
+  // Only the controllers take part, so workers need not know of this
+  MPI_Comm_group(comm, &everyone);
+  MPI_Group_incl(everyone, ranks.size(), ranks.data(), &controllers);
+  MPI_Comm_create_group(comm, controllers, 0, &peers);
+  MPI_Group_free(&controllers);
+  MPI_Group_free(&everyone);
+}
+
+void Controller::parallel_for(std::vector<WorkerRequest> &_batch, const RequestHandler &_handler)
+{
+  if (!pool) {
+    for (WorkerRequest &request : _batch) { _handler(request); }
+    return;
+  }
+
+  for (WorkerRequest &request : _batch) {
+    WorkerRequest *const to_handle = &request;
+    pool->submit([&_handler, to_handle]() { _handler(*to_handle); });
+  }
+  pool->wait();
+}
+
+void Controller::add_requests(const int &_rank, Worker &_worker,
+                              std::vector<WorkerRequest> &_into)
+{
+  if (_worker.parts.empty()) {
+    _into.push_back({_rank, &_worker.atoms, &_worker.fixes, _into.size(), &_worker.arrived,
+                     &_worker.departed, nullptr});
+    return;
+  }
+
+  for (Worker::Part &part : _worker.parts) {
+    if (!part.has_request) { continue; }
+    _into.push_back({_rank, &part.atoms, &part.fixes, _into.size(), &_worker.arrived,
+                     &_worker.departed, &part.fix});
+  }
+}
+
+bool Controller::receive(int &_source, bool &_is_request)
+{
+  MPI_Status status;
+  BinaryHeader header;
+  int count;
+
+  _is_request = false;
+  MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
+  _source = status.MPI_SOURCE;
+
+  // Binary packets are always requests, and land directly in columns
+  if (status.MPI_TAG == ARBFN_MPI_TAG_BINARY) {
+    MPI_Get_count(&status, MPI_BYTE, &count);
+    const auto it = workers.find(_source);
+    if (it == workers.end()) {
+      text.resize(count);
+      MPI_Recv(text.data(), count, MPI_BYTE, _source, status.MPI_TAG, comm, &status);
+      std::cerr << "Unregistered worker " << _source << " sent binary request\n";
+      return false;
+    }
+
+    // Workers with several fixes send them all in one request
+    Worker &worker = it->second;
+    if (!worker.parts.empty()) {
+      if (!receive_parts(_source, worker, count)) { return false; }
+      _is_request = true;
+      return true;
+    }
+
+    // In delta mode, the atoms sent are merged into those known
+    const bool is_delta = (worker.mode == ARBFN_MODE_DELTA);
+    AtomBuffer &into = (is_delta ? worker.changed : worker.atoms);
+    if (worker.format == ARBFN_FORMAT_SHARED) {
+      if (!receive_shared(_source, worker, count)) { return false; }
+      worker.has_request = true;
+      _is_request = true;
+      return true;
+    }
+    // Atoms at reduced precision are widened once received
+    const bool is_reduced = (into.precision != ARBFN_PRECISION_DOUBLE);
+    std::vector<char> &received = (is_reduced ? into.packed : into.packet);
+    received.resize(count);
+    MPI_Recv(received.data(), count, MPI_BYTE, _source, status.MPI_TAG, comm, &status);
+
+    if ((size_t) count < sizeof(BinaryHeader)) {
+      std::cerr << "Worker " << _source << " sent truncated binary packet\n";
+      return false;
+    }
+    std::memcpy(&header, received.data(), sizeof(BinaryHeader));
+    if (header.magic != ARBFN_BINARY_MAGIC ||
+        header.type != (is_delta ? ARBFN_PACKET_DELTA : ARBFN_PACKET_REQUEST)) {
+      std::cerr << "Worker " << _source << " sent bad binary packet\n";
+      return false;
+    }
+    into.resize(header.n, header.fields);
+
+    // A delta may run on past the atoms, with the tags which left
+    const size_t size = packed_size(into);
+    const size_t num_left = ((size_t) count - std::min<size_t>(count, size)) / sizeof(double);
+    if (size + num_left * sizeof(double) != (size_t) count || (!is_delta && num_left > 0)) {
+      std::cerr << "Worker " << _source << " sent truncated binary packet\n";
+      return false;
+    }
+    if (is_reduced) { unpack(received.data(), into); }
+    if (is_delta) {
+      worker.left.resize(num_left);
+      std::memcpy(worker.left.data(), received.data() + size, num_left * sizeof(double));
+      if (!apply_delta(worker.atoms, worker.changed, worker.left.data(), num_left,
+                       worker.merged)) {
+        return false;
+      }
+    }
+
+    worker.format = ARBFN_FORMAT_BINARY;
+  }
+
+  // Otherwise, JSON
+  else {
+    MPI_Get_count(&status, MPI_CHAR, &count);
+    text.resize(count);
+    MPI_Recv(text.data(), count, MPI_CHAR, _source, status.MPI_TAG, comm, &status);
+
+    // Empty packets carry no information
+    if (count == 0) { return true; }
+
+    const boost::json::value parsed =
+        boost::json::parse(boost::json::string_view(text.data(), text.size()));
+    const boost::json::object *const json = parsed.if_object();
+    const boost::json::value *const type = (json ? json->if_contains("type") : nullptr);
+    if (type == nullptr) {
+      std::cerr << "Worker " << _source << " sent packet without type\n";
+      return false;
+    }
+
+    // Register a new worker, or re-register at the start of a run
+    if (*type == "register") {
+      known_workers.insert(_source);
+
+      Worker &worker = workers[_source];
+      worker.has_request = false;
+      worker.fields = fields_of(*json);
+      worker.parts.clear();
+
+      // Several fixes register together, each announcing its own
+      // fields and terms, then send full requests together over MPI
+      const boost::json::value *const parts = json->if_contains("fixes");
+      if (parts != nullptr && parts->is_array()) {
+        const boost::json::value *const format = json->if_contains("format");
+        const bool binary = allow_binary && format != nullptr && *format == "binary";
+        worker.format = (binary ? ARBFN_FORMAT_BINARY : ARBFN_FORMAT_JSON);
+        worker.mode = ARBFN_MODE_REQUEST;
+        worker.migrate = false;
+        worker.segment.close();
+        worker.tiles.clear();
+        worker.arrived.clear();
+        worker.departed.clear();
+
+        std::string ack = (binary ? "{\"type\":\"ack\",\"format\":\"binary\",\"fixes\":["
+                                  : "{\"type\":\"ack\",\"fixes\":[");
+        worker.parts.resize(parts->as_array().size());
+        for (size_t k = 0; k < worker.parts.size(); ++k) {
+          const boost::json::object *const entry = parts->as_array()[k].if_object();
+          const boost::json::value *const id = (entry ? entry->if_contains("fix") : nullptr);
+          if (id == nullptr || !id->is_string()) {
+            std::cerr << "Worker " << _source << " registered fix without ID\n";
+            return false;
+          }
+          Worker::Part &part = worker.parts[k];
+          part.fix = id->as_string().c_str();
+          part.fields = fields_of(*entry);
+          part.fixes.set_terms(terms_of(*entry));
+
+          ack += (k == 0 ? "{\"fix\":" : ",{\"fix\":");
+          ack += boost::json::serialize(boost::json::string_view(part.fix));
+          append_terms(ack, part.fixes.terms);
+          ack += '}';
+        }
+        ack += "]}";
+        send_json(_source, ack);
+
+        // This may have been the last worker the group awaited
+        form_group();
+        return true;
+      }
+
+      // Grid mode is only agreed to once there is a grid to send
+      const boost::json::value *const mode = json->if_contains("mode");
+      const bool grid_mode = mode != nullptr && *mode == "grid" && grid.size() > 0;
+      const bool delta_mode = mode != nullptr && *mode == "delta";
+      worker.mode = (grid_mode ? ARBFN_MODE_GRID
+                               : (delta_mode ? ARBFN_MODE_DELTA : ARBFN_MODE_REQUEST));
+
+      // Memory is shared outside grid mode if the worker's segment
+      // can be opened here, else binary packets are sent over MPI
+      const boost::json::value *const format = json->if_contains("format");
+      const boost::json::value *const segment = json->if_contains("segment");
+      const boost::json::value *const token = json->if_contains("token");
+      const bool shared = allow_binary && format != nullptr && *format == "shared" &&
+                          !grid_mode && segment != nullptr && segment->is_string() &&
+                          token != nullptr && token->is_number() &&
+                          worker.segment.open(segment->as_string().c_str(),
+                                              token->to_number<uint64_t>());
+      const bool binary =
+          allow_binary && format != nullptr && (*format == "binary" || *format == "shared");
+      worker.format =
+          (shared ? ARBFN_FORMAT_SHARED : (binary ? ARBFN_FORMAT_BINARY : ARBFN_FORMAT_JSON));
+      if (!shared) { worker.segment.close(); }
+
+      // Binary packets may travel at reduced precision, outside grid
+      // mode
+      const boost::json::value *const precision = json->if_contains("precision");
+      ARBFNPrecision agreed = ARBFN_PRECISION_DOUBLE;
+      if (binary && !grid_mode && precision != nullptr && precision->is_string() &&
+          !precision_from_name(precision->as_string().c_str(), agreed)) {
+        agreed = ARBFN_PRECISION_DOUBLE;
+      }
+      worker.atoms.precision = worker.changed.precision = worker.merged.precision = agreed;
+      worker.fixes.precision = agreed;
+
+      // Collective workers send full requests all at once, which
+      // only `serve_bulk` answers. Once the group is made, only its
+      // members may rejoin it.
+      const boost::json::value *const collective = json->if_contains("collective");
+      const bool in_group = group.comm == MPI_COMM_NULL ||
+                            std::count(group.ranks.begin(), group.ranks.end(), _source) > 0;
+      const bool is_collective = binary && !shared && serving_bulk && !grid_mode &&
+                                 !delta_mode && collective != nullptr && *collective == true &&
+                                 in_group;
+      if (is_collective) {
+        worker.format = ARBFN_FORMAT_COLLECTIVE;
+        if (group.comm == MPI_COMM_NULL) { group.joining.insert(_source); }
+      }
+
+      // Workers which send IDs may tell of atoms migrating, except
+      // collective ones, whose requests may overtake the news
+      const boost::json::value *const migrate = json->if_contains("migrate");
+      worker.migrate = migrate != nullptr && *migrate == true &&
+                       (worker.fields & ARBFN_FIELD_ID) && !grid_mode && !is_collective;
+
+      // Any terms asked for follow the force deltas in each response
+      const uint64_t terms = (grid_mode ? 0 : terms_of(*json));
+      worker.fixes.set_terms(terms);
+
+      // The worker starts over with its tiles or atoms
+      worker.tiles.clear();
+      worker.atoms.resize(0, 0);
+      worker.arrived.clear();
+      worker.departed.clear();
+
+      // Workers in grid mode are told the grid's layout, then fetch
+      // only the tiles they need
+      std::string ack = "{\"type\":\"ack\"";
+      if (shared) {
+        ack += ",\"format\":\"shared\"";
+      } else if (binary) {
+        ack += ",\"format\":\"binary\"";
+      }
+      if (delta_mode) { ack += ",\"mode\":\"delta\""; }
+      if (worker.migrate) { ack += ",\"migrate\":true"; }
+      append_terms(ack, terms);
+      if (is_collective) { ack += ",\"collective\":true"; }
+      if (agreed != ARBFN_PRECISION_DOUBLE) {
+        ack += ",\"precision\":\"" + std::string(precision_name(agreed)) + "\"";
+      }
+      if (grid_mode) {
+        ack += ",\"mode\":\"grid\",\"grid\":{\"dims\":[";
+        for (size_t d = 0; d < 3; ++d) {
+          ack += (d == 0 ? "" : ",") + std::to_string(grid.dims[d]);
+        }
+        static const char *const corners[2] = {"],\"lo\":[", "],\"hi\":["};
+        for (size_t corner = 0; corner < 2; ++corner) {
+          ack += corners[corner];
+          for (size_t d = 0; d < 3; ++d) {
+            if (d > 0) { ack += ','; }
+            append_double(ack, corner == 0 ? grid.lo[d] : grid.hi[d]);
+          }
+        }
+        ack += "],\"tile\":" + std::to_string(tile_size) + '}';
+      }
+      ack += '}';
+      send_json(_source, ack);
+
+      // This may have been the last worker the group awaited
+      form_group();
+      return true;
+    }
+
+    // Send a worker in grid mode the tiles it asks for, and stop
+    // pushing those it no longer needs
+    else if (*type == "tiles") {
+      const auto it = workers.find(_source);
+      if (it == workers.end() || it->second.mode != ARBFN_MODE_GRID) {
+        std::cerr << "Worker " << _source << " asked for tiles outside grid mode\n";
+        return false;
+      }
+      Worker &worker = it->second;
+
+      const boost::json::value *const drop = json->if_contains("drop");
+      if (drop != nullptr && drop->is_array()) {
+        for (const boost::json::value &index : drop->as_array()) {
+          worker.tiles.erase(index.to_number<uint64_t>());
+        }
+      }
+
+      const boost::json::value *const fetch = json->if_contains("fetch");
+      const uint64_t num_tiles = tiles_along(grid, tile_size, 0) * tiles_along(grid, tile_size, 1) *
+                                 tiles_along(grid, tile_size, 2);
+      std::vector<char> packet;
+      ForceGrid tile;
+      if (fetch != nullptr && fetch->is_array()) {
+        for (const boost::json::value &value : fetch->as_array()) {
+          const uint64_t index = value.to_number<uint64_t>();
+          if (index >= num_tiles) {
+            std::cerr << "Worker " << _source << " asked for nonexistent tile " << index << "\n";
+            return false;
+          }
+          worker.tiles.insert(index);
+
+          extract_tile(grid, tile_size, index, tile);
+          encode_grid(tile, index, worker.format, packet);
+          MPI_Send(packet.data(), packet.size(),
+                   worker.format == ARBFN_FORMAT_BINARY ? MPI_BYTE : MPI_CHAR, _source,
+                   worker.format == ARBFN_FORMAT_BINARY ? ARBFN_MPI_TAG_BINARY
+                                                        : ARBFN_MPI_TAG_JSON,
+                   comm);
+        }
+      }
+      return true;
+    }
+
+    // Note which atoms came and went, for the next request
+    else if (*type == "migrate") {
+      const auto it = workers.find(_source);
+      if (it == workers.end() || !it->second.migrate) {
+        std::cerr << "Worker " << _source << " sent unexpected migration\n";
+        return false;
+      }
+      Worker &worker = it->second;
+
+      const boost::json::value *const arrived = json->if_contains("arrived");
+      if (arrived != nullptr && arrived->is_array()) {
+        for (const boost::json::value &tag : arrived->as_array()) {
+          worker.arrived.push_back(tag.to_number<double>());
+        }
+      }
+      const boost::json::value *const departed = json->if_contains("left");
+      if (departed != nullptr && departed->is_array()) {
+        for (const boost::json::value &tag : departed->as_array()) {
+          worker.departed.push_back(tag.to_number<double>());
+        }
+      }
+      return true;
+    }
+
+    // Erase a worker. One in grid mode awaits an ack, behind which
+    // any grids still in flight to it are drained.
+    else if (*type == "deregister") {
+      const auto it = workers.find(_source);
+      if (it != workers.end() && it->second.mode == ARBFN_MODE_GRID) {
+        send_json(_source, "{\"type\":\"ack\"}");
+      }
+      workers.erase(_source);
+      return true;
+    }
+
+    // Stage a request
+    else if (*type == "request") {
+      const auto it = workers.find(_source);
+      if (it == workers.end()) {
+        std::cerr << "Unregistered worker " << _source << " sent request\n";
+        return false;
+      }
+      Worker &worker = it->second;
+      if (worker.parts.empty()) {
+        if (!stage_json(*json, worker.fields, worker.atoms)) { return false; }
+        worker.format = ARBFN_FORMAT_JSON;
+      }
+
+      // Those of several fixes come in parts, in the order registered
+      else {
+        const boost::json::value *const parts = json->if_contains("fixes");
+        if (parts == nullptr || !parts->is_array()) {
+          std::cerr << "Worker " << _source << " sent request without fixes\n";
+          return false;
+        }
+        for (Worker::Part &part : worker.parts) { part.has_request = false; }
+        size_t k = 0;
+        for (const boost::json::value &value : parts->as_array()) {
+          const boost::json::object *const entry = value.if_object();
+          const boost::json::value *const id = (entry ? entry->if_contains("fix") : nullptr);
+          while (k < worker.parts.size() &&
+                 (id == nullptr || !id->is_string() ||
+                  worker.parts[k].fix != id->as_string().c_str())) {
+            ++k;
+          }
+          if (k == worker.parts.size()) {
+            std::cerr << "Worker " << _source << " sent request for unknown fix\n";
+            return false;
+          }
+          Worker::Part &part = worker.parts[k];
+          if (!stage_json(*entry, part.fields, part.atoms)) { return false; }
+          part.prefix.fix = k++;
+          part.has_request = true;
+        }
+      }
+    }
+
+    // Merge the atoms sent into those known
+    else if (*type == "delta") {
+      const auto it = workers.find(_source);
+      if (it == workers.end() || it->second.mode != ARBFN_MODE_DELTA) {
+        std::cerr << "Worker " << _source << " sent delta outside delta mode\n";
+        return false;
+      }
+      Worker &worker = it->second;
+      if (!stage_json(*json, worker.fields, worker.changed)) { return false; }
+
+      const boost::json::value *const left = json->if_contains("left");
+      worker.left.clear();
+      if (left != nullptr && left->is_array()) {
+        for (const boost::json::value &tag : left->as_array()) {
+          worker.left.push_back(tag.to_number<double>());
+        }
+      }
+      if (!apply_delta(worker.atoms, worker.changed, worker.left.data(), worker.left.size(),
+                       worker.merged)) {
+        return false;
+      }
+      worker.format = ARBFN_FORMAT_JSON;
+    }
+
+    else {
+      std::cerr << "Worker " << _source << " sent bad packet w/ type '" << *type << "'\n";
+      return false;
+    }
+  }
+
+  // Prepare zeroed fixes for the handler
+  Worker &worker = workers.at(_source);
+  if (worker.parts.empty()) { zero_fixes(worker.fixes, worker.atoms.n); }
+  for (Worker::Part &part : worker.parts) {
+    if (part.has_request) { zero_fixes(part.fixes, part.atoms.n); }
+  }
+  worker.has_request = true;
+  _is_request = true;
+
+  return true;
+}
+
+bool Controller::receive_shared(const int &_source, Worker &_worker, const int &_count)
+{
+  SharedDoorbell doorbell;
+  MPI_Status status;
+
+  if ((size_t) _count != sizeof(SharedDoorbell)) {
+    text.resize(_count);
+    MPI_Recv(text.data(), _count, MPI_BYTE, _source, ARBFN_MPI_TAG_BINARY, comm, &status);
+    std::cerr << "Worker " << _source << " sent binary packet in shared format\n";
+    return false;
+  }
+  MPI_Recv(&doorbell, _count, MPI_BYTE, _source, ARBFN_MPI_TAG_BINARY, comm, &status);
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  // The packet lies in the segment, as it would have been sent. A
+  // delta may run on past the atoms, with the tags which left.
+  const BinaryHeader &header = doorbell.header;
+  const bool is_delta = (_worker.mode == ARBFN_MODE_DELTA);
+  const bool is_reduced = (_worker.atoms.precision != ARBFN_PRECISION_DOUBLE);
+  const bool is_valid = header.magic == ARBFN_BINARY_MAGIC &&
+                        header.type == (is_delta ? ARBFN_PACKET_DELTA : ARBFN_PACKET_REQUEST);
+  AtomBuffer &into = (is_delta ? _worker.changed : _worker.atoms);
+  if (is_valid && is_reduced) { into.resize(header.n, header.fields); }
+  const size_t size = (is_reduced ? packed_size(into)
+                                   : sizeof(BinaryHeader) +
+                                         field_columns(header.fields) * header.n * sizeof(double));
+  if (!is_valid || doorbell.bytes < size || (doorbell.bytes - size) % sizeof(double) != 0 ||
+      (!is_delta && doorbell.bytes != size) ||
+      !_worker.segment.reserve(ARBFN_SHARED_REQUEST_OFFSET + doorbell.bytes)) {
+    std::cerr << "Worker " << _source << " sent bad shared packet\n";
+    return false;
+  }
+
+  // Atoms at reduced precision are widened out of the segment, and
+  // others viewed in place
+  char *const packet = _worker.segment.data() + ARBFN_SHARED_REQUEST_OFFSET;
+  if (is_reduced) {
+    unpack(packet, into);
+  } else if (is_delta) {
+    _worker.changed.place(packet, header.n, header.fields);
+  }
+  if (is_delta) {
+    if (!apply_delta(_worker.atoms, _worker.changed,
+                     reinterpret_cast<const double *>(packet + size),
+                     (doorbell.bytes - size) / sizeof(double), _worker.merged)) {
+      return false;
+    }
+  }
+
+  // The handler reads the atoms and writes zeroed fixes in place.
+  // Growing the mapping may move it, so views are placed last.
+  const size_t response = shared_response_offset(doorbell.bytes);
+  const size_t num_fixes = (is_delta ? _worker.atoms.n : header.n);
+  if (!_worker.segment.reserve(response + sizeof(BinaryHeader) +
+                               _worker.fixes.width * num_fixes * sizeof(double))) {
+    std::cerr << "Worker " << _source << " left no room for its response\n";
+    return false;
+  }
+  _worker.response_offset = response;
+  if (is_reduced) {
+    _worker.fixes.resize(num_fixes);
+  } else {
+    if (!is_delta) {
+      _worker.atoms.place(_worker.segment.data() + ARBFN_SHARED_REQUEST_OFFSET, header.n,
+                          header.fields);
+    }
+    _worker.fixes.place(_worker.segment.data() + response, num_fixes);
+  }
+  std::fill(_worker.fixes.column(0),
+            _worker.fixes.column(0) + _worker.fixes.width * _worker.fixes.n, 0.0);
+  return true;
+}
+
+bool Controller::receive_parts(const int &_source, Worker &_worker, const int &_count)
+{
+  std::vector<char> &received = _worker.atoms.packet;
+  MPI_Status status;
+  BinaryHeader header;
+
+  received.resize(_count);
+  MPI_Recv(received.data(), _count, MPI_BYTE, _source, ARBFN_MPI_TAG_BINARY, comm, &status);
+  std::memcpy(&header, received.data(), std::min<size_t>(sizeof(BinaryHeader), _count));
+  if ((size_t) _count < sizeof(BinaryHeader) || header.magic != ARBFN_BINARY_MAGIC ||
+      header.type != ARBFN_PACKET_MULTIPLEX) {
+    std::cerr << "Worker " << _source << " sent bad multiplexed packet\n";
+    return false;
+  }
+
+  // Each part is a request of its own, viewed in place. They come in
+  // the order registered, and go back in the same order.
+  for (Worker::Part &part : _worker.parts) { part.has_request = false; }
+  size_t offset = sizeof(BinaryHeader), next = 0;
+  for (uint64_t k = 0; k < header.n; ++k) {
+    MultiplexPart prefix;
+    BinaryHeader inner;
+    if (offset + sizeof(MultiplexPart) + sizeof(BinaryHeader) > (size_t) _count) { break; }
+    std::memcpy(&prefix, received.data() + offset, sizeof(MultiplexPart));
+    offset += sizeof(MultiplexPart);
+    std::memcpy(&inner, received.data() + offset, sizeof(BinaryHeader));
+    if (prefix.fix < next || prefix.fix >= _worker.parts.size() ||
+        inner.magic != ARBFN_BINARY_MAGIC || inner.type != ARBFN_PACKET_REQUEST ||
+        prefix.bytes != sizeof(BinaryHeader) +
+                            field_columns(inner.fields) * inner.n * sizeof(double) ||
+        offset + prefix.bytes > (size_t) _count) {
+      break;
+    }
+
+    Worker::Part &part = _worker.parts[prefix.fix];
+    part.atoms.place(received.data() + offset, inner.n, inner.fields);
+    zero_fixes(part.fixes, inner.n);
+    part.prefix = prefix;
+    part.has_request = true;
+    offset += prefix.bytes;
+    next = prefix.fix + 1;
+  }
+  if (offset != (size_t) _count) {
+    std::cerr << "Worker " << _source << " sent bad part in multiplexed packet\n";
+    return false;
+  }
+
+  _worker.has_request = true;
+  return true;
+}
+
+void Controller::respond_parts(const int &_rank, Worker &_worker)
+{
+  if (_worker.format == ARBFN_FORMAT_BINARY) {
+    // Each fix buffer is already laid out as a response packet, so
+    // the parts are sent from where they lie
+    std::vector<std::pair<const void *, size_t>> pieces;
+    BinaryHeader header, inner;
+    header.magic = inner.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_MULTIPLEX;
+    inner.type = ARBFN_PACKET_RESPONSE;
+    header.n = 0;
+    header.fields = inner.fields = 0;
+    header.expect_response = inner.expect_response = 0.0;
+    pieces.emplace_back(&header, sizeof(BinaryHeader));
+    for (Worker::Part &part : _worker.parts) {
+      if (!part.has_request) { continue; }
+      inner.n = part.fixes.n;
+      std::memcpy(part.fixes.packet.data(), &inner, sizeof(BinaryHeader));
+      part.prefix.bytes = part.fixes.packet.size();
+      pieces.emplace_back(&part.prefix, sizeof(MultiplexPart));
+      pieces.emplace_back(part.fixes.packet.data(), part.fixes.packet.size());
+      ++header.n;
+    }
+
+    MPI_Datatype type = scattered_type(pieces);
+    MPI_Send(MPI_BOTTOM, 1, type, _rank, ARBFN_MPI_TAG_BINARY, comm);
+    MPI_Type_free(&type);
+  } else {
+    reply = "{\"type\":\"response\",\"fixes\":[";
+    bool is_first = true;
+    for (const Worker::Part &part : _worker.parts) {
+      if (!part.has_request) { continue; }
+      reply += (is_first ? "{\"fix\":" : ",{\"fix\":");
+      reply += boost::json::serialize(boost::json::string_view(part.fix));
+      reply += ",\"atoms\":";
+      append_json_fixes(reply, part.fixes);
+      reply += '}';
+      is_first = false;
+    }
+    reply += "]}";
+    send_json(_rank, reply);
+  }
+
+  for (Worker::Part &part : _worker.parts) { part.has_request = false; }
+}
+
+void Controller::respond(const int &_rank, Worker &_worker)
+{
+  const size_t n = _worker.fixes.n;
+
+  if (!_worker.parts.empty()) {
+    respond_parts(_rank, _worker);
+  } else if (_worker.format == ARBFN_FORMAT_SHARED) {
+    // The fixes are already in place: Just ring the doorbell
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_RESPONSE;
+    header.n = n;
+    header.fields = 0;
+    header.expect_response = 0.0;
+    std::memcpy(_worker.fixes.data(), &header, sizeof(BinaryHeader));
+    if (_worker.fixes.precision != ARBFN_PRECISION_DOUBLE) {
+      pack(_worker.fixes, _worker.segment.data() + _worker.response_offset);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    MPI_Send(&header, sizeof(BinaryHeader), MPI_BYTE, _rank, ARBFN_MPI_TAG_BINARY, comm);
+  } else if (_worker.format == ARBFN_FORMAT_BINARY) {
+    // The fix buffer is already laid out as a response packet, unless
+    // it travels at reduced precision
+    const bool is_reduced = (_worker.fixes.precision != ARBFN_PRECISION_DOUBLE);
+    std::vector<char> &to_send = (is_reduced ? _worker.fixes.packed : _worker.fixes.packet);
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_RESPONSE;
+    header.n = n;
+    header.fields = 0;
+    header.expect_response = 0.0;
+    std::memcpy(_worker.fixes.packet.data(), &header, sizeof(BinaryHeader));
+    if (is_reduced) {
+      to_send.resize(packed_size(_worker.fixes));
+      pack(_worker.fixes, to_send.data());
+    }
+    MPI_Send(to_send.data(), to_send.size(), MPI_BYTE, _rank, ARBFN_MPI_TAG_BINARY, comm);
+  } else {
+    reply = "{\"type\":\"response\",\"atoms\":";
+    append_json_fixes(reply, _worker.fixes);
+    reply += '}';
+    send_json(_rank, reply);
+  }
+
+  _worker.has_request = false;
+  _worker.arrived.clear();
+  _worker.departed.clear();
+  ++requests;
+}
+
+void Controller::form_group()
+{
+  MPI_Group everyone, members;
+  int rank;
+
+  if (group.comm != MPI_COMM_NULL || group.joining.empty() || !all_registered()) { return; }
+
+  // This controller is rank 0, and the workers follow in rank order
+  MPI_Comm_rank(comm, &rank);
+  group.ranks.assign(1, rank);
+  group.ranks.insert(group.ranks.end(), group.joining.begin(), group.joining.end());
+  group.joining.clear();
+
+  reply = "{\"type\":\"group\",\"ranks\":[";
+  for (size_t i = 0; i < group.ranks.size(); ++i) {
+    reply += (i == 0 ? "" : ",") + std::to_string(group.ranks[i]);
+  }
+  reply += "]}";
+  for (size_t i = 1; i < group.ranks.size(); ++i) { send_json(group.ranks[i], reply); }
+
+  MPI_Comm_group(comm, &everyone);
+  MPI_Group_incl(everyone, group.ranks.size(), group.ranks.data(), &members);
+  MPI_Comm_create_group(comm, members, ARBFN_MPI_TAG_GROUP, &group.comm);
+  MPI_Group_free(&members);
+  MPI_Group_free(&everyone);
+
+  post_group_gather();
+}
+
+void Controller::post_group_gather()
+{
+  group.sizes.assign(group.ranks.size(), 0);
+  MPI_Igather(MPI_IN_PLACE, 1, MPI_UINT64_T, group.sizes.data(), 1, MPI_UINT64_T, 0, group.comm,
+              &group.request);
+}
+
+bool Controller::gather_group()
+{
+  const size_t num_members = group.ranks.size();
+  size_t num_leaving = 0, total = 0;
+  BinaryHeader header;
+
+  // Members leave together, after which the group is of no more use
+  for (size_t i = 1; i < num_members; ++i) {
+    if (group.sizes[i] == ARBFN_GROUP_LEAVING) { ++num_leaving; }
+  }
+  if (num_leaving == num_members - 1) {
+    MPI_Comm_free(&group.comm);
+    group.ranks.clear();
+    return true;
+  } else if (num_leaving > 0) {
+    std::cerr << "Only " << num_leaving << " of " << num_members - 1
+              << " collective workers left their group\n";
+    return false;
+  }
+
+  group.counts.assign(num_members, 0);
+  group.displs.assign(num_members, 0);
+  for (size_t i = 1; i < num_members; ++i) {
+    group.counts[i] = group.sizes[i];
+    group.displs[i] = total;
+    total += group.sizes[i];
+  }
+  group.gathered.resize(total);
+  MPI_Igatherv(MPI_IN_PLACE, 0, MPI_BYTE, group.gathered.data(), group.counts.data(),
+               group.displs.data(), MPI_BYTE, 0, group.comm, &group.request);
+  MPI_Wait(&group.request, MPI_STATUS_IGNORE);
+
+  // View each request in place, then lay the fixes out likewise.
+  // Those at reduced precision are widened into their own buffers.
+  total = 0;
+  for (size_t i = 1; i < num_members; ++i) {
+    const int rank = group.ranks[i];
+    Worker &worker = workers.at(rank);
+    const bool is_reduced = (worker.atoms.precision != ARBFN_PRECISION_DOUBLE);
+    char *const packet = group.gathered.data() + group.displs[i];
+    std::memcpy(&header, packet, std::min<size_t>(sizeof(BinaryHeader), group.sizes[i]));
+    const bool is_valid = group.sizes[i] >= sizeof(BinaryHeader) &&
+                          header.magic == ARBFN_BINARY_MAGIC &&
+                          header.type == ARBFN_PACKET_REQUEST;
+    if (is_valid && is_reduced) { worker.atoms.resize(header.n, header.fields); }
+    if (!is_valid ||
+        group.sizes[i] != (is_reduced ? packed_size(worker.atoms)
+                                      : sizeof(BinaryHeader) + field_columns(header.fields) *
+                                                                   header.n * sizeof(double))) {
+      std::cerr << "Worker " << rank << " gathered bad binary packet\n";
+      return false;
+    }
+
+    if (is_reduced) {
+      unpack(packet, worker.atoms);
+      worker.fixes.resize(header.n);
+      group.counts[i] = packed_size(worker.fixes);
+    } else {
+      worker.atoms.place(packet, header.n, header.fields);
+      group.counts[i] = sizeof(BinaryHeader) + worker.fixes.width * header.n * sizeof(double);
+    }
+    group.displs[i] = total;
+    total += group.counts[i];
+  }
+  group.scattered.resize(total);
+  for (size_t i = 1; i < num_members; ++i) {
+    Worker &worker = workers.at(group.ranks[i]);
+    if (worker.fixes.precision == ARBFN_PRECISION_DOUBLE) {
+      worker.fixes.place(group.scattered.data() + group.displs[i], worker.atoms.n);
+    }
+    std::fill(worker.fixes.column(0),
+              worker.fixes.column(0) + worker.fixes.width * worker.fixes.n, 0.0);
+    worker.has_request = true;
+  }
+
+  return true;
+}
+
+void Controller::scatter_group()
+{
+  BinaryHeader header;
+
+  header.magic = ARBFN_BINARY_MAGIC;
+  header.type = ARBFN_PACKET_RESPONSE;
+  header.fields = 0;
+  header.expect_response = 0.0;
+  for (size_t i = 1; i < group.ranks.size(); ++i) {
+    Worker &worker = workers.at(group.ranks[i]);
+    header.n = worker.fixes.n;
+    std::memcpy(worker.fixes.data(), &header, sizeof(BinaryHeader));
+    if (worker.fixes.precision != ARBFN_PRECISION_DOUBLE) {
+      pack(worker.fixes, group.scattered.data() + group.displs[i]);
+    }
+    worker.has_request = false;
+    worker.arrived.clear();
+    worker.departed.clear();
+    ++requests;
+  }
+
+  MPI_Iscatterv(group.scattered.data(), group.counts.data(), group.displs.data(), MPI_BYTE,
+                MPI_IN_PLACE, 0, MPI_BYTE, 0, group.comm, &group.request);
+  MPI_Wait(&group.request, MPI_STATUS_IGNORE);
+  post_group_gather();
+}
+
+void Controller::send_waiting(const int &_rank, const Worker &_worker)
+{
+  if (_worker.format != ARBFN_FORMAT_JSON) {
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_WAITING;
+    header.n = _worker.atoms.n;
+    header.fields = 0;
+    header.expect_response = 0.0;
+    MPI_Send(&header, sizeof(BinaryHeader), MPI_BYTE, _rank, ARBFN_MPI_TAG_BINARY, comm);
+  } else {
+    send_json(_rank, "{\"type\":\"waiting\"}");
+  }
+}
+
+void Controller::push_grid()
+{
+  std::map<uint64_t, std::shared_ptr<std::vector<char>>> packets[2];
+  ForceGrid tile;
+
+  finish_pushes(false);
+  for (const auto &p : workers) {
+    if (p.second.mode != ARBFN_MODE_GRID) { continue; }
+
+    for (const uint64_t &index : p.second.tiles) {
+      // Encode each tile once per format, then share between workers
+      const ARBFNFormat format = p.second.format;
+      std::shared_ptr<std::vector<char>> &packet = packets[format][index];
+      if (!packet) {
+        packet.reset(new std::vector<char>());
+        extract_tile(grid, tile_size, index, tile);
+        encode_grid(tile, index, format, *packet);
+      }
+
+      // Workers only look for grids between steps, so don't block
+      Push push;
+      push.packet = packet;
+      MPI_Isend(packet->data(), packet->size(),
+                format == ARBFN_FORMAT_BINARY ? MPI_BYTE : MPI_CHAR, p.first,
+                format == ARBFN_FORMAT_BINARY ? ARBFN_MPI_TAG_BINARY : ARBFN_MPI_TAG_JSON, comm,
+                &push.request);
+      pushes.push_back(push);
+    }
+  }
+}
+
+void Controller::finish_pushes(const bool &_wait)
+{
+  size_t kept = 0;
+  int done;
+
+  for (Push &push : pushes) {
+    if (_wait) {
+      MPI_Wait(&push.request, MPI_STATUS_IGNORE);
+      done = 1;
+    } else {
+      MPI_Test(&push.request, &done, MPI_STATUS_IGNORE);
+    }
+    if (!done) { pushes[kept++] = push; }
+  }
+  pushes.resize(kept);
+}
+
+void Controller::send_json(const int &_rank, const std::string &_what)
+{
+  MPI_Send(_what.c_str(), _what.size(), MPI_CHAR, _rank, ARBFN_MPI_TAG_JSON, comm);
+}
@@ -0,0 +1,496 @@
+/**
+ * @brief Defines a reusable controller-side server for the ARBFN
+ * protocol, so controllers need only provide the physics
+ * @author J Dehmel, J Schiffbauer, 2024, MIT License
+ */
+
+#ifndef ARBFN_CONTROLLER_H
+#define ARBFN_CONTROLLER_H
+
+#include "interchange.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mpi.h>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @struct WorkerRequest
+ * @brief One worker's request, as handed to a controller callback.
+ * Both buffers belong to the controller and are reused between
+ * requests, so must not be held onto after the callback returns.
+ * @var WorkerRequest::rank The worker's rank in the ARBFN comm
+ * @var WorkerRequest::atoms The atoms sent, as columns. Only the
+ * fields in `atoms->fields` are present.
+ * @var WorkerRequest::fixes Where to write the force deltas: Sized
+ * to match the atoms and zeroed beforehand. Columns 0 to 2 take the
+ * deltas, then come those of any terms the worker asked for, in
+ * `fixes->terms` (see `FixBuffer::term_column`): The rates of change
+ * of the deltas per unit time, each atom's potential energy, and its
+ * contribution to the virial.
+ * @var WorkerRequest::index The position of the request within the
+ * batch handed to a bulk handler, else among those sent together by
+ * the worker's fixes (always 0 for a worker with a single fix)
+ * @var WorkerRequest::arrived The tags of the atoms which arrived at
+ * the worker since its previous request, in ascending order. Only
+ * workers which send IDs say so (see `notify_migration`), and their
+ * first request has every atom arrive.
+ * @var WorkerRequest::departed The tags of the atoms which left the
+ * worker since its previous request, in ascending order
+ * @var WorkerRequest::fix For a worker running several `fix arbfn'
+ * instances over one channel, the ID of the fix which sent the
+ * request (else null). Each has its own atoms, fields and terms.
+ */
+struct WorkerRequest {
+  int rank;
+  const AtomBuffer *atoms;
+  FixBuffer *fixes;
+  size_t index;
+  const std::vector<double> *arrived, *departed;
+  const std::string *fix;
+};
+
+/// Computes the fixes for a single worker's request
+typedef std::function<void(WorkerRequest &)> RequestHandler;
+
+/// Computes the fixes for one request from every registered worker at once
+typedef std::function<void(std::vector<WorkerRequest> &)> BulkRequestHandler;
+
+/**
+ * @class ThreadPool
+ * @brief A fixed set of threads running submitted tasks. Each thread
+ * has its own queue, and idle threads steal the oldest task from the
+ * front of the others' queues, so uneven tasks still keep every
+ * thread busy while replies go out in roughly the order requested.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @brief Starts the threads
+   * @param _num_threads The number of threads to start
+   */
+  ThreadPool(const size_t &_num_threads);
+
+  /**
+   * @brief Stops the threads once all submitted tasks are done
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Queues a task to be run by some thread
+   * @param _task The task to run
+   */
+  void submit(const std::function<void()> &_task);
+
+  /**
+   * @brief Blocks until every submitted task has finished, running
+   * queued tasks on the calling thread in the meantime
+   */
+  void wait();
+
+  /**
+   * @brief Yields the number of threads in the pool
+   */
+  size_t size() const { return threads.size(); }
+
+ protected:
+  /**
+   * @brief Takes a task from the given queue, else steals one
+   * @param _home The queue to try first
+   * @param _into Where to save the task
+   * @return True if a task was taken, false if all were empty
+   */
+  bool take(const size_t &_home, std::function<void()> &_into);
+
+  /**
+   * @brief Runs a task, then counts it as finished
+   */
+  void run(std::function<void()> &_task);
+
+  /// Body of each thread
+  void work(const size_t &_home);
+
+  /**
+   * @struct Queue
+   * @brief One thread's queue of tasks
+   */
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next_queue, num_queued;
+
+  // Guards sleeping, waking and finishing
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  size_t num_unfinished;
+  bool quitting;
+};
+
+/**
+ * @class Controller
+ * @brief Serves ARBFN workers: Handles the communicator setup,
+ * registration (in any wire format), receiving requests into
+ * reusable column buffers (or viewing them in place, for workers
+ * which share memory), replying, "waiting" packets and shutdown.
+ * Construct it after `MPI_Init`, call `serve` or `serve_bulk` once,
+ * then destroy it before `MPI_Finalize`.
+ *
+ * With more than one thread, `serve` receives on the calling thread
+ * while handlers run on a pool, and each reply is sent as soon as
+ * its fixes are ready. Handlers must then be safe to call
+ * concurrently. Only the calling thread ever uses MPI, so
+ * `MPI_THREAD_FUNNELED` support suffices.
+ *
+ * Several controllers may run side by side, each serving the
+ * workers which picked it during discovery (see `fix arbfn ...
+ * shard`). They share the `peers` communicator for reductions
+ * across all atoms.
+ *
+ * A worker running several `fix arbfn' instances registers them
+ * together, then sends the atoms of all those due in one request
+ * (see `MultiplexedFix`). Each is handed to the handler as a request
+ * of its own, and the fixes all go back in one response.
+ */
+class Controller {
+ public:
+  /**
+   * @brief Performs both communicator splits expected of a
+   * controller, then takes part in discovery
+   * @param _allow_binary Whether to accept the binary wire format,
+   * and with it the shared one
+   * @param _num_threads The number of threads to run handlers on
+   */
+  Controller(const bool &_allow_binary = true, const size_t &_num_threads = 1);
+
+  /**
+   * @brief Frees the communicators
+   */
+  ~Controller();
+
+  Controller(const Controller &) = delete;
+  Controller &operator=(const Controller &) = delete;
+
+  /**
+   * @brief Answers each request as soon as its fixes are ready,
+   * until all workers have deregistered, then performs the final
+   * barrier
+   * @param _handler Computes the fixes for each request
+   * @return True on success, false on a protocol error
+   */
+  bool serve(const RequestHandler &_handler);
+
+  /**
+   * @brief Holds each request (sending "waiting" packets) until
+   * every worker which picked this controller has registered and
+   * sent a request, then answers them all at once. Continues until
+   * all workers have deregistered, then performs the final barrier.
+   *
+   * Workers which ask for the collective format are gathered from
+   * and scattered to together, over a group made once all workers
+   * have registered, so need no "waiting" packets.
+   * @param _handler Computes the fixes for all requests at once
+   * @return True on success, false on a protocol error
+   */
+  bool serve_bulk(const BulkRequestHandler &_handler);
+
+  /**
+   * @brief Runs a handler on every request of a batch, spread over
+   * the thread pool. For use within bulk handlers, EG to compute
+   * per-worker partial sums (indexed by `WorkerRequest::index`),
+   * then again to apply the combined result.
+   * @param _batch The requests
+   * @param _handler The handler to run on each
+   */
+  void parallel_for(std::vector<WorkerRequest> &_batch, const RequestHandler &_handler);
+
+  /// The ARBFN communicator
+  MPI_Comm comm;
+
+  /**
+   * @brief Connects all controllers (in rank order), for reductions
+   * within bulk handlers. Every controller must then serve at least
+   * one worker, so that all of them take part in each reduction.
+   */
+  MPI_Comm peers;
+
+  /// The number of requests answered so far
+  uintmax_t requests;
+
+  /**
+   * @brief The force grid for workers in grid mode (see `fix arbfn
+   * ... mode grid`). Set it before serving to accept such workers:
+   * Each is told its layout as it registers, then fetches the tiles
+   * around its subdomain. Its layout must not change while serving.
+   */
+  ForceGrid grid;
+
+  /// The number of nodes (at least 1) along each axis of a tile of the grid
+  uint64_t tile_size;
+
+  /**
+   * @brief Sends the current values of the tiles which each worker
+   * in grid mode holds, without blocking. Call it after changing
+   * the grid, from the thread which called `serve` or `serve_bulk`
+   * (EG from a bulk handler, or from a handler without a thread
+   * pool).
+   */
+  void push_grid();
+
+ protected:
+  /**
+   * @struct Worker
+   * @brief Everything known about one registered worker, along
+   * with its reusable buffers
+   * @var Worker::format The wire format agreed upon, and hence that
+   * of its requests. Collective workers are members of `group`.
+   * @var Worker::mode The mode agreed upon
+   * @var Worker::tiles In grid mode, the tiles the worker holds
+   * @var Worker::fields The fields announced at registration
+   * @var Worker::has_request Whether a request awaits its response
+   * @var Worker::atoms The atoms of the latest request. In delta
+   * mode, every atom the worker has sent, sorted by tag.
+   * @var Worker::fixes The fixes for the latest request
+   * @var Worker::changed In delta mode, the atoms of the latest delta
+   * @var Worker::left In delta mode, the tags of the atoms which the
+   * latest delta removed
+   * @var Worker::migrate Whether the worker tells of atoms migrating
+   * @var Worker::arrived The tags of the atoms which arrived since the
+   * latest response
+   * @var Worker::departed The tags of the atoms which left since the
+   * latest response
+   * @var Worker::segment In the shared format, the memory shared
+   * with the worker. Its atoms and fixes are views into it, unless
+   * they travel at reduced precision.
+   * @var Worker::response_offset In the shared format, where the
+   * response to the latest request goes within the segment
+   * @var Worker::parts For a worker running several fixes over one
+   * channel, each fix, numbered in the order registered. Its own
+   * `atoms` and `fixes` are then unused.
+   */
+  struct Worker {
+    ARBFNFormat format = ARBFN_FORMAT_JSON;
+    ARBFNMode mode = ARBFN_MODE_REQUEST;
+    std::set<uint64_t> tiles;
+    uint64_t fields = ARBFN_DEFAULT_FIELDS;
+    bool has_request = false;
+    AtomBuffer atoms;
+    FixBuffer fixes;
+    AtomBuffer changed, merged;
+    std::vector<double> left;
+    bool migrate = false;
+    std::vector<double> arrived, departed;
+    SharedSegment segment;
+    size_t response_offset = 0;
+
+    /**
+     * @struct Part
+     * @brief One of the fixes of a worker which sends several
+     * @var Part::fix The ID of the fix
+     * @var Part::fields The fields it announced at registration
+     * @var Part::has_request Whether the latest request included it
+     * @var Part::atoms Its atoms in the latest request. In the binary
+     * format, a view into the worker's `atoms.packet`.
+     * @var Part::fixes Its fixes for the latest request
+     * @var Part::prefix The prefix of its part of the latest request
+     */
+    struct Part {
+      std::string fix;
+      uint64_t fields = ARBFN_DEFAULT_FIELDS;
+      bool has_request = false;
+      AtomBuffer atoms;
+      FixBuffer fixes;
+      MultiplexPart prefix;
+    };
+    std::vector<Part> parts;
+  };
+
+  /**
+   * @brief Receives and handles one packet. Registration and
+   * deregistration are dealt with entirely here.
+   * @param _source Where to save the rank of the sender
+   * @param _is_request Where to save whether the packet was a
+   * request, now staged in the sender's `Worker`
+   * @return True on success, false on a protocol error
+   */
+  bool receive(int &_source, bool &_is_request);
+
+  /**
+   * @brief Receives the doorbell of a worker in the shared format,
+   * then views its request and zeroed fixes in place
+   * @param _source The rank of the worker
+   * @param _worker The worker
+   * @param _count The size of the doorbell
+   * @return True on success, false on a protocol error
+   */
+  bool receive_shared(const int &_source, Worker &_worker, const int &_count);
+
+  /**
+   * @brief Receives a binary request from a worker with several
+   * fixes, then views the atoms of each part in place along with
+   * zeroed fixes
+   * @param _source The rank of the worker
+   * @param _worker The worker
+   * @param _count The size of the request
+   * @return True on success, false on a protocol error
+   */
+  bool receive_parts(const int &_source, Worker &_worker, const int &_count);
+
+  /**
+   * @brief Appends the requests staged by a worker to a batch: One
+   * per part it sent, else just the one
+   * @param _rank The rank of the worker
+   * @param _worker The worker
+   * @param _into The batch to append to
+   */
+  void add_requests(const int &_rank, Worker &_worker, std::vector<WorkerRequest> &_into);
+
+  /**
+   * @brief Sends a worker the fixes in its buffer, in its format
+   */
+  void respond(const int &_rank, Worker &_worker);
+
+  /**
+   * @brief Sends a worker with several fixes those of each part of
+   * its latest request, together
+   */
+  void respond_parts(const int &_rank, Worker &_worker);
+
+  /**
+   * @brief Makes the group of the collective workers, once every
+   * worker has registered, then awaits their first requests
+   */
+  void form_group();
+
+  /**
+   * @brief Gathers the requests of the collective workers, whose
+   * sizes have just been gathered, then views them in place along
+   * with zeroed fixes. If all are leaving instead, frees the group.
+   * @return True on success, false on a protocol error
+   */
+  bool gather_group();
+
+  /**
+   * @brief Scatters the fixes of all collective workers, then
+   * awaits their next requests
+   */
+  void scatter_group();
+
+  /**
+   * @brief Begins gathering the sizes of the collective workers' next
+   * requests
+   */
+  void post_group_gather();
+
+  /**
+   * @brief Tells a worker that its response is not ready yet
+   */
+  void send_waiting(const int &_rank, const Worker &_worker);
+
+  /**
+   * @brief Sends a JSON string to a worker
+   */
+  void send_json(const int &_rank, const std::string &_what);
+
+  /**
+   * @brief The body of `serve` when handlers run on the pool
+   */
+  bool serve_pooled(const RequestHandler &_handler);
+
+  /**
+   * @brief Whether every worker which picked this controller has
+   * registered
+   */
+  bool all_registered() const;
+
+  /**
+   * @brief Whether all workers have come and gone, so serving is over
+   */
+  bool finished() const;
+
+  /**
+   * @brief Completes the grid pushes which have been received
+   * @param _wait Whether to wait for all of them, rather than just
+   * forgetting those already done
+   */
+  void finish_pushes(const bool &_wait = true);
+
+  /**
+   * @brief Creates `peers` from the lowest ranks, which are the
+   * controllers
+   */
+  void connect_peers(const uint &_num_controllers);
+
+  bool allow_binary;
+  MPI_Comm junk_comm;
+
+  // Runs handlers when there is more than one thread
+  std::unique_ptr<ThreadPool> pool;
+
+  // Registered workers, by rank
+  std::map<int, Worker> workers;
+
+  // Every worker which has ever registered, and the number which
+  // picked this controller during discovery
+  std::set<int> known_workers;
+  size_t num_expected;
+
+  /**
+   * @struct Push
+   * @brief A grid push in flight, and the packet it is sending
+   */
+  struct Push {
+    MPI_Request request;
+    std::shared_ptr<std::vector<char>> packet;
+  };
+  std::vector<Push> pushes;
+
+  /**
+   * @struct Group
+   * @brief This controller (at rank 0) and its collective workers
+   * @var Group::comm The group's communicator, made by `form_group`
+   * @var Group::ranks The ARBFN ranks of its members, in group order
+   * @var Group::joining The collective workers awaiting the group
+   * @var Group::request The collective in progress
+   * @var Group::sizes The sizes of the members' requests
+   * @var Group::counts The size of each member's part of a gather or
+   * scatter
+   * @var Group::displs The offset of each member's part
+   * @var Group::gathered The members' requests, end to end
+   * @var Group::scattered The members' fixes, end to end
+   */
+  struct Group {
+    MPI_Comm comm = MPI_COMM_NULL;
+    std::vector<int> ranks;
+    std::set<int> joining;
+    MPI_Request request = MPI_REQUEST_NULL;
+    std::vector<uint64_t> sizes;
+    std::vector<int> counts, displs;
+    std::vector<char> gathered, scattered;
+  };
+  Group group;
+
+  // Whether `serve_bulk` is serving, so collectives can be answered
+  bool serving_bulk;
+
+  // Reused receive and send buffers for JSON text
+  std::vector<char> text;
+  std::string reply;
+};
+
+#endif
@@ -1,18 +1,130 @@
 #include "fix_arbfn.h"
+#include "domain.h"
 #include "interchange.h"
+#include "memory.h"
+#include "modify.h"
+#include "neighbor.h"
+#include "timer.h"
+#include "update.h"
 #include "utils.h"
+#include <algorithm>
+#include <cmath>
 #include <mpi.h>
 #include <string>
 #include <vector>
 
+/**
+ * @brief Copies one per-atom vector quantity of some of the given
+ * atoms into the three component columns of a staging buffer
+ * @param _src The LAMMPS per-atom array to read from
+ * @param _indices The local indices of the atoms to copy
+ * @param _begin The first of the atoms to copy
+ * @param _end One past the last of the atoms to copy
+ * @param _into The staging buffer to write into
+ * @param _field The field of the staging buffer to fill
+ */
+static void gather(double *const *const _src, const int *const _indices, const size_t &_begin,
+                   const size_t &_end, AtomBuffer &_into, const ARBFNField &_field)
+{
+  double *const cx = _into.column(_field, 0);
+  double *const cy = _into.column(_field, 1);
+  double *const cz = _into.column(_field, 2);
+
+  for (size_t j = _begin; j < _end; ++j) {
+    const double *const src = _src[_indices[j]];
+    cx[j] = src[0];
+    cy[j] = src[1];
+    cz[j] = src[2];
+  }
+}
+
+/**
+ * @brief Copies one per-atom scalar quantity of some of the given
+ * atoms into the single column of a staging buffer
+ * @param _src The LAMMPS per-atom vector to read from
+ * @param _indices The local indices of the atoms to copy
+ * @param _begin The first of the atoms to copy
+ * @param _end One past the last of the atoms to copy
+ * @param _into The staging buffer to write into
+ * @param _field The field of the staging buffer to fill
+ */
+template <typename T>
+static void gather_scalar(const T *const _src, const int *const _indices, const size_t &_begin,
+                          const size_t &_end, AtomBuffer &_into, const ARBFNField &_field)
+{
+  double *const c = _into.column(_field, 0);
+
+  for (size_t j = _begin; j < _end; ++j) { c[j] = (double) _src[_indices[j]]; }
+}
+
+/**
+ * @brief Lays out interchange statistics as the global vector of
+ * `fix arbfn`: Six timings in seconds, then three counts
+ * @param _stats The statistics to lay out
+ * @param _into The vector to write into
+ */
+static void stats_to_vector(const InterchangeStats &_stats, double _into[])
+{
+  _into[0] = _stats.gather_s;
+  _into[1] = _stats.serialize_s;
+  _into[2] = _stats.send_s;
+  _into[3] = _stats.wait_s;
+  _into[4] = _stats.parse_s;
+  _into[5] = _stats.scatter_s;
+  _into[6] = (double) _stats.bytes_sent;
+  _into[7] = (double) _stats.bytes_received;
+  _into[8] = (double) _stats.waiting_packets;
+}
+
+/// The number of timings at the front of the global vector
+static const int num_timings = 6;
+
+std::map<LAMMPS_NS::LAMMPS *, LAMMPS_NS::FixArbFnChannel *> LAMMPS_NS::FixArbFn::channels;
+
 LAMMPS_NS::FixArbFn::FixArbFn(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp, _c, _v)
 {
-  // Split comm
-  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
+  // Per-step timings and traffic, for thermo output
+  vector_flag = 1;
+  size_vector = FIX_ARBFN_SIZE_VECTOR;
+  global_freq = 1;
+  extvector = 0;
+  step_reduced = false;
+
+  // The controller's field may count towards the potential energy
+  // and pressure (see fix_modify)
+  scalar_flag = 1;
+  extscalar = 1;
+  energy_global_flag = 1;
+  virial_global_flag = virial_peratom_flag = 1;
+  with_energy = energy_reduced = false;
+  energy_of = nullptr;
+  energy_at = virial_at = -1;
+  local_energy = energy_all = 0.0;
 
   // Handle keywords here
   max_ms = 0.0;
   every = 1;
+  requested_format = ARBFN_FORMAT_JSON;
+  requested_mode = mode = ARBFN_MODE_REQUEST;
+  requested_precision = precision = ARBFN_PRECISION_DOUBLE;
+  tiles_valid = false;
+  migration_due = false;
+  fields = ARBFN_DEFAULT_FIELDS;
+  is_async = false;
+  extrapolate_order = 1;
+  is_holding = with_rates = false;
+  is_incoming = false;
+  held_at = incoming_at = history_at = 0;
+  held_response = responses = 0;
+  stored = nullptr;
+  stored_width = stored_nmax = slot_width = 0;
+  is_spatial = false;
+  group = MPI_COMM_NULL;
+  bool is_collective = false;
+
+  // `async' is another spelling of `lag 1', so must not meet `lag 0'
+  bool said_async = false;
+  int lag = -1;
 
   for (int i = 3; i < _c; ++i) {
     const char *const arg = _v[i];
@@ -30,36 +142,482 @@ LAMMPS_NS::FixArbFn::FixArbFn(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp,
       every = utils::numeric(FLERR, _v[i + 1], false, _lmp);
       ++i;
     } else if (strcmp(arg, "dipole") == 0) {
-      is_dipole = !is_dipole;
+      fields ^= ARBFN_FIELD_MU;
+    } else if (strcmp(arg, "fields") == 0) {
+      // Consume field names until the next keyword
+      fields = 0;
+      while (i + 1 < _c && field_from_name(_v[i + 1]) != 0) {
+        fields |= field_from_name(_v[i + 1]);
+        ++i;
+      }
+      if (fields == 0) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `fields'.");
+      }
+    } else if (strcmp(arg, "format") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `format'.");
+      }
+      if (strcmp(_v[i + 1], "json") == 0) {
+        requested_format = ARBFN_FORMAT_JSON;
+      } else if (strcmp(_v[i + 1], "binary") == 0) {
+        requested_format = ARBFN_FORMAT_BINARY;
+      } else if (strcmp(_v[i + 1], "shared") == 0) {
+        requested_format = ARBFN_FORMAT_SHARED;
+      } else {
+        error->all(FLERR,
+                   "Malformed `fix arbfn': `format' must be `json', `binary' or `shared'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "precision") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `precision'.");
+      }
+      if (!precision_from_name(_v[i + 1], requested_precision)) {
+        error->all(FLERR, "Malformed `fix arbfn': `precision' must be `double', `single' or "
+                          "`quantized'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "mode") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `mode'.");
+      }
+      if (strcmp(_v[i + 1], "request") == 0) {
+        requested_mode = ARBFN_MODE_REQUEST;
+      } else if (strcmp(_v[i + 1], "grid") == 0) {
+        requested_mode = ARBFN_MODE_GRID;
+      } else if (strcmp(_v[i + 1], "delta") == 0) {
+        requested_mode = ARBFN_MODE_DELTA;
+      } else {
+        error->all(FLERR,
+                   "Malformed `fix arbfn': `mode' must be `request', `grid' or `delta'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "tolerance") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `tolerance'.");
+      }
+      delta.tolerance = utils::numeric(FLERR, _v[i + 1], false, _lmp);
+      ++i;
+    } else if (strcmp(arg, "async") == 0) {
+      said_async = is_async = true;
+    } else if (strcmp(arg, "lag") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `lag'.");
+      }
+      lag = utils::inumeric(FLERR, _v[i + 1], false, _lmp);
+      if (lag != 0 && lag != 1) {
+        error->all(FLERR, "Malformed `fix arbfn': `lag' must be 0 or 1.");
+      }
+      is_async = said_async || lag == 1;
+      ++i;
+    } else if (strcmp(arg, "collective") == 0) {
+      is_collective = true;
+    } else if (strcmp(arg, "hold") == 0) {
+      is_holding = true;
+    } else if (strcmp(arg, "rates") == 0) {
+      with_rates = true;
+    } else if (strcmp(arg, "energy") == 0) {
+      with_energy = true;
+    } else if (strcmp(arg, "extrapolate") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `extrapolate'.");
+      }
+      const int order = utils::inumeric(FLERR, _v[i + 1], false, _lmp);
+      if (order < 1 || order > FIX_ARBFN_MAX_HISTORY) {
+        error->all(FLERR, "Malformed `fix arbfn': `extrapolate' must be 1, 2 or 3.");
+      }
+      extrapolate_order = order;
+      ++i;
+    } else if (strcmp(arg, "shard") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `shard'.");
+      }
+      if (strcmp(_v[i + 1], "rank") == 0) {
+        is_spatial = false;
+      } else if (strcmp(_v[i + 1], "space") == 0) {
+        is_spatial = true;
+      } else {
+        error->all(FLERR, "Malformed `fix arbfn': `shard' must be `rank' or `space'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "wait") == 0) {
+      if (i + 1 >= _c) {
+        error->all(FLERR, "Malformed `fix arbfn': Missing argument for `wait'.");
+      }
+      if (strcmp(_v[i + 1], "poll") == 0) {
+        waiter.strategy = ARBFN_WAIT_POLL;
+      } else if (strcmp(_v[i + 1], "backoff") == 0) {
+        waiter.strategy = ARBFN_WAIT_BACKOFF;
+      } else if (strcmp(_v[i + 1], "block") == 0) {
+        waiter.strategy = ARBFN_WAIT_BLOCK;
+      } else {
+        error->all(FLERR, "Malformed `fix arbfn': `wait' must be `poll', `backoff' or `block'.");
+      }
+      ++i;
     }
 
     else {
       error->all(FLERR, "Malformed `fix arbfn': Unknown keyword `" + std::string(arg) + "'.");
     }
   }
+
+  // Ensure the requested fields exist in this atom style
+  if (said_async && lag == 0) {
+    error->all(FLERR, "`fix arbfn' keyword `async' cannot be used with `lag 0'.");
+  } else if ((fields & ARBFN_FIELD_MU) && !atom->mu_flag) {
+    error->all(FLERR, "`fix arbfn' field `mu' requires an atom style with dipoles.");
+  } else if ((fields & ARBFN_FIELD_Q) && !atom->q_flag) {
+    error->all(FLERR, "`fix arbfn' field `q' requires an atom style with charges.");
+  } else if ((fields & ARBFN_FIELD_ID) && !atom->tag_enable) {
+    error->all(FLERR, "`fix arbfn' field `id' requires atom IDs.");
+  } else if (is_async && !atom->tag_enable) {
+    error->all(FLERR, "`fix arbfn' keyword `async' requires atom IDs.");
+  } else if (is_async && requested_mode == ARBFN_MODE_GRID) {
+    error->all(FLERR, "`fix arbfn' keyword `async' cannot be used with `mode grid'.");
+  } else if (extrapolate_order > 1 && !is_async) {
+    error->all(FLERR, "`fix arbfn' keyword `extrapolate' requires `lag 1'.");
+  } else if (is_holding && !atom->tag_enable) {
+    error->all(FLERR, "`fix arbfn' keyword `hold' requires atom IDs.");
+  } else if (is_holding && requested_mode == ARBFN_MODE_GRID) {
+    error->all(FLERR, "`fix arbfn' keyword `hold' cannot be used with `mode grid'.");
+  } else if (with_rates && !is_holding) {
+    error->all(FLERR, "`fix arbfn' keyword `rates' requires `hold'.");
+  } else if (requested_mode == ARBFN_MODE_DELTA && !atom->tag_enable) {
+    error->all(FLERR, "`fix arbfn' `mode delta' requires atom IDs.");
+  } else if (is_collective && requested_mode != ARBFN_MODE_REQUEST) {
+    error->all(FLERR, "`fix arbfn' keyword `collective' requires `mode request'.");
+  } else if (is_collective && requested_format == ARBFN_FORMAT_SHARED) {
+    error->all(FLERR, "`fix arbfn' keyword `collective' cannot be used with `format shared'.");
+  } else if (requested_precision != ARBFN_PRECISION_DOUBLE &&
+             requested_format == ARBFN_FORMAT_JSON && !is_collective) {
+    error->all(FLERR, "`fix arbfn' keyword `precision' requires a binary format.");
+  } else if (requested_precision != ARBFN_PRECISION_DOUBLE &&
+             requested_mode == ARBFN_MODE_GRID) {
+    error->all(FLERR, "`fix arbfn' keyword `precision' cannot be used with `mode grid'.");
+  }
+
+  // Collectives carry binary packets, whatever the format asked for
+  if (is_collective) { requested_format = ARBFN_FORMAT_COLLECTIVE; }
+
+  // The first instance of each LAMMPS splits comm, then picks a
+  // controller. Later ones share both, so must pick it the same way.
+  channel = channels[lmp];
+  if (channel == nullptr) {
+    channel = channels[lmp] = new FixArbFnChannel();
+    MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, ARBFN_MPI_KEY_WORKER, &channel->comm);
+    if (!discover_controller(channel->controller_rank, channel->comm,
+                             is_spatial ? spatial_position() : -1.0)) {
+      error->all(FLERR, "`fix arbfn' found no controller: Ensure it is running.");
+    }
+    channel->is_spatial = is_spatial;
+  } else if (channel->is_spatial != is_spatial) {
+    error->all(FLERR, "`fix arbfn' instances must all use the same `shard'.");
+  }
+  channel->fixes.push_back(this);
+  channel->registered = false;
+  comm = channel->comm;
+  controller_rank = channel->controller_rank;
+  part = 0;
 }
 
 LAMMPS_NS::FixArbFn::~FixArbFn()
 {
-  send_deregistration(controller_rank, comm);
+  // Don't leave a response in flight past deregistration
+  if (pending.active) { finish_interchange(to_recv, pending); }
+
+  if (stored_width > 0) {
+    atom->delete_callback(id, Atom::GROW);
+    memory->destroy(stored);
+  }
+
+  // Any others register anew at the next run. The last to go
+  // deregisters.
+  std::vector<FixArbFn *> &fixes = channel->fixes;
+  fixes.erase(std::find(fixes.begin(), fixes.end(), this));
+  channel->registered = false;
+  if (!fixes.empty()) { return; }
+
+  send_deregistration(controller_rank, comm, mode, &group);
   MPI_Comm_free(&comm);
+  channels.erase(lmp);
+  delete channel;
+}
+
+uint64_t LAMMPS_NS::FixArbFn::wanted_terms()
+{
+  // Energy is asked for when it may be output, and the virial when
+  // it counts towards the pressure
+  return (with_rates ? ARBFN_TERM_RATES : 0) |
+         (with_energy || thermo_energy ? ARBFN_TERM_ENERGY : 0) |
+         (thermo_virial ? ARBFN_TERM_VIRIAL : 0);
+}
+
+void LAMMPS_NS::FixArbFn::register_channel()
+{
+  // Parts are numbered in the order LAMMPS runs the instances, so
+  // the last to run sends the request
+  std::vector<FixArbFn *> &fixes = channel->fixes;
+  std::vector<FixArbFn *> ordered;
+  for (int i = 0; i < modify->nfix; ++i) {
+    for (FixArbFn *const fix : fixes) {
+      if (modify->fix[i] == fix) { ordered.push_back(fix); }
+    }
+  }
+  fixes.swap(ordered);
+
+  // Binary packets are asked for if any instance wants them
+  channel->format = ARBFN_FORMAT_JSON;
+  channel->parts.assign(fixes.size(), MultiplexedFix());
+  channel->due.clear();
+  for (size_t k = 0; k < fixes.size(); ++k) {
+    FixArbFn &fix = *fixes[k];
+    if (fix.requested_mode != ARBFN_MODE_REQUEST || fix.is_async ||
+        fix.requested_format == ARBFN_FORMAT_COLLECTIVE ||
+        fix.requested_precision != ARBFN_PRECISION_DOUBLE) {
+      error->all(FLERR, "`fix arbfn' instances sharing a process must use `mode request', "
+                        "without `async', `collective' or `precision'.");
+    }
+    if (fix.requested_format != ARBFN_FORMAT_JSON) { channel->format = ARBFN_FORMAT_BINARY; }
+
+    fix.part = k;
+    MultiplexedFix &part = channel->parts[k];
+    part.id = fix.id;
+    part.fields = fix.fields;
+    part.terms = fix.wanted_terms();
+    part.atoms = &fix.to_send;
+    part.fixes = &fix.to_recv;
+  }
+
+  if (!send_registration(controller_rank, comm, channel->format, channel->parts)) {
+    error->all(FLERR, "`fix arbfn' failed to register instances with controller: Ensure it "
+                      "is running, and serves several per process.");
+  }
+  channel->registered = true;
 }
 
 void LAMMPS_NS::FixArbFn::init()
 {
-  bool res = send_registration(controller_rank, comm);
+  if (is_async && atom->map_style == Atom::MAP_NONE) {
+    error->all(FLERR, "`fix arbfn' keyword `async' requires an atom map: See atom_modify.");
+  } else if (requested_mode == ARBFN_MODE_DELTA && atom->map_style == Atom::MAP_NONE) {
+    error->all(FLERR, "`fix arbfn' `mode delta' requires an atom map: See atom_modify.");
+  } else if (is_holding && atom->map_style == Atom::MAP_NONE) {
+    error->all(FLERR, "`fix arbfn' keyword `hold' requires an atom map: See atom_modify.");
+  }
+
+  // Deltas are matched up by tag, so always carry it
+  sent_fields = fields;
+  if (requested_mode == ARBFN_MODE_DELTA) { sent_fields |= ARBFN_FIELD_ID; }
+
+  format = requested_format;
+  mode = requested_mode;
+  const uint64_t requested_terms = wanted_terms();
+  uint64_t terms = requested_terms;
+  precision = requested_precision;
+
+  // Several instances register together, upon the first init of a
+  // run, then each takes what was agreed for its part
+  bool res = true;
+  if (channel->fixes.size() > 1) {
+    if (!channel->registered) { register_channel(); }
+    format = channel->format;
+    terms = channel->parts[part].terms;
+    migration.clear();
+    migration.enabled = false;
+  } else {
+    res = send_registration(controller_rank, comm, format, sent_fields, mode, &tiles,
+                            &migration, &terms, &segment, &group, &precision);
+  }
   if (!res) {
     error->all(FLERR, "`fix arbfn' failed to register with controller: Ensure it is running.");
+  } else if (mode != requested_mode && requested_mode == ARBFN_MODE_GRID) {
+    error->all(FLERR, "`fix arbfn' controller does not support `mode grid'.");
+  }
+
+  // Registering forgets any tiles or atoms sent: They are sent anew
+  // at the first step
+  tiles_valid = false;
+  delta.clear();
+  migration_due = true;
+
+  // Any terms agreed to follow the deltas in responses. Nothing is
+  // held or counted until the first response arrives.
+  to_recv.set_terms(terms);
+  to_send.precision = delta.changed.precision = precision;
+  to_recv.precision = precision;
+  lay_out_storage();
+  local_energy = 0.0;
+  energy_reduced = false;
+
+  // Only ranks on the same node as their controller share memory
+  int me, unshared, any_unshared;
+  MPI_Comm_rank(world, &me);
+  unshared = (requested_format == ARBFN_FORMAT_SHARED && format == ARBFN_FORMAT_BINARY);
+  MPI_Allreduce(&unshared, &any_unshared, 1, MPI_INT, MPI_MAX, world);
+  if (format == ARBFN_FORMAT_JSON && requested_format != ARBFN_FORMAT_JSON && me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `format binary': Using JSON.");
+  }
+  if (requested_format == ARBFN_FORMAT_COLLECTIVE && format != ARBFN_FORMAT_COLLECTIVE &&
+      me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `collective': "
+                          "Sending requests one by one.");
+  }
+  if (any_unshared && me == 0) {
+    error->warning(FLERR, "`fix arbfn' cannot share memory with controller on all ranks: "
+                          "Using `format binary' where not.");
+  }
+  if (mode != requested_mode && me == 0) {
+    error->warning(FLERR,
+                   "`fix arbfn' controller does not support `mode delta': Sending all atoms.");
+  }
+  const uint64_t refused = requested_terms & ~terms;
+  if (precision != requested_precision && me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `precision " +
+                              std::string(precision_name(requested_precision)) +
+                              "': Sending doubles.");
+  }
+  if ((refused & ARBFN_TERM_RATES) && me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `rates': Holding constant.");
+  }
+  if ((refused & ARBFN_TERM_ENERGY) && me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `energy': Counting none.");
+  }
+  if ((refused & ARBFN_TERM_VIRIAL) && me == 0) {
+    error->warning(FLERR, "`fix arbfn' controller does not support `virial': Counting none.");
   }
 
   counter = 0;
+  waiter.stats.clear();
+  step_stats.clear();
+  run_stats.clear();
+  step_reduced = false;
+
+  // Force the group members to be found anew
+  indices_ncalls = -1;
+}
+
+void LAMMPS_NS::FixArbFn::lay_out_storage()
+{
+  // Slots are as wide as the responses agreed to, so may widen when
+  // registering anew. Nothing is kept from earlier runs.
+  slot_width = (int) to_recv.width + 1;
+  int width = 0;
+  if (is_holding) {
+    held_at = width;
+    width += slot_width;
+  }
+  if (is_async) {
+    incoming_at = width;
+    width += slot_width;
+  }
+  if (extrapolate_order > 1) {
+    history_at = width;
+    width += 2 + 3 * FIX_ARBFN_MAX_HISTORY;
+  }
+  is_incoming = false;
+  if (width == 0) { return; }
+
+  if (width != stored_width) {
+    if (stored_width == 0) { atom->add_callback(Atom::GROW); }
+    memory->destroy(stored);
+    stored_width = maxexchange = width;
+    stored_nmax = 0;
+    grow_arrays(atom->nmax);
+  }
+  for (int i = 0; i < stored_nmax; ++i) { set_arrays(i); }
+  held_response = 0;
+}
+
+void LAMMPS_NS::FixArbFn::grow_arrays(int _nmax)
+{
+  memory->grow(stored, _nmax, stored_width, "arbfn:stored");
+  for (int i = stored_nmax; i < _nmax; ++i) { set_arrays(i); }
+  stored_nmax = _nmax;
+}
+
+void LAMMPS_NS::FixArbFn::copy_arrays(int _i, int _j, int)
+{
+  std::copy(stored[_i], stored[_i] + stored_width, stored[_j]);
+}
+
+void LAMMPS_NS::FixArbFn::set_arrays(int _i)
+{
+  // New atoms have been sent no response yet, which no number marks
+  if (is_holding) { stored[_i][held_at] = -1.0; }
+  if (is_async) { stored[_i][incoming_at] = -1.0; }
+  if (extrapolate_order > 1) { stored[_i][history_at] = -1.0; }
+}
+
+int LAMMPS_NS::FixArbFn::pack_exchange(int _i, double *_buf)
+{
+  std::copy(stored[_i], stored[_i] + stored_width, _buf);
+  return stored_width;
+}
+
+int LAMMPS_NS::FixArbFn::unpack_exchange(int _nlocal, double *_buf)
+{
+  std::copy(_buf, _buf + stored_width, stored[_nlocal]);
+  return stored_width;
+}
+
+double LAMMPS_NS::FixArbFn::memory_usage()
+{
+  return (double) stored_nmax * stored_width * sizeof(double);
 }
 
-void LAMMPS_NS::FixArbFn::post_force(int)
+void LAMMPS_NS::FixArbFn::fetch_tiles_if_moved()
 {
-  // Only actually post force every once in a while
+  // Triclinic subdomains are not boxes in space: Cover the whole box
+  const double *const sublo = (domain->triclinic ? domain->boxlo_bound : domain->sublo);
+  const double *const subhi = (domain->triclinic ? domain->boxhi_bound : domain->subhi);
+  if (tiles_valid && std::equal(sublo, sublo + 3, tiles_sublo) &&
+      std::equal(subhi, subhi + 3, tiles_subhi)) {
+    return;
+  }
+
+  // Owned atoms stray at most a skin distance between reneighborings
+  double lo[3], hi[3];
+  for (int d = 0; d < 3; ++d) {
+    tiles_sublo[d] = sublo[d];
+    tiles_subhi[d] = subhi[d];
+    lo[d] = sublo[d] - neighbor->skin;
+    hi[d] = subhi[d] + neighbor->skin;
+  }
+
+  if (!fetch_tiles(tiles, lo, hi, max_ms, controller_rank, comm, waiter)) {
+    error->all(FLERR, "`fix arbfn' failed to receive grid from controller.");
+  }
+  tiles_valid = true;
+}
+
+double LAMMPS_NS::FixArbFn::spatial_position()
+{
+  // Slice the box along its longest axis, one slab per controller
+  int axis = 0;
+  for (int d = 1; d < domain->dimension; ++d) {
+    if (domain->prd[d] > domain->prd[axis]) { axis = d; }
+  }
+
+  const double center = 0.5 * (domain->sublo[axis] + domain->subhi[axis]);
+  return std::max(0.0, (center - domain->boxlo[axis]) / domain->prd[axis]);
+}
+
+void LAMMPS_NS::FixArbFn::post_force(int _vflag)
+{
+  // The virial and energy count only the deltas applied on this
+  // step, so are nothing on steps where none are
+  v_init(_vflag);
+  local_energy = 0.0;
+  energy_reduced = false;
+
+  // Only actually post force every once in a while, holding the
+  // latest force deltas in between if asked to
   ++counter;
   if (counter < every) {
+    if (is_holding) { apply_held(); }
+
+    // The last instance sends for those due even if it is not
+    if (channel->fixes.size() > 1 && part + 1 == channel->fixes.size()) { flush_channel(); }
     return;
   } else {
     // Reset counter and do interchange
@@ -67,64 +625,521 @@ void LAMMPS_NS::FixArbFn::post_force(int)
   }
 
   // Meta
-  double *const *const x = atom->x;
-  double *const *const v = atom->v;
-  double *const *const f = atom->f;
-  double *const *const mu = atom->mu;
-  int *const mask = atom->mask;
-
-  // Variables
-  bool success;
-  std::vector<AtomData> to_send;
-
-  // Move from LAMMPS atom format to AtomData struct
-  size_t n = 0;
-  for (size_t i = 0; i < atom->nlocal; ++i) {
-    if (mask[i] & groupbit) {
-      AtomData to_add;
-      to_add.x = x[i][0];
-      to_add.y = x[i][1];
-      to_add.z = x[i][2];
-      to_add.vx = v[i][0];
-      to_add.vy = v[i][1];
-      to_add.vz = v[i][2];
-      to_add.fx = f[i][0];
-      to_add.fy = f[i][1];
-      to_add.fz = f[i][2];
-
-      to_add.is_dipole = is_dipole;
-      if (to_add.is_dipole) {
-        to_add.mux = mu[i][0];
-        to_add.muy = mu[i][1];
-        to_add.muz = mu[i][2];
-      }
-
-      to_send.push_back(to_add);
-      ++n;
+  const int nlocal = atom->nlocal;
+
+  step_stats.clear();
+  step_reduced = false;
+
+  // Apply the previous response, which has had a whole step to arrive
+  // unless taken before atoms migrated
+  double start;
+  if (pending.active) { receive_response(); }
+  if (is_incoming) {
+    step_stats.add(pending.stats);
+
+    start = MPI_Wtime();
+    if (is_holding) {
+      std::swap(held_at, incoming_at);
+      held_response = responses;
+    } else {
+      apply_stored(incoming_at, responses, 0.0);
+    }
+    is_incoming = false;
+    step_stats.scatter_s += MPI_Wtime() - start;
+  }
+
+  // Atoms only move between or within ranks when reneighboring
+  start = MPI_Wtime();
+  if (neighbor->ncalls != indices_ncalls || nlocal != indices_nlocal) {
+    find_indices();
+    indices_ncalls = neighbor->ncalls;
+    indices_nlocal = nlocal;
+    migration_due = true;
+  }
+
+  // Gather from LAMMPS atom format into the staging buffer. The
+  // grid is looked up by position alone.
+  const uint64_t staged = (mode == ARBFN_MODE_GRID ? (uint64_t) ARBFN_FIELD_X : sent_fields);
+  to_send.resize(indices.size(), staged);
+  if ((is_async || is_holding) && mode != ARBFN_MODE_DELTA) { sent_tags.resize(indices.size()); }
+  gather_atoms(staged);
+  step_stats.gather_s += MPI_Wtime() - start;
+
+  // Tell the controller which atoms came and went, which can only
+  // have changed upon reneighboring
+  if (migration.enabled && migration_due) {
+    start = MPI_Wtime();
+    notify_migration(to_send, migration, controller_rank, comm, &step_stats);
+    migration_due = false;
+    step_stats.serialize_s += MPI_Wtime() - start;
+  }
+
+  // In delta mode, only the changes are sent, but the response
+  // covers every atom sent so far, in order of tag
+  if (mode == ARBFN_MODE_DELTA) {
+    start = MPI_Wtime();
+    stage_delta(to_send, delta);
+    const double *const tags = delta.snapshot.column(ARBFN_FIELD_ID, 0);
+    sent_tags.assign(tags, tags + delta.snapshot.n);
+    step_stats.serialize_s += MPI_Wtime() - start;
+  }
+
+  // Several instances send their atoms together once the last has
+  // gathered, then each scatters its own fixes
+  if (channel->fixes.size() > 1) {
+    channel->due.push_back(part);
+    if (part + 1 == channel->fixes.size()) { flush_channel(); }
+    return;
+  }
+
+  // Collective workers send over their group, in which the
+  // controller is rank 0
+  MPI_Comm &link = (format == ARBFN_FORMAT_COLLECTIVE ? group : comm);
+  const uint link_rank = (format == ARBFN_FORMAT_COLLECTIVE ? 0 : controller_rank);
+
+  // Transmit atoms; asynchronously, the fix data is applied next time
+  if (is_async) {
+    const bool success = (mode == ARBFN_MODE_DELTA
+                              ? begin_interchange(delta, to_recv, max_ms, controller_rank, comm,
+                                                  format, pending, waiter, &segment)
+                              : begin_interchange(to_send, to_recv, max_ms, link_rank, link,
+                                                  format, pending, waiter, &segment));
+    if (!success) { error->all(FLERR, "`fix arbfn' failed interchange."); }
+
+    // The interchange is counted once it is finished, next time
+    if (is_holding) { apply_held(); }
+    run_stats.add(step_stats);
+    return;
+  }
+
+  // In grid mode, the controller is only heard from when the grid
+  // changes or the subdomain moves. Interpolation is counted as
+  // part of scattering.
+  if (mode == ARBFN_MODE_GRID) {
+    start = MPI_Wtime();
+    fetch_tiles_if_moved();
+    step_stats.wait_s += MPI_Wtime() - start;
+
+    bool updated;
+    start = MPI_Wtime();
+    if (!poll_grid(tiles, controller_rank, comm, updated)) {
+      error->all(FLERR, "`fix arbfn' failed to receive grid from controller.");
     }
+    step_stats.parse_s += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    interpolate(tiles.local, to_send, to_recv);
+    step_stats.scatter_s += MPI_Wtime() - start;
   }
 
   // Transmit atoms, receive fix data
-  FixData *to_recv = new FixData[n];
-  success = interchange(n, to_send.data(), to_recv, max_ms, controller_rank, comm);
-  if (!success) { error->all(FLERR, "`fix arbfn' failed interchange."); }
-
-  // Translate FixData struct to LAMMPS force info
-  n = 0;
-  for (size_t i = 0; i < atom->nlocal; ++i) {
-    if (mask[i] & groupbit) {
-      f[i][0] += to_recv[n].dfx;
-      f[i][1] += to_recv[n].dfy;
-      f[i][2] += to_recv[n].dfz;
-      ++n;
+  else {
+    const bool success = (mode == ARBFN_MODE_DELTA
+                              ? interchange(delta, to_recv, max_ms, controller_rank, comm,
+                                            format, waiter, &step_stats, &segment)
+                              : interchange(to_send, to_recv, max_ms, link_rank, link, format,
+                                            waiter, &step_stats, &segment));
+    if (!success) { error->all(FLERR, "`fix arbfn' failed interchange."); }
+  }
+
+  scatter_response();
+}
+
+void LAMMPS_NS::FixArbFn::flush_channel()
+{
+  std::vector<size_t> &due = channel->due;
+  if (due.empty()) { return; }
+
+  // The interchange is awaited and counted by the first instance
+  // due, for as long as any may wait
+  FixArbFn &first = *channel->fixes[due[0]];
+  double limit_ms = first.max_ms;
+  for (const size_t &k : due) {
+    const double &other_ms = channel->fixes[k]->max_ms;
+    limit_ms = (limit_ms == 0.0 || other_ms == 0.0 ? 0.0 : std::max(limit_ms, other_ms));
+  }
+  if (!interchange(channel->parts, due, limit_ms, controller_rank, comm, channel->format,
+                   first.waiter, &first.step_stats)) {
+    error->all(FLERR, "`fix arbfn' failed interchange.");
+  }
+
+  for (const size_t &k : due) { channel->fixes[k]->scatter_response(); }
+  due.clear();
+}
+
+void LAMMPS_NS::FixArbFn::scatter_response()
+{
+  // Scatter force deltas back into LAMMPS force info
+  const double start = MPI_Wtime();
+  if (is_holding) {
+    hold_response();
+    apply_held();
+  } else if (mode == ARBFN_MODE_DELTA) {
+    scatter_by_tag();
+  } else {
+    scatter_direct();
+  }
+  step_stats.scatter_s += MPI_Wtime() - start;
+  run_stats.add(step_stats);
+}
+
+void LAMMPS_NS::FixArbFn::find_indices()
+{
+  const int *const mask = atom->mask;
+  const int nlocal = atom->nlocal;
+
+  if ((size_t) nlocal > indices.capacity()) { indices.reserve(nlocal); }
+  indices.clear();
+  for (int i = 0; i < nlocal; ++i) {
+    if (mask[i] & groupbit) { indices.push_back(i); }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::gather_atoms(const uint64_t &_staged)
+{
+  gather_range(_staged, 0, indices.size());
+}
+
+void LAMMPS_NS::FixArbFn::gather_range(const uint64_t &_staged, const size_t &_begin,
+                                       const size_t &_end)
+{
+  // Gather from LAMMPS atom format into the staging buffer, which
+  // has already been sized
+  const int *const idx = indices.data();
+  const tagint *const tag = atom->tag;
+  if (_staged & ARBFN_FIELD_X) { gather(atom->x, idx, _begin, _end, to_send, ARBFN_FIELD_X); }
+  if (_staged & ARBFN_FIELD_V) { gather(atom->v, idx, _begin, _end, to_send, ARBFN_FIELD_V); }
+  if (_staged & ARBFN_FIELD_F) { gather(atom->f, idx, _begin, _end, to_send, ARBFN_FIELD_F); }
+  if (_staged & ARBFN_FIELD_MU) { gather(atom->mu, idx, _begin, _end, to_send, ARBFN_FIELD_MU); }
+  if (_staged & ARBFN_FIELD_Q) {
+    gather_scalar(atom->q, idx, _begin, _end, to_send, ARBFN_FIELD_Q);
+  }
+  if (_staged & ARBFN_FIELD_TYPE) {
+    gather_scalar(atom->type, idx, _begin, _end, to_send, ARBFN_FIELD_TYPE);
+  }
+  if (_staged & ARBFN_FIELD_ID) { gather_scalar(tag, idx, _begin, _end, to_send, ARBFN_FIELD_ID); }
+  if ((is_async || is_holding) && mode != ARBFN_MODE_DELTA) {
+    for (size_t j = _begin; j < _end; ++j) { sent_tags[j] = tag[idx[j]]; }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::scatter_direct()
+{
+  double *const *const f = atom->f;
+  const size_t n = indices.size();
+  const int *const idx = indices.data();
+  const double *const dfx = to_recv.column(0);
+  const double *const dfy = to_recv.column(1);
+  const double *const dfz = to_recv.column(2);
+
+  begin_tally(to_recv);
+  for (size_t j = 0; j < n; ++j) {
+    f[idx[j]][0] += dfx[j];
+    f[idx[j]][1] += dfy[j];
+    f[idx[j]][2] += dfz[j];
+    tally(j, idx[j]);
+  }
+}
+
+void LAMMPS_NS::FixArbFn::post_run()
+{
+  // Several instances register together again at the next run
+  channel->registered = false;
+  channel->due.clear();
+
+  // A response which arrives after the run would be stale: Discard it
+  if (pending.active) {
+    if (!finish_interchange(to_recv, pending)) {
+      error->all(FLERR, "`fix arbfn' failed interchange.");
     }
+    run_stats.add(pending.stats);
+  } else if (is_incoming) {
+    run_stats.add(pending.stats);
+  }
+  is_incoming = false;
+
+  report_waits();
+  report_timings();
+}
+
+void LAMMPS_NS::FixArbFn::report_waits()
+{
+  static const char *const strategy_names[] = {"poll", "backoff", "block"};
+  const WaitStats &local = waiter.stats;
+  double sums[3] = {(double) local.count, local.total_us, local.total_sq_us};
+  double totals[3], min_us, max_us;
+  int me;
+
+  // Ranks which never waited must not skew the extremes
+  const double local_min = (local.count > 0 ? local.min_us : HUGE_VAL);
+  const double local_max = (local.count > 0 ? local.max_us : 0.0);
+
+  MPI_Reduce(sums, totals, 3, MPI_DOUBLE, MPI_SUM, 0, world);
+  MPI_Reduce(&local_min, &min_us, 1, MPI_DOUBLE, MPI_MIN, 0, world);
+  MPI_Reduce(&local_max, &max_us, 1, MPI_DOUBLE, MPI_MAX, 0, world);
+
+  MPI_Comm_rank(world, &me);
+  if (me != 0 || totals[0] == 0.0) { return; }
+
+  const double mean = totals[1] / totals[0];
+  const double stddev = sqrt(std::max(0.0, totals[2] / totals[0] - mean * mean));
+  utils::logmesg(lmp,
+                 "fix arbfn: {} waits ({}): mean {:.1f} us, stddev {:.1f} us, "
+                 "min {:.1f} us, max {:.1f} us\n",
+                 (bigint) totals[0], strategy_names[waiter.strategy], mean, stddev, min_us,
+                 max_us);
+}
+
+void LAMMPS_NS::FixArbFn::report_timings()
+{
+  static const char *const section_names[num_timings] = {"Gather", "Serial", "Send",
+                                                         "Wait",   "Parse",  "Scatter"};
+  double local[FIX_ARBFN_SIZE_VECTOR], local_sq[num_timings];
+  double totals[FIX_ARBFN_SIZE_VECTOR], totals_sq[num_timings];
+  double mins[num_timings], maxes[num_timings];
+  int me, nprocs;
+
+  stats_to_vector(run_stats, local);
+  for (int k = 0; k < num_timings; ++k) { local_sq[k] = local[k] * local[k]; }
+
+  MPI_Reduce(local, totals, FIX_ARBFN_SIZE_VECTOR, MPI_DOUBLE, MPI_SUM, 0, world);
+  MPI_Reduce(local_sq, totals_sq, num_timings, MPI_DOUBLE, MPI_SUM, 0, world);
+  MPI_Reduce(local, mins, num_timings, MPI_DOUBLE, MPI_MIN, 0, world);
+  MPI_Reduce(local, maxes, num_timings, MPI_DOUBLE, MPI_MAX, 0, world);
+
+  MPI_Comm_rank(world, &me);
+  MPI_Comm_size(world, &nprocs);
+  double total_s = 0.0;
+  for (int k = 0; k < num_timings; ++k) { total_s += totals[k]; }
+  if (me != 0 || total_s == 0.0) { return; }
+
+  // Laid out like the MPI task timing breakdown of the run itself
+  const double time_loop = timer->get_wall(Timer::TOTAL);
+  utils::logmesg(lmp, "\nfix arbfn timing breakdown:\n"
+                      "Section |  min time  |  avg time  |  max time  |%varavg| %total\n"
+                      "---------------------------------------------------------------\n");
+  for (int k = 0; k < num_timings; ++k) {
+    const double avg = totals[k] / nprocs;
+    const double var = std::max(0.0, totals_sq[k] / nprocs - avg * avg);
+    const double varavg = (avg > 0.0 ? 100.0 * sqrt(var) / avg : 0.0);
+    const double percent = (time_loop > 0.0 ? 100.0 * avg / time_loop : 0.0);
+    utils::logmesg(lmp, "{:<8}| {:<10.5g} | {:<10.5g} | {:<10.5g} |{:6.1f} |{:6.2f}\n",
+                   section_names[k], mins[k], avg, maxes[k], varavg, percent);
+  }
+  utils::logmesg(lmp, "fix arbfn: {} bytes sent, {} bytes received, {} waiting packets\n",
+                 (bigint) totals[6], (bigint) totals[7], (bigint) totals[8]);
+}
+
+double LAMMPS_NS::FixArbFn::compute_scalar()
+{
+  // Reduce over ranks once per step, upon the first request
+  if (!energy_reduced) {
+    MPI_Allreduce(&local_energy, &energy_all, 1, MPI_DOUBLE, MPI_SUM, world);
+    energy_reduced = true;
+  }
+
+  return energy_all;
+}
+
+double LAMMPS_NS::FixArbFn::compute_vector(int _i)
+{
+  // Reduce over ranks once per step, upon the first request
+  if (!step_reduced) {
+    double local[FIX_ARBFN_SIZE_VECTOR];
+    int nprocs;
+
+    stats_to_vector(step_stats, local);
+    MPI_Allreduce(local, step_all, FIX_ARBFN_SIZE_VECTOR, MPI_DOUBLE, MPI_SUM, world);
+    MPI_Comm_size(world, &nprocs);
+    for (int k = 0; k < num_timings; ++k) { step_all[k] /= nprocs; }
+    step_reduced = true;
+  }
+
+  return step_all[_i];
+}
+
+void LAMMPS_NS::FixArbFn::find_rows()
+{
+  const int nlocal = atom->nlocal;
+  rows.resize(sent_tags.size());
+  for (size_t j = 0; j < sent_tags.size(); ++j) {
+    const int i = atom->map(sent_tags[j]);
+    rows[j] = (i >= 0 && i < nlocal ? i : -1);
+  }
+}
+
+void LAMMPS_NS::FixArbFn::scatter_by_tag()
+{
+  double *const *const f = atom->f;
+  const int *const mask = atom->mask;
+  const double *const dfx = to_recv.column(0);
+  const double *const dfy = to_recv.column(1);
+  const double *const dfz = to_recv.column(2);
+
+  // Atoms which have since left this rank or the group are skipped
+  find_rows();
+  begin_tally(to_recv);
+  for (size_t j = 0; j < rows.size(); ++j) {
+    const int i = rows[j];
+    if (i >= 0 && (mask[i] & groupbit)) {
+      f[i][0] += dfx[j];
+      f[i][1] += dfy[j];
+      f[i][2] += dfz[j];
+      tally(j, i);
+    }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::pre_exchange()
+{
+  // Atoms are about to migrate: Take the response in flight while
+  // this rank still owns every atom it was sent for
+  if (pending.active) { receive_response(); }
+}
+
+void LAMMPS_NS::FixArbFn::receive_response()
+{
+  if (!finish_interchange(to_recv, pending)) {
+    error->all(FLERR, "`fix arbfn' failed interchange.");
+  }
+
+  // Each atom keeps its own row of the response, which migrates with
+  // it until applied at the next interchange
+  const double start = MPI_Wtime();
+  ++responses;
+  find_rows();
+  if (extrapolate_order > 1) { extrapolate_response(); }
+  store_response(incoming_at);
+  is_incoming = true;
+  pending.stats.scatter_s += MPI_Wtime() - start;
+}
+
+void LAMMPS_NS::FixArbFn::extrapolate_response()
+{
+  double *const df[3] = {to_recv.column(0), to_recv.column(1), to_recv.column(2)};
+  const double number = (double) responses;
+
+  // Weights of the latest responses, by how many are known, which
+  // fit a polynomial through them and step it one application on
+  static const double weights[FIX_ARBFN_MAX_HISTORY][FIX_ARBFN_MAX_HISTORY] = {
+      {1.0, 0.0, 0.0}, {2.0, -1.0, 0.0}, {3.0, -3.0, 1.0}};
+
+  for (size_t j = 0; j < rows.size(); ++j) {
+    if (rows[j] < 0) { continue; }
+    double *const known = stored[rows[j]] + history_at;
+    double *const known_df = known + 2;
+
+    // Atoms which missed a response start over
+    if (known[0] + 1.0 != number) { known[1] = 0.0; }
+    known[0] = number;
+
+    for (size_t c = 0; c < 3; ++c) {
+      for (size_t k = FIX_ARBFN_MAX_HISTORY - 1; k > 0; --k) {
+        known_df[3 * k + c] = known_df[3 * (k - 1) + c];
+      }
+      known_df[c] = df[c][j];
+    }
+    known[1] = std::min(known[1] + 1.0, (double) extrapolate_order);
+
+    const double *const w = weights[(size_t) known[1] - 1];
+    for (size_t c = 0; c < 3; ++c) {
+      df[c][j] = w[0] * known_df[c] + w[1] * known_df[3 + c] + w[2] * known_df[6 + c];
+    }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::store_response(const int &_at)
+{
+  const double number = (double) responses;
+  const size_t width = to_recv.width;
+  for (size_t j = 0; j < rows.size(); ++j) {
+    if (rows[j] < 0) { continue; }
+    double *const slot = stored[rows[j]] + _at;
+    slot[0] = number;
+    for (size_t c = 0; c < width; ++c) { slot[1 + c] = to_recv.column(c)[j]; }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::hold_response()
+{
+  // Each atom keeps its own row of the response, which migrates with
+  // it until the next response replaces it
+  ++responses;
+  find_rows();
+  store_response(held_at);
+  held_response = responses;
+}
+
+void LAMMPS_NS::FixArbFn::apply_held()
+{
+  // The deltas follow their rates of change from the step on which
+  // they were received
+  apply_stored(held_at, held_response, counter * update->dt);
+}
+
+void LAMMPS_NS::FixArbFn::apply_stored(const int &_at, const uintmax_t &_response,
+                                       const double &_age)
+{
+  double *const *const f = atom->f;
+  const int *const mask = atom->mask;
+  const int nlocal = atom->nlocal;
+  const double number = (double) _response;
+  const bool has_rates = (to_recv.terms & ARBFN_TERM_RATES);
+  const size_t first_rate = 1 + (has_rates ? to_recv.term_column(ARBFN_TERM_RATES) : 0);
+  const double age = (has_rates ? _age : 0.0);
+
+  // Atoms which were sent no part of the response (EG those which
+  // joined the group since) or have left the group are skipped
+  begin_tally(to_recv);
+  for (int i = 0; i < nlocal; ++i) {
+    const double *const slot = stored[i] + _at;
+    if (slot[0] == number && (mask[i] & groupbit)) {
+      for (size_t c = 0; c < 3; ++c) { f[i][c] += slot[1 + c] + age * slot[first_rate + c]; }
+      tally_row(slot + 1, i);
+    }
+  }
+}
+
+void LAMMPS_NS::FixArbFn::begin_tally(const FixBuffer &_fixes)
+{
+  // The energy is counted anew with each application, from either
+  // the columns of the fixes or stored rows laid out alike
+  local_energy = 0.0;
+  energy_at =
+      (_fixes.terms & ARBFN_TERM_ENERGY ? (int) _fixes.term_column(ARBFN_TERM_ENERGY) : -1);
+  virial_at = ((_fixes.terms & ARBFN_TERM_VIRIAL) && vflag_either
+                   ? (int) _fixes.term_column(ARBFN_TERM_VIRIAL)
+                   : -1);
+  energy_of = (energy_at >= 0 ? _fixes.column(energy_at) : nullptr);
+  for (size_t c = 0; c < 6; ++c) {
+    virial_of[c] = (virial_at >= 0 ? _fixes.column(virial_at + c) : nullptr);
+  }
+}
+
+void LAMMPS_NS::FixArbFn::tally(const size_t &_j, const int &_i)
+{
+  if (energy_of != nullptr) { local_energy += energy_of[_j]; }
+  if (virial_of[0] != nullptr) {
+    double v[6];
+    for (size_t c = 0; c < 6; ++c) { v[c] = virial_of[c][_j]; }
+    v_tally(_i, v);
+  }
+}
+
+void LAMMPS_NS::FixArbFn::tally_row(const double *_row, const int &_i)
+{
+  if (energy_at >= 0) { local_energy += _row[energy_at]; }
+  if (virial_at >= 0) {
+    double v[6];
+    for (size_t c = 0; c < 6; ++c) { v[c] = _row[virial_at + c]; }
+    v_tally(_i, v);
   }
-  delete[] to_recv;
 }
 
 int LAMMPS_NS::FixArbFn::setmask()
 {
   int mask = 0;
   mask |= LAMMPS_NS::FixConst::POST_FORCE;
+  if (is_async) { mask |= LAMMPS_NS::FixConst::PRE_EXCHANGE; }
   return mask;
 }
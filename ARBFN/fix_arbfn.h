@@ -31,25 +31,194 @@ FixStyle(arbfn,FixArbFn);
 #include "error.h"
 #include "fix.h"
 #include "interchange.h"
+#include <map>
+#include <vector>
 
-#define FIX_ARBFN_VERSION "0.1.2"
+#define FIX_ARBFN_VERSION "0.2.0"
+
+/// The length of the global vector computed by `fix arbfn`
+#define FIX_ARBFN_SIZE_VECTOR 9
+
+/// The most responses per atom which `fix arbfn` extrapolates from
+#define FIX_ARBFN_MAX_HISTORY 3
 
 namespace LAMMPS_NS {
+class FixArbFn;
+
+// The link to the controller shared by every `fix arbfn' of one
+// LAMMPS instance, made by the first. Several register together,
+// then send the atoms of all those due on a step as one request, in
+// the order LAMMPS runs them.
+struct FixArbFnChannel {
+  MPI_Comm comm;
+  uint controller_rank;
+  bool is_spatial;
+  std::vector<FixArbFn *> fixes;
+
+  // Several instances: The format agreed to, each one's part, those
+  // which have gathered this step, and whether registered this run
+  ARBFNFormat format = ARBFN_FORMAT_JSON;
+  std::vector<MultiplexedFix> parts;
+  std::vector<size_t> due;
+  bool registered = false;
+};
+
 class FixArbFn : public Fix {
  public:
   FixArbFn(class LAMMPS *, int, char **);
   ~FixArbFn() override;
 
   void init() override;
+  void pre_exchange() override;
   void post_force(int) override;
+  void post_run() override;
   int setmask() override;
+  double compute_scalar() override;
+  double compute_vector(int) override;
+
+  // Responses kept past the step they arrive on migrate with their
+  // atoms
+  void grow_arrays(int) override;
+  void copy_arrays(int, int, int) override;
+  void set_arrays(int) override;
+  int pack_exchange(int, double *) override;
+  int unpack_exchange(int, double *) override;
+  double memory_usage() override;
 
  protected:
+  // The per-atom loops, which `fix arbfn/omp' shares between threads
+  virtual void find_indices();
+  virtual void gather_atoms(const uint64_t &);
+  virtual void scatter_direct();
+  virtual void scatter_by_tag();
+  virtual void find_rows();
+  virtual void apply_stored(const int &, const uintmax_t &, const double &);
+
+  void gather_range(const uint64_t &, const size_t &, const size_t &);
+  void lay_out_storage();
+  void receive_response();
+  void extrapolate_response();
+  void store_response(const int &);
+  void hold_response();
+  void apply_held();
+  void begin_tally(const FixBuffer &);
+  void tally(const size_t &, const int &);
+  void tally_row(const double *, const int &);
+  void report_waits();
+  void report_timings();
+  double spatial_position();
+  void fetch_tiles_if_moved();
+  uint64_t wanted_terms();
+  void register_channel();
+  void flush_channel();
+  void scatter_response();
+
   uint controller_rank;
   double max_ms;
   MPI_Comm comm;
   uintmax_t every, counter;
-  bool is_dipole = false;
+  uint64_t fields, sent_fields;
+  ARBFNFormat requested_format, format;
+
+  // Binary formats: The width at which values travel
+  ARBFNPrecision requested_precision, precision;
+
+  // Grid mode: Forces are interpolated from the tiles of the
+  // controller's grid around this rank's subdomain, as it was when
+  // they were fetched
+  ARBFNMode requested_mode, mode;
+  TileCache tiles;
+  bool tiles_valid;
+  double tiles_sublo[3], tiles_subhi[3];
+
+  // How to pick a controller
+  bool is_spatial;
+
+  // The channel shared with any other instances in the same LAMMPS
+  // instance, and this one's part of it
+  static std::map<LAMMPS *, FixArbFnChannel *> channels;
+  FixArbFnChannel *channel;
+  size_t part;
+
+  // Persistent staging buffers, reused every step
+  AtomBuffer to_send;
+  FixBuffer to_recv;
+
+  // Shared format: The memory through which they are passed
+  SharedSegment segment;
+
+  // Collective format: The group of the controller and its
+  // collective workers, over which they are passed
+  MPI_Comm group;
+
+  // Delta mode: The atoms as last sent, and the changes since
+  AtomDelta delta;
+
+  // When sending IDs: The atoms held as of the last migration
+  // notice, and whether another may be due
+  Migration migration;
+  bool migration_due;
+
+  // Asynchronous (or delta) mode: The interchange in flight and the
+  // tags of the atoms its response is for
+  bool is_async;
+  PendingInterchange pending;
+  std::vector<tagint> sent_tags;
+
+  // The local index of each atom of the latest response, found by
+  // tag before any migrate, or -1 if it has since gone
+  std::vector<int> rows;
+
+  // Responses applied after the step they arrive on are kept in
+  // per-atom rows, so that they migrate with their atoms. Each slot
+  // of a row is the number of the response it came in, then that
+  // response's row (as laid out in `to_recv`).
+  double **stored;
+  int stored_width, stored_nmax, slot_width;
+  uintmax_t responses;
+
+  // Asynchronously: The response in flight is taken before atoms
+  // migrate, into the slot at `incoming_at`, and is applied at the
+  // next interchange
+  int incoming_at;
+  bool is_incoming;
+
+  // Lagged responses may be extrapolated from the latest few
+  // received for each atom. Its row keeps them at `history_at`: The
+  // number of the latest response, how many are known, then their
+  // force deltas, newest first.
+  size_t extrapolate_order;
+  int history_at;
+
+  // Holding: The latest response (with rates of change if agreed
+  // to) is applied on every step until the next one, from the slot
+  // of each atom's stored row at `held_at`
+  bool is_holding, with_rates;
+  int held_at;
+  uintmax_t held_response;
+
+  // Energy and virial: Summed over the atoms on this rank from the
+  // terms of the response applied on this step, and reduced over ranks
+  // when first asked for in a step
+  bool with_energy;
+  const double *energy_of, *virial_of[6];
+  int energy_at, virial_at;
+  double local_energy, energy_all;
+  bool energy_reduced;
+
+  // How to await the controller, and how long that took
+  Waiter waiter;
+
+  // Instrumentation: The latest interchange, its reduction over
+  // ranks (computed when first asked for), and the whole run
+  InterchangeStats step_stats, run_stats;
+  double step_all[FIX_ARBFN_SIZE_VECTOR];
+  bool step_reduced;
+
+  // Local indices of group members, rebuilt upon reneighboring
+  std::vector<int> indices;
+  bigint indices_ncalls;
+  int indices_nlocal;
 };
 }    // namespace LAMMPS_NS
 
@@ -0,0 +1,197 @@
+#include "fix_arbfn_omp.h"
+#include "atom.h"
+#include "comm.h"
+#include <algorithm>
+
+/// The fewest atoms worth giving each thread
+static const size_t min_atoms_per_thread = 1024;
+
+/**
+ * @brief Yields how many threads to share a loop over atoms between,
+ * such that each has enough to be worth starting
+ * @param _n The number of atoms
+ * @param _nthreads The number of threads available
+ * @return At least 1, and at most `_nthreads`
+ */
+static int count_shares(const size_t &_n, const int &_nthreads)
+{
+  const size_t most = std::max(_n / min_atoms_per_thread, (size_t) 1);
+  return (int) std::min((size_t) std::max(_nthreads, 1), most);
+}
+
+LAMMPS_NS::FixArbFnOMP::FixArbFnOMP(LAMMPS *_lmp, int _narg, char **_arg)
+    : FixArbFn(_lmp, _narg, _arg), nthreads(1)
+{
+}
+
+void LAMMPS_NS::FixArbFnOMP::init()
+{
+  FixArbFn::init();
+
+  // `comm' is the link to the controller here, so LAMMPS' is named
+  // in full. The threads also share encoding requests and decoding
+  // responses.
+  nthreads = std::max(Pointers::comm->nthreads, 1);
+  to_send.threads = delta.changed.threads = nthreads;
+  to_recv.threads = nthreads;
+}
+
+void LAMMPS_NS::FixArbFnOMP::find_indices()
+{
+  const int *const mask = atom->mask;
+  const int nlocal = atom->nlocal;
+  const int shares = count_shares(nlocal, nthreads);
+  if (thread_indices.size() < (size_t) shares) { thread_indices.resize(shares); }
+
+  // Each thread searches a contiguous share of the local atoms, so
+  // joining the shares in order keeps the indices ascending
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(shares) schedule(static, 1)
+#endif
+  for (int t = 0; t < shares; ++t) {
+    std::vector<int> &mine = thread_indices[t];
+    const int begin = (int) ((bigint) nlocal * t / shares);
+    const int end = (int) ((bigint) nlocal * (t + 1) / shares);
+    mine.clear();
+    for (int i = begin; i < end; ++i) {
+      if (mask[i] & groupbit) { mine.push_back(i); }
+    }
+  }
+
+  if ((size_t) nlocal > indices.capacity()) { indices.reserve(nlocal); }
+  indices.clear();
+  for (int t = 0; t < shares; ++t) {
+    indices.insert(indices.end(), thread_indices[t].begin(), thread_indices[t].end());
+  }
+}
+
+void LAMMPS_NS::FixArbFnOMP::gather_atoms(const uint64_t &_staged)
+{
+  const size_t n = indices.size();
+  const int shares = count_shares(n, nthreads);
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(shares) schedule(static, 1)
+#endif
+  for (int t = 0; t < shares; ++t) { gather_range(_staged, n * t / shares, n * (t + 1) / shares); }
+}
+
+void LAMMPS_NS::FixArbFnOMP::scatter_direct()
+{
+  add_rows(to_recv, indices.data(), indices.size());
+}
+
+void LAMMPS_NS::FixArbFnOMP::scatter_by_tag()
+{
+  find_rows();
+  add_rows(to_recv, rows.data(), rows.size());
+}
+
+void LAMMPS_NS::FixArbFnOMP::find_rows()
+{
+  const int nlocal = atom->nlocal;
+  const long n = (long) sent_tags.size();
+  rows.resize(sent_tags.size());
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(count_shares(sent_tags.size(), nthreads)) schedule(static)
+#endif
+  for (long j = 0; j < n; ++j) {
+    const int i = atom->map(sent_tags[j]);
+    rows[j] = (i >= 0 && i < nlocal ? i : -1);
+  }
+}
+
+void LAMMPS_NS::FixArbFnOMP::add_rows(const FixBuffer &_fixes, const int *const _rows,
+                                      const size_t &_n)
+{
+  double *const *const f = atom->f;
+  const int *const mask = atom->mask;
+  const long n = (long) _n;
+  const double *const df[3] = {_fixes.column(0), _fixes.column(1), _fixes.column(2)};
+
+  // Rows never share an atom, so each thread adds to the forces and
+  // per-atom virials of its own, while the sums are reduced
+  begin_tally(_fixes);
+  double energy = 0.0, virial_sum[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(count_shares(_n, nthreads)) reduction(+ : energy)
+#endif
+  {
+    double mine[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+#if defined(_OPENMP)
+#pragma omp for schedule(static)
+#endif
+    for (long j = 0; j < n; ++j) {
+      const int i = _rows[j];
+      if (i < 0 || !(mask[i] & groupbit)) { continue; }
+      for (size_t c = 0; c < 3; ++c) { f[i][c] += df[c][j]; }
+      if (energy_of != nullptr) { energy += energy_of[j]; }
+      if (virial_of[0] != nullptr) {
+        for (size_t c = 0; c < 6; ++c) {
+          mine[c] += virial_of[c][j];
+          if (vflag_atom) { vatom[i][c] += virial_of[c][j]; }
+        }
+      }
+    }
+
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+    for (size_t c = 0; c < 6; ++c) { virial_sum[c] += mine[c]; }
+  }
+
+  local_energy = energy;
+  if (virial_of[0] != nullptr && vflag_global) {
+    for (size_t c = 0; c < 6; ++c) { virial[c] += virial_sum[c]; }
+  }
+}
+
+void LAMMPS_NS::FixArbFnOMP::apply_stored(const int &_at, const uintmax_t &_response,
+                                          const double &_age)
+{
+  double *const *const f = atom->f;
+  const int *const mask = atom->mask;
+  const int nlocal = atom->nlocal;
+  const double number = (double) _response;
+  const bool has_rates = (to_recv.terms & ARBFN_TERM_RATES);
+  const size_t first_rate = 1 + (has_rates ? to_recv.term_column(ARBFN_TERM_RATES) : 0);
+  const double age = (has_rates ? _age : 0.0);
+
+  // As in `add_rows', but each atom's row is its own
+  begin_tally(to_recv);
+  double energy = 0.0, virial_sum[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(count_shares(nlocal, nthreads)) reduction(+ : energy)
+#endif
+  {
+    double mine[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+#if defined(_OPENMP)
+#pragma omp for schedule(static)
+#endif
+    for (int i = 0; i < nlocal; ++i) {
+      const double *const slot = stored[i] + _at;
+      if (slot[0] != number || !(mask[i] & groupbit)) { continue; }
+      for (size_t c = 0; c < 3; ++c) { f[i][c] += slot[1 + c] + age * slot[first_rate + c]; }
+      if (energy_at >= 0) { energy += slot[1 + energy_at]; }
+      if (virial_at >= 0) {
+        for (size_t c = 0; c < 6; ++c) {
+          mine[c] += slot[1 + virial_at + c];
+          if (vflag_atom) { vatom[i][c] += slot[1 + virial_at + c]; }
+        }
+      }
+    }
+
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+    for (size_t c = 0; c < 6; ++c) { virial_sum[c] += mine[c]; }
+  }
+
+  local_energy = energy;
+  if (virial_at >= 0 && vflag_global) {
+    for (size_t c = 0; c < 6; ++c) { virial[c] += virial_sum[c]; }
+  }
+}
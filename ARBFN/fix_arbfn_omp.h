@@ -0,0 +1,57 @@
+/* -*- c++ -*- ----------------------------------------------------------
+    LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+    https://www.lammps.org/, Sandia National Laboratories
+    LAMMPS development team: developers@lammps.org
+
+    Copyright (2003) Sandia Corporation.  Under the terms of Contract
+    DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+    certain rights in this software.  This software is distributed under
+    the GNU General Public License.
+
+    See the README file in the top-level LAMMPS directory.
+-------------------------------------------------------------------------
+    Defines the `fix arbfn/omp` class, which shares the per-atom loops
+    of `fix arbfn` between OpenMP threads, as set by `package omp`.
+
+    J Dehmel, J Schiffbauer, 2024
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+// clang-format off
+FixStyle(arbfn/omp,FixArbFnOMP);
+// clang-format on
+#else
+
+#ifndef FIX_ARBFN_OMP_HPP
+#define FIX_ARBFN_OMP_HPP
+
+#include "fix_arbfn.h"
+#include <vector>
+
+namespace LAMMPS_NS {
+class FixArbFnOMP : public FixArbFn {
+ public:
+  FixArbFnOMP(class LAMMPS *, int, char **);
+
+  void init() override;
+
+ protected:
+  void find_indices() override;
+  void gather_atoms(const uint64_t &) override;
+  void scatter_direct() override;
+  void scatter_by_tag() override;
+  void find_rows() override;
+  void apply_stored(const int &, const uintmax_t &, const double &) override;
+
+  void add_rows(const FixBuffer &, const int *, const size_t &);
+
+  // The threads to share the loops between, as set by `package omp'
+  int nthreads;
+
+  // Each thread's share of the group members, as last found
+  std::vector<std::vector<int>> thread_indices;
+};
+}    // namespace LAMMPS_NS
+
+#endif    // FIX_ARBFN_OMP_HPP
+#endif    // FIX_CLASS
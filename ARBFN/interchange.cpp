@@ -4,10 +4,24 @@
  */
 
 #include "interchange.h"
+#include <algorithm>
+#include <atomic>
+#include <boost/json/basic_parser.hpp>
 #include <boost/json/src.hpp>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <iterator>
 #include <mpi.h>
+#include <random>
 #include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /**
  * @brief Turn a JSON object into a std::string
@@ -22,201 +36,2754 @@ std::string json_to_str(boost::json::value _what)
 }
 
 /**
- * @brief Yields a string JSON version of the given atom
- * @param _what The atom to JSON-ify
- * @return The serialized version of the atom
+ * @struct FieldInfo
+ * @brief Describes how a field is named and serialized
+ * @var FieldInfo::field The field being described
+ * @var FieldInfo::name The name used in `fix arbfn` and registration
+ * @var FieldInfo::keys The per-atom JSON keys of each column
+ * @var FieldInfo::is_integer Whether the field is integral in JSON
  */
-boost::json::object to_json(const AtomData &_what)
+struct FieldInfo {
+  ARBFNField field;
+  const char *name;
+  const char *keys[3];
+  bool is_integer;
+};
+
+/**
+ * @brief All fields, in ascending bit order
+ */
+static const FieldInfo field_info[] = {
+    {ARBFN_FIELD_X, "x", {"x", "y", "z"}, false},
+    {ARBFN_FIELD_V, "v", {"vx", "vy", "vz"}, false},
+    {ARBFN_FIELD_F, "f", {"fx", "fy", "fz"}, false},
+    {ARBFN_FIELD_MU, "mu", {"mux", "muy", "muz"}, false},
+    {ARBFN_FIELD_Q, "q", {"q", nullptr, nullptr}, false},
+    {ARBFN_FIELD_TYPE, "type", {"type", nullptr, nullptr}, true},
+    {ARBFN_FIELD_ID, "id", {"id", nullptr, nullptr}, true},
+};
+
+/**
+ * @brief The most columns which the fields of an atom may span
+ */
+static const size_t max_field_columns = 15;
+
+/**
+ * @brief Looks up a field by name
+ * @return The field, or 0 if no field has the given name
+ */
+uint64_t field_from_name(const std::string &_name)
+{
+  for (const FieldInfo &info : field_info) {
+    if (_name == info.name) { return info.field; }
+  }
+  return 0;
+}
+
+/**
+ * @brief Yields the name of the given field
+ */
+const char *field_name(const uint64_t &_field)
+{
+  for (const FieldInfo &info : field_info) {
+    if (_field == (uint64_t) info.field) { return info.name; }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Yields the per-atom JSON key of one component of a field
+ */
+const char *field_key(const uint64_t &_field, const size_t &_component)
+{
+  for (const FieldInfo &info : field_info) {
+    if (_field == (uint64_t) info.field && _component < field_width(_field)) {
+      return info.keys[_component];
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @struct TermInfo
+ * @brief Describes how a response term is named and serialized
+ * @var TermInfo::term The term being described
+ * @var TermInfo::name The name used in registration
+ * @var TermInfo::keys The per-atom JSON keys of each column
+ */
+struct TermInfo {
+  ARBFNTerm term;
+  const char *name;
+  const char *keys[6];
+};
+
+/**
+ * @brief All terms, in ascending bit order
+ */
+static const TermInfo term_info[] = {
+    {ARBFN_TERM_RATES, "rates", {"dfx_dt", "dfy_dt", "dfz_dt", nullptr, nullptr, nullptr}},
+    {ARBFN_TERM_ENERGY, "energy", {"energy", nullptr, nullptr, nullptr, nullptr, nullptr}},
+    {ARBFN_TERM_VIRIAL,
+     "virial",
+     {"virial_xx", "virial_yy", "virial_zz", "virial_xy", "virial_xz", "virial_yz"}},
+};
+
+/**
+ * @brief The most columns which the terms of a fix may span
+ */
+static const size_t max_term_columns = 10;
+
+/**
+ * @brief Yields the name of the given term
+ */
+const char *term_name(const uint64_t &_term)
+{
+  for (const TermInfo &info : term_info) {
+    if (_term == (uint64_t) info.term) { return info.name; }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Yields the per-atom JSON key of one column of a term
+ */
+const char *term_key(const uint64_t &_term, const size_t &_component)
+{
+  for (const TermInfo &info : term_info) {
+    if (_term == (uint64_t) info.term && _component < term_width(_term)) {
+      return info.keys[_component];
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The names of each precision, in order
+ */
+static const char *const precision_names[3] = {"double", "single", "quantized"};
+
+/**
+ * @brief Yields the name of the given precision
+ */
+const char *precision_name(const ARBFNPrecision &_precision)
+{
+  return precision_names[_precision];
+}
+
+/**
+ * @brief Looks up a precision by name
+ */
+bool precision_from_name(const std::string &_name, ARBFNPrecision &_into)
+{
+  for (size_t p = 0; p < 3; ++p) {
+    if (_name == precision_names[p]) {
+      _into = (ARBFNPrecision) p;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Writes a double as JSON text, such that it parses back as
+ * the same double (rather than as an integer). JSON has no NaN or
+ * infinity, so those are written as `null`.
+ */
+size_t format_double(char *_into, const double &_what)
+{
+  if (!std::isfinite(_what)) {
+    std::memcpy(_into, "null", 5);
+    return 4;
+  }
+
+  size_t length = std::snprintf(_into, ARBFN_MAX_DOUBLE_CHARS, "%.17g", _what);
+  if (std::strpbrk(_into, ".eE") == nullptr) {
+    _into[length++] = '.';
+    _into[length++] = '0';
+    _into[length] = '\0';
+  }
+  return length;
+}
+
+/**
+ * @brief Appends some text to a packet
+ * @param _into The packet to append to
+ * @param _what The text to append
+ * @param _length The number of characters to append
+ */
+static void append(std::vector<char> &_into, const char *_what, const size_t &_length)
+{
+  _into.insert(_into.end(), _what, _what + _length);
+}
+
+/**
+ * @brief Appends a null-terminated string to a packet
+ */
+static void append(std::vector<char> &_into, const char *_what)
+{
+  append(_into, _what, std::strlen(_what));
+}
+
+/**
+ * @brief Appends a double to a packet, as by `format_double`
+ */
+static void append_double(std::vector<char> &_into, const double &_what)
+{
+  char buffer[ARBFN_MAX_DOUBLE_CHARS];
+  append(_into, buffer, format_double(buffer, _what));
+}
+
+/**
+ * @brief Appends an integer to a packet
+ */
+static void append_integer(std::vector<char> &_into, const int64_t &_what)
+{
+  char buffer[ARBFN_MAX_DOUBLE_CHARS];
+  append(_into, buffer, std::snprintf(buffer, sizeof(buffer), "%lld", (long long) _what));
+}
+
+/// The fewest atoms worth spreading over threads when encoding
+static const size_t min_atoms_per_thread = 1024;
+
+/**
+ * @brief Appends some rows of a staging buffer to a JSON packet as
+ * objects, each preceded by a comma unless it is the first atom
+ * @param _columns The columns to write
+ * @param _keys The key of each column
+ * @param _is_integer Whether each column holds integers
+ * @param _width The number of columns
+ * @param _begin The first row to write
+ * @param _end One past the last row to write
+ * @param _into The packet to append to
+ * @return False if any value was not finite, which JSON cannot
+ * carry, else true
+ */
+static bool append_json_rows(const double *const _columns[], const char *const _keys[],
+                             const bool _is_integer[], const size_t &_width,
+                             const size_t &_begin, const size_t &_end, std::vector<char> &_into)
+{
+  bool is_finite = true;
+  for (size_t i = _begin; i < _end; ++i) {
+    append(_into, (i == 0 ? "{" : ",{"));
+    for (size_t c = 0; c < _width; ++c) {
+      append(_into, (c == 0 ? "\"" : ",\""));
+      append(_into, _keys[c]);
+      append(_into, "\":");
+      if (_is_integer[c]) {
+        append_integer(_into, (int64_t) _columns[c][i]);
+      } else {
+        is_finite = is_finite && std::isfinite(_columns[c][i]);
+        append_double(_into, _columns[c][i]);
+      }
+    }
+    _into.push_back('}');
+  }
+  return is_finite;
+}
+
+/**
+ * @brief Appends the atoms of a staging buffer to a JSON packet as a
+ * list of objects, straight from the columns. Given enough atoms,
+ * the buffer's `threads` each write a contiguous share into their
+ * own chunk, and the chunks are joined in order.
+ * @param _from The staged atoms
+ * @param _into The packet to append to
+ * @return False if any value was not finite, else true
+ */
+static bool append_json_atoms(const AtomBuffer &_from, std::vector<char> &_into)
+{
+  const double *columns[max_field_columns];
+  const char *keys[max_field_columns];
+  bool is_integer[max_field_columns];
+  size_t width = 0;
+
+  // Each key is written along with the separator before it
+  for (const FieldInfo &info : field_info) {
+    if (!(_from.fields & info.field)) { continue; }
+    for (size_t c = 0; c < field_width(info.field); ++c, ++width) {
+      columns[width] = _from.column(info.field, c);
+      keys[width] = info.keys[c];
+      is_integer[width] = info.is_integer;
+    }
+  }
+
+  _into.push_back('[');
+  bool is_finite = true;
+  const size_t threads = std::min(_from.threads, _from.n / min_atoms_per_thread);
+  if (threads <= 1) {
+    is_finite = append_json_rows(columns, keys, is_integer, width, 0, _from.n, _into);
+  } else {
+    if (_from.chunks.size() < threads) { _from.chunks.resize(threads); }
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(threads) schedule(static, 1) reduction(&& : is_finite)
+#endif
+    for (size_t t = 0; t < threads; ++t) {
+      std::vector<char> &chunk = _from.chunks[t];
+      chunk.clear();
+      is_finite = append_json_rows(columns, keys, is_integer, width, _from.n * t / threads,
+                                   _from.n * (t + 1) / threads, chunk) &&
+          is_finite;
+    }
+
+    for (size_t t = 0; t < threads; ++t) {
+      append(_into, _from.chunks[t].data(), _from.chunks[t].size());
+    }
+  }
+  _into.push_back(']');
+  return is_finite;
+}
+
+/**
+ * @brief Writes a JSON request (or delta) straight from the columns
+ * of a staging buffer, without building the document first. The
+ * text is as `boost::json` would have serialized it, up to the
+ * formatting of numbers.
+ * @param _from The staged atoms
+ * @param _left The tags of the atoms which left, for a delta, else
+ * nullptr
+ * @param _max_ms The max ms the worker will await the response
+ * @param _into Where to write the text. Overwritten.
+ * @return False if any value was not finite, else true
+ */
+static bool write_json_request(const AtomBuffer &_from, const std::vector<double> *_left,
+                               const double &_max_ms, std::vector<char> &_into)
+{
+  _into.clear();
+  append(_into, (_left != nullptr ? "{\"type\":\"delta\",\"expectResponse\":"
+                                  : "{\"type\":\"request\",\"expectResponse\":"));
+  append_double(_into, _max_ms);
+  append(_into, ",\"atoms\":");
+  const bool is_finite = append_json_atoms(_from, _into);
+  if (_left != nullptr) {
+    append(_into, ",\"left\":[");
+    for (size_t i = 0; i < _left->size(); ++i) {
+      if (i > 0) { _into.push_back(','); }
+      append_integer(_into, (int64_t) (*_left)[i]);
+    }
+    _into.push_back(']');
+  }
+  _into.push_back('}');
+  return is_finite;
+}
+
+/**
+ * @brief Writes a multiplexed JSON request, with a part for each of
+ * the given fixes, tagged with its ID
+ * @param _fixes The fixes registered together
+ * @param _parts The positions of those to send
+ * @param _max_ms The max ms the worker will await the response
+ * @param _into Where to write the text. Overwritten.
+ * @return False if any value was not finite, else true
+ */
+static bool write_json_parts(const std::vector<MultiplexedFix> &_fixes,
+                             const std::vector<size_t> &_parts, const double &_max_ms,
+                             std::vector<char> &_into)
+{
+  _into.clear();
+  append(_into, "{\"type\":\"request\",\"expectResponse\":");
+  append_double(_into, _max_ms);
+  append(_into, ",\"fixes\":[");
+  bool is_finite = true;
+  for (size_t k = 0; k < _parts.size(); ++k) {
+    const MultiplexedFix &fix = _fixes[_parts[k]];
+    append(_into, (k == 0 ? "{\"fix\":" : ",{\"fix\":"));
+    append(_into, boost::json::serialize(boost::json::string_view(fix.id)).c_str());
+    append(_into, ",\"atoms\":");
+    is_finite = append_json_atoms(*fix.atoms, _into) && is_finite;
+    _into.push_back('}');
+  }
+  append(_into, "]}");
+  return is_finite;
+}
+
+/// Explains why a request could not be written as JSON
+static const char *const non_finite_message =
+    "Cannot send a NaN or infinite value as JSON: Check the atoms, or use `format binary'\n";
+
+/**
+ * @class FixHandler
+ * @brief Handles the events of a `boost::json::basic_parser` as it
+ * reads a JSON response (or "waiting" packet), writing each fix
+ * straight into a fix buffer of the expected size without building
+ * the document. Anything else in the packet is skipped. A
+ * multiplexed response holds its fixes in a list of parts instead,
+ * one for each fix sent, in order.
+ */
+class FixHandler {
+ public:
+  constexpr static size_t max_object_size = size_t(-1);
+  constexpr static size_t max_array_size = size_t(-1);
+  constexpr static size_t max_key_size = size_t(-1);
+  constexpr static size_t max_string_size = size_t(-1);
+
+  /// Counts the fixes of a part without `"atoms"`
+  const static size_t no_atoms = size_t(-1);
+
+  /// The `"type"` of the packet
+  std::string type;
+
+  /// The number of fixes in `"atoms"`, including any past the end
+  /// of the buffer
+  size_t count = 0;
+
+  /// Whether the packet held the list `"atoms"`
+  bool has_atoms = false;
+
+  /// Whether a multiplexed packet held the list `"fixes"`
+  bool has_fixes = false;
+
+  /// The `"fix"` of each part of a multiplexed packet, and the
+  /// number of fixes in each (or `no_atoms`)
+  std::vector<std::string> ids;
+  std::vector<size_t> counts;
+
+  /// If not null, the key which a fix lacked or held a non-number in
+  const char *bad_key = nullptr;
+
+  /**
+   * @param _into The buffer to write the fixes into, already sized
+   * for the number expected
+   */
+  FixHandler(FixBuffer &_into) : base(0), in_part(true) { target(&_into); }
+
+  /**
+   * @param _fixes The fixes registered together
+   * @param _parts The positions of those sent, whose buffers are
+   * already sized for the number expected
+   */
+  FixHandler(std::vector<MultiplexedFix> &_fixes, const std::vector<size_t> &_parts) :
+      fixes(&_fixes), parts(&_parts), base(2), in_part(false)
+  {
+  }
+
+  bool on_document_begin(boost::json::error_code &) { return true; }
+  bool on_document_end(boost::json::error_code &) { return true; }
+
+  bool on_object_begin(boost::json::error_code &_ec)
+  {
+    if (!is_number_expected(_ec)) { return false; }
+    ++depth;
+    if (base > 0 && depth == 3 && in_fixes) {
+      // Parts beyond those sent are read, but not kept
+      const size_t part = counts.size();
+      in_part = true;
+      has_atoms = false;
+      ids.emplace_back();
+      target(part < parts->size() ? (*fixes)[(*parts)[part]].fixes : nullptr);
+    } else if (depth == base + 3 && in_atoms) {
+      // Terms may be left out when zero
+      seen = 0;
+      if (into != nullptr && count < into->n) {
+        for (size_t c = 3; c < into->width; ++c) { into->column(c)[count] = 0.0; }
+      }
+    }
+    return true;
+  }
+
+  bool on_object_end(size_t, boost::json::error_code &_ec)
+  {
+    if (depth == base + 3 && in_atoms) {
+      for (size_t c = 0; c < 3 && into != nullptr; ++c) {
+        if (!(seen & ((uint64_t) 1 << c))) { return fail(keys[c], _ec); }
+      }
+      ++count;
+    } else if (base > 0 && depth == 3 && in_part) {
+      counts.push_back(has_atoms ? count : (size_t) no_atoms);
+      in_part = false;
+    }
+    --depth;
+    return true;
+  }
+
+  bool on_array_begin(boost::json::error_code &_ec)
+  {
+    if (!is_number_expected(_ec)) { return false; }
+    ++depth;
+    if (depth == base + 2 && in_part && key == KEY_ATOMS) {
+      has_atoms = in_atoms = true;
+    } else if (base > 0 && depth == 2 && key == KEY_FIXES) {
+      has_fixes = in_fixes = true;
+    }
+    return true;
+  }
+
+  bool on_array_end(size_t, boost::json::error_code &)
+  {
+    if (depth == base + 2) {
+      in_atoms = false;
+    } else if (base > 0 && depth == 2) {
+      in_fixes = false;
+    }
+    --depth;
+    return true;
+  }
+
+  bool on_key_part(boost::json::string_view _part, size_t, boost::json::error_code &)
+  {
+    partial.append(_part.data(), _part.size());
+    return true;
+  }
+
+  bool on_key(boost::json::string_view _part, size_t, boost::json::error_code &)
+  {
+    const char *text = _part.data();
+    size_t length = _part.size();
+    if (!partial.empty()) {
+      partial.append(text, length);
+      text = partial.data();
+      length = partial.size();
+    }
+
+    if (depth == 1) {
+      key = (is_key(text, length, "type")    ? KEY_TYPE
+             : is_key(text, length, "atoms") ? KEY_ATOMS
+             : is_key(text, length, "fixes") ? KEY_FIXES
+                                             : KEY_OTHER);
+    } else if (base > 0 && depth == 3 && in_part) {
+      key = (is_key(text, length, "fix")     ? KEY_FIX
+             : is_key(text, length, "atoms") ? KEY_ATOMS
+                                             : KEY_OTHER);
+    } else if (depth == base + 3 && in_atoms && into != nullptr) {
+      // Keys usually come in the order they were written in
+      column = no_column;
+      for (size_t tried = 0, c = next; tried < into->width; ++tried, ++c) {
+        if (c >= into->width) { c = 0; }
+        if (is_key(text, length, keys[c])) {
+          column = c;
+          next = c + 1;
+          break;
+        }
+      }
+    }
+    partial.clear();
+    return true;
+  }
+
+  bool on_string_part(boost::json::string_view _part, size_t, boost::json::error_code &_ec)
+  {
+    if (!is_number_expected(_ec)) { return false; }
+    if (is_text_expected()) { partial.append(_part.data(), _part.size()); }
+    return true;
+  }
+
+  bool on_string(boost::json::string_view _part, size_t, boost::json::error_code &_ec)
+  {
+    if (!is_number_expected(_ec)) { return false; }
+    if (is_text_expected()) {
+      std::string &text = (depth == 1 ? type : ids.back());
+      text = partial;
+      text.append(_part.data(), _part.size());
+    }
+    partial.clear();
+    return true;
+  }
+
+  bool on_number_part(boost::json::string_view, boost::json::error_code &) { return true; }
+  bool on_int64(int64_t _what, boost::json::string_view, boost::json::error_code &)
+  {
+    return on_number(_what);
+  }
+  bool on_uint64(uint64_t _what, boost::json::string_view, boost::json::error_code &)
+  {
+    return on_number(_what);
+  }
+  bool on_double(double _what, boost::json::string_view, boost::json::error_code &)
+  {
+    return on_number(_what);
+  }
+  bool on_bool(bool, boost::json::error_code &_ec) { return is_number_expected(_ec); }
+  bool on_null(boost::json::error_code &_ec) { return is_number_expected(_ec); }
+  bool on_comment_part(boost::json::string_view, boost::json::error_code &) { return true; }
+  bool on_comment(boost::json::string_view, boost::json::error_code &) { return true; }
+
+ private:
+  const static size_t no_column = size_t(-1);
+  enum Key { KEY_OTHER, KEY_TYPE, KEY_ATOMS, KEY_FIXES, KEY_FIX };
+
+  // Multiplexed packets only
+  std::vector<MultiplexedFix> *fixes = nullptr;
+  const std::vector<size_t> *parts = nullptr;
+  bool in_fixes = false;
+
+  // The depth of "atoms" is 1 plus this, and that of each fix 3 plus
+  // this; fixes are only read within a part
+  const size_t base;
+  bool in_part;
+
+  FixBuffer *into = nullptr;
+  const char *keys[3 + max_term_columns];
+  std::string partial;
+  size_t depth = 0;
+  Key key = KEY_OTHER;
+  bool in_atoms = false;
+  size_t column = no_column;
+  size_t next = 0;
+  uint64_t seen = 0;
+
+  static bool is_key(const char *_text, const size_t &_length, const char *_key)
+  {
+    return std::strncmp(_text, _key, _length) == 0 && _key[_length] == '\0';
+  }
+
+  /// Starts writing fixes into the given buffer, if any
+  void target(FixBuffer *_into)
+  {
+    into = _into;
+    count = 0;
+    next = 0;
+    column = no_column;
+    if (into == nullptr) { return; }
+
+    keys[0] = "dfx";
+    keys[1] = "dfy";
+    keys[2] = "dfz";
+    size_t k = 3;
+    for (const TermInfo &info : term_info) {
+      if (!(into->terms & info.term)) { continue; }
+      for (size_t c = 0; c < term_width(info.term); ++c, ++k) { keys[k] = info.keys[c]; }
+    }
+  }
+
+  bool fail(const char *_key, boost::json::error_code &_ec)
+  {
+    bad_key = _key;
+    _ec = boost::json::error::not_number;
+    return false;
+  }
+
+  /// Fails if a value other than a number is given for a fix's key
+  bool is_number_expected(boost::json::error_code &_ec)
+  {
+    if (depth == base + 3 && in_atoms && column != no_column) { return fail(keys[column], _ec); }
+    return true;
+  }
+
+  /// Whether a string is the packet's `"type"` or a part's `"fix"`
+  bool is_text_expected() const
+  {
+    return (depth == 1 && key == KEY_TYPE) ||
+           (base > 0 && depth == 3 && in_part && key == KEY_FIX);
+  }
+
+  bool on_number(const double &_what)
+  {
+    if (depth == base + 3 && in_atoms && column != no_column) {
+      if (count < into->n) { into->column(column)[count] = _what; }
+      seen |= (uint64_t) 1 << column;
+      column = no_column;
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief Parses a JSON packet from the controller straight into a
+ * fix buffer, without building the document.
+ * @param _text The packet
+ * @param _into The buffer to write any fixes into, already sized for
+ * the number expected
+ * @param _type Where to save the `"type"` of the packet
+ * @param _count Where to save the number of fixes in the packet
+ * @return True on success, false if the packet was malformed
+ */
+static bool parse_json_fixes(const std::vector<char> &_text, FixBuffer &_into, std::string &_type,
+                             size_t &_count)
+{
+  boost::json::basic_parser<FixHandler> parser(boost::json::parse_options(), _into);
+  boost::json::error_code ec;
+
+  parser.write_some(false, _text.data(), _text.size(), ec);
+  const FixHandler &handler = parser.handler();
+  if (handler.bad_key != nullptr) {
+    std::cerr << "Controller sent fix without numeric '" << handler.bad_key << "'\n";
+    return false;
+  } else if (ec) {
+    std::cerr << "Controller sent malformed JSON: " << ec.message() << "\n";
+    return false;
+  } else if (handler.type == "response" && !handler.has_atoms) {
+    std::cerr << "Controller sent response without atoms\n";
+    return false;
+  }
+
+  _type = handler.type;
+  _count = handler.count;
+  return true;
+}
+
+/**
+ * @brief Parses a multiplexed JSON packet from the controller
+ * straight into the fix buffers of the fixes sent, without building
+ * the document.
+ * @param _text The packet
+ * @param _fixes The fixes registered together
+ * @param _parts The positions of those sent, whose buffers are
+ * already sized for the number expected
+ * @param _type Where to save the `"type"` of the packet
+ * @return True on success, false if the packet was malformed, or
+ * did not answer each fix sent
+ */
+static bool parse_json_parts(const std::vector<char> &_text, std::vector<MultiplexedFix> &_fixes,
+                             const std::vector<size_t> &_parts, std::string &_type)
+{
+  boost::json::basic_parser<FixHandler> parser(boost::json::parse_options(), _fixes, _parts);
+  boost::json::error_code ec;
+
+  parser.write_some(false, _text.data(), _text.size(), ec);
+  const FixHandler &handler = parser.handler();
+  if (handler.bad_key != nullptr) {
+    std::cerr << "Controller sent fix without numeric '" << handler.bad_key << "'\n";
+    return false;
+  } else if (ec) {
+    std::cerr << "Controller sent malformed JSON: " << ec.message() << "\n";
+    return false;
+  }
+
+  _type = handler.type;
+  if (_type != "response") { return true; }
+  if (!handler.has_fixes || handler.counts.size() != _parts.size()) {
+    std::cerr << "Controller sent response without a part for each fix\n";
+    return false;
+  }
+  for (size_t k = 0; k < _parts.size(); ++k) {
+    const MultiplexedFix &fix = _fixes[_parts[k]];
+    if (handler.ids[k] != fix.id) {
+      std::cerr << "Controller sent part for fix '" << handler.ids[k] << "' in place of '"
+                << fix.id << "'\n";
+      return false;
+    } else if (handler.counts[k] == FixHandler::no_atoms) {
+      std::cerr << "Controller sent part without atoms\n";
+      return false;
+    } else if (handler.counts[k] != fix.fixes->n) {
+      std::cerr << "Received malformed fix data from controller: Expected " << fix.fixes->n
+                << " atoms for fix '" << fix.id << "', but got " << handler.counts[k] << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Yields a pointer to column `_c` of a staging buffer,
+ * counting across all fields
+ */
+static double *raw_column(AtomBuffer &_buffer, const size_t &_c)
+{
+  return reinterpret_cast<double *>(_buffer.data() + sizeof(BinaryHeader)) + _c * _buffer.n;
+}
+
+/**
+ * @brief Yields a pointer to column `_c` of a staging buffer,
+ * counting across all fields
+ */
+static const double *raw_column(const AtomBuffer &_buffer, const size_t &_c)
+{
+  return reinterpret_cast<const double *>(_buffer.data() + sizeof(BinaryHeader)) + _c * _buffer.n;
+}
+
+/**
+ * @brief Yields which columns of the given fields must stay exact
+ * @return A bitmask with bit `c` set if column `c` is integral
+ */
+static uint64_t exact_columns(const uint64_t &_fields)
+{
+  uint64_t exact = 0;
+  size_t c = 0;
+  for (const FieldInfo &info : field_info) {
+    if (!(_fields & info.field)) { continue; }
+    for (size_t k = 0; k < field_width(info.field); ++k, ++c) {
+      if (info.is_integer) { exact |= (uint64_t) 1 << c; }
+    }
+  }
+  return exact;
+}
+
+/**
+ * @brief Yields the size of one packed column, padded so that the
+ * next one stays aligned
+ * @param _n The number of values in the column
+ * @param _precision The precision it travels at
+ * @param _is_exact Whether it travels as doubles regardless
+ */
+static size_t packed_column_size(const size_t &_n, const ARBFNPrecision &_precision,
+                                 const bool &_is_exact)
+{
+  size_t bytes = _n * sizeof(double);
+  if (_is_exact || _precision == ARBFN_PRECISION_DOUBLE) {
+    return bytes;
+  } else if (_precision == ARBFN_PRECISION_SINGLE) {
+    bytes = _n * sizeof(float);
+  } else {
+    bytes = 2 * sizeof(double) + _n * sizeof(uint16_t);
+  }
+  return (bytes + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+}
+
+/**
+ * @brief Yields the size of a packet of the given columns
+ */
+static size_t packed_size(const size_t &_n, const size_t &_columns, const uint64_t &_exact,
+                          const ARBFNPrecision &_precision)
+{
+  size_t bytes = sizeof(BinaryHeader);
+  for (size_t c = 0; c < _columns; ++c) {
+    bytes += packed_column_size(_n, _precision, (_exact >> c) & 1);
+  }
+  return bytes;
+}
+
+#if defined(_OPENMP)
+/**
+ * @brief Yields whether a loop over `_n` values is worth sharing
+ * between `_threads` OpenMP threads
+ */
+static bool worth_threading(const size_t &_n, const size_t &_threads)
+{
+  return _threads > 1 && _n >= 2 * min_atoms_per_thread;
+}
+#endif
+
+/**
+ * @brief Writes contiguous columns of doubles at reduced precision
+ * @param _from The first column, followed by the others
+ * @param _n The number of values in each column
+ * @param _columns The number of columns
+ * @param _exact Bitmask of the columns which travel as doubles
+ * @param _precision The precision they travel at
+ * @param _threads The number of OpenMP threads to share each column
+ * @param _into Where to write the columns, just past the header
+ */
+static void pack_columns(const double *_from, const size_t &_n, const size_t &_columns,
+                         const uint64_t &_exact, const ARBFNPrecision &_precision,
+                         const size_t &_threads, char *_into)
+{
+  const long n = (long) _n;
+#if !defined(_OPENMP)
+  (void) _threads;
+#endif
+
+  for (size_t c = 0; c < _columns; ++c) {
+    const double *const from = _from + c * _n;
+    const bool is_exact = (_exact >> c) & 1;
+    const size_t size = packed_column_size(_n, _precision, is_exact);
+
+    if (is_exact || _precision == ARBFN_PRECISION_DOUBLE) {
+      std::memcpy(_into, from, _n * sizeof(double));
+    } else if (_precision == ARBFN_PRECISION_SINGLE) {
+      float *const to = reinterpret_cast<float *>(_into);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (worth_threading(_n, _threads)) schedule(static)
+#endif
+      for (long i = 0; i < n; ++i) { to[i] = (float) from[i]; }
+      std::memset(_into + _n * sizeof(float), 0, size - _n * sizeof(float));
+    } else {
+      // Spread the integers evenly from the least value to the
+      // greatest, rounding each value to the nearest
+      double range[2] = {0.0, 0.0}, scale = 0.0, magnify = 1.0;
+      if (_n > 0) {
+        double least = from[0], greatest = from[0];
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (worth_threading(_n, _threads)) schedule(static) \
+    reduction(min : least) reduction(max : greatest)
+#endif
+        for (long i = 1; i < n; ++i) {
+          least = std::min(least, from[i]);
+          greatest = std::max(greatest, from[i]);
+        }
+        const double spread = greatest - least;
+        range[0] = least;
+        range[1] = spread / ARBFN_QUANTIZED_MAX;
+        scale = (spread > 0.0 ? ARBFN_QUANTIZED_MAX / spread : 0.0);
+
+        // Spreads too small to invert are first magnified (exactly,
+        // by a power of two), while infinite ones are given up on
+        if (spread > 0.0 && !std::isfinite(scale)) {
+          magnify = std::ldexp(1.0, 600);
+          scale = ARBFN_QUANTIZED_MAX / (spread * magnify);
+        }
+        if (!std::isfinite(scale)) { scale = 0.0; }
+      }
+      std::memcpy(_into, range, sizeof(range));
+      uint16_t *const to = reinterpret_cast<uint16_t *>(_into + sizeof(range));
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (worth_threading(_n, _threads)) schedule(static)
+#endif
+      for (long i = 0; i < n; ++i) {
+        to[i] = (uint16_t) ((from[i] - range[0]) * magnify * scale + 0.5);
+      }
+      std::memset(_into + sizeof(range) + _n * sizeof(uint16_t), 0,
+                  size - sizeof(range) - _n * sizeof(uint16_t));
+    }
+    _into += size;
+  }
+}
+
+/**
+ * @brief Reads contiguous columns of doubles back from reduced
+ * precision, as written by `pack_columns`
+ * @param _from The packed columns, just past the header
+ * @param _n The number of values in each column
+ * @param _columns The number of columns
+ * @param _exact Bitmask of the columns which travel as doubles
+ * @param _precision The precision they travel at
+ * @param _threads The number of OpenMP threads to share each column
+ * @param _into The first column, followed by the others
+ */
+static void unpack_columns(const char *_from, const size_t &_n, const size_t &_columns,
+                           const uint64_t &_exact, const ARBFNPrecision &_precision,
+                           const size_t &_threads, double *_into)
+{
+  const long n = (long) _n;
+#if !defined(_OPENMP)
+  (void) _threads;
+#endif
+
+  for (size_t c = 0; c < _columns; ++c) {
+    double *const to = _into + c * _n;
+    const bool is_exact = (_exact >> c) & 1;
+
+    if (is_exact || _precision == ARBFN_PRECISION_DOUBLE) {
+      std::memcpy(to, _from, _n * sizeof(double));
+    } else if (_precision == ARBFN_PRECISION_SINGLE) {
+      const float *const from = reinterpret_cast<const float *>(_from);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (worth_threading(_n, _threads)) schedule(static)
+#endif
+      for (long i = 0; i < n; ++i) { to[i] = from[i]; }
+    } else {
+      double range[2];
+      std::memcpy(range, _from, sizeof(range));
+      const uint16_t *const from = reinterpret_cast<const uint16_t *>(_from + sizeof(range));
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (worth_threading(_n, _threads)) schedule(static)
+#endif
+      for (long i = 0; i < n; ++i) { to[i] = range[0] + range[1] * from[i]; }
+    }
+    _from += packed_column_size(_n, _precision, is_exact);
+  }
+}
+
+/**
+ * @brief Yields the size of the packet the staged atoms travel as
+ */
+size_t packed_size(const AtomBuffer &_atoms)
+{
+  return packed_size(_atoms.n, field_columns(_atoms.fields), exact_columns(_atoms.fields),
+                     _atoms.precision);
+}
+
+/**
+ * @brief Yields the size of the packet the fixes travel as
+ */
+size_t packed_size(const FixBuffer &_fixes)
+{
+  return packed_size(_fixes.n, _fixes.width, 0, _fixes.precision);
+}
+
+/**
+ * @brief Writes the staged atoms as a packet at their precision
+ */
+void pack(const AtomBuffer &_from, char *_into)
+{
+  std::memcpy(_into, _from.data(), sizeof(BinaryHeader));
+  pack_columns(raw_column(_from, 0), _from.n, field_columns(_from.fields),
+               exact_columns(_from.fields), _from.precision, _from.threads,
+               _into + sizeof(BinaryHeader));
+}
+
+/**
+ * @brief Reads staged atoms back from a packet written by `pack`
+ */
+void unpack(const char *_from, AtomBuffer &_into)
+{
+  std::memcpy(_into.data(), _from, sizeof(BinaryHeader));
+  unpack_columns(_from + sizeof(BinaryHeader), _into.n, field_columns(_into.fields),
+                 exact_columns(_into.fields), _into.precision, _into.threads,
+                 raw_column(_into, 0));
+}
+
+/**
+ * @brief Writes fixes as a packet at their precision
+ */
+void pack(const FixBuffer &_from, char *_into)
+{
+  std::memcpy(_into, _from.data(), sizeof(BinaryHeader));
+  pack_columns(_from.column(0), _from.n, _from.width, 0, _from.precision, _from.threads,
+               _into + sizeof(BinaryHeader));
+}
+
+/**
+ * @brief Reads fixes back from a packet written by `pack`
+ */
+void unpack(const char *_from, FixBuffer &_into)
+{
+  std::memcpy(_into.data(), _from, sizeof(BinaryHeader));
+  unpack_columns(_from + sizeof(BinaryHeader), _into.n, _into.width, 0, _into.precision,
+                 _into.threads, _into.column(0));
+}
+
+/**
+ * @brief Walks the merge of the atoms last sent with a delta,
+ * copying each resulting atom into `_into` unless it is null
+ * @return The number of resulting atoms
+ */
+static size_t merge_delta(const AtomBuffer &_mirror, const AtomBuffer &_changed,
+                          const double *_left, const size_t &_num_left, AtomBuffer *_into)
+{
+  const size_t num_columns = field_columns(_changed.fields);
+  const double *const old_tags = (_mirror.n > 0 ? _mirror.column(ARBFN_FIELD_ID, 0) : nullptr);
+  const double *const new_tags = (_changed.n > 0 ? _changed.column(ARBFN_FIELD_ID, 0) : nullptr);
+  size_t i = 0, j = 0, k = 0, count = 0;
+
+  while (i < _mirror.n || j < _changed.n) {
+    const AtomBuffer *from;
+    size_t row;
+
+    // Changed atoms replace their old values
+    if (j < _changed.n && (i >= _mirror.n || new_tags[j] <= old_tags[i])) {
+      if (i < _mirror.n && new_tags[j] == old_tags[i]) { ++i; }
+      from = &_changed;
+      row = j++;
+    } else {
+      while (k < _num_left && _left[k] < old_tags[i]) { ++k; }
+      if (k < _num_left && _left[k] == old_tags[i]) {
+        ++i;
+        continue;
+      }
+      from = &_mirror;
+      row = i++;
+    }
+
+    if (_into != nullptr) {
+      for (size_t c = 0; c < num_columns; ++c) {
+        raw_column(*_into, c)[count] = raw_column(*from, c)[row];
+      }
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+/**
+ * @brief Applies a delta to a copy of the atoms last sent
+ * @return True on success, false if the fields do not match
+ */
+bool apply_delta(AtomBuffer &_mirror, const AtomBuffer &_changed, const double *_left,
+                 const size_t &_num_left, AtomBuffer &_scratch)
+{
+  // Nothing is known yet upon (re-)registration
+  if (_mirror.n == 0) { _mirror.resize(0, _changed.fields); }
+  if (_changed.n > 0 && _changed.fields != _mirror.fields) {
+    std::cerr << "Delta has different fields than the atoms it updates\n";
+    return false;
+  } else if (!(_mirror.fields & ARBFN_FIELD_ID) && _mirror.fields != 0) {
+    std::cerr << "Delta lacks atom IDs\n";
+    return false;
+  }
+
+  const size_t n = merge_delta(_mirror, _changed, _left, _num_left, nullptr);
+  _scratch.resize(n, _mirror.fields);
+  merge_delta(_mirror, _changed, _left, _num_left, &_scratch);
+  std::swap(_mirror, _scratch);
+  return true;
+}
+
+/**
+ * @brief Finds the changes between the atoms last sent and the
+ * current ones, then takes the current ones as sent
+ */
+void stage_delta(const AtomBuffer &_current, AtomDelta &_delta)
+{
+  const size_t num_columns = field_columns(_current.fields);
+  const double *const tags = _current.column(ARBFN_FIELD_ID, 0);
+  AtomBuffer &snapshot = _delta.snapshot;
+
+  // Atoms sent under other fields are no use
+  if (snapshot.fields != _current.fields) { snapshot.resize(0, _current.fields); }
+  const double *const old_tags = (snapshot.n > 0 ? snapshot.column(ARBFN_FIELD_ID, 0) : nullptr);
+
+  // Walk the current atoms in order of tag alongside the snapshot
+  _delta.order.resize(_current.n);
+  for (size_t j = 0; j < _current.n; ++j) { _delta.order[j] = j; }
+  std::sort(_delta.order.begin(), _delta.order.end(),
+            [tags](const size_t &_a, const size_t &_b) { return tags[_a] < tags[_b]; });
+
+  _delta.rows.clear();
+  _delta.left.clear();
+  size_t i = 0;
+  for (const size_t &j : _delta.order) {
+    while (i < snapshot.n && old_tags[i] < tags[j]) { _delta.left.push_back(old_tags[i++]); }
+
+    // New atoms are always sent, and known ones if they changed
+    bool changed = (i >= snapshot.n || old_tags[i] != tags[j]);
+    for (size_t c = 0; !changed && c < num_columns; ++c) {
+      changed = std::fabs(raw_column(_current, c)[j] - raw_column(snapshot, c)[i]) >
+          _delta.tolerance;
+    }
+    if (i < snapshot.n && old_tags[i] == tags[j]) { ++i; }
+    if (changed) { _delta.rows.push_back(j); }
+  }
+  while (i < snapshot.n) { _delta.left.push_back(old_tags[i++]); }
+
+  _delta.changed.resize(_delta.rows.size(), _current.fields);
+  for (size_t c = 0; c < num_columns; ++c) {
+    const double *const from = raw_column(_current, c);
+    double *const to = raw_column(_delta.changed, c);
+    for (size_t r = 0; r < _delta.rows.size(); ++r) { to[r] = from[_delta.rows[r]]; }
+  }
+
+  apply_delta(snapshot, _delta.changed, _delta.left.data(), _delta.left.size(), _delta.merged);
+}
+
+/**
+ * @brief Tells the controller which atoms have arrived or left
+ * since the last call, if any have
+ */
+void notify_migration(const AtomBuffer &_atoms, Migration &_migration,
+                      const uint &_controller_rank, MPI_Comm &_comm, InterchangeStats *_stats)
+{
+  if (!_migration.enabled || !(_atoms.fields & ARBFN_FIELD_ID)) { return; }
+
+  // Compare the tags held now with those held before
+  const double *const tags = _atoms.column(ARBFN_FIELD_ID, 0);
+  std::vector<double> &current = _migration.current;
+  current.assign(tags, tags + _atoms.n);
+  std::sort(current.begin(), current.end());
+
+  std::vector<double> &held = _migration.held;
+  _migration.arrived.clear();
+  _migration.left.clear();
+  std::set_difference(current.begin(), current.end(), held.begin(), held.end(),
+                      std::back_inserter(_migration.arrived));
+  std::set_difference(held.begin(), held.end(), current.begin(), current.end(),
+                      std::back_inserter(_migration.left));
+  held.swap(current);
+  if (_migration.arrived.empty() && _migration.left.empty()) { return; }
+
+  boost::json::object json;
+  boost::json::array arrived, left;
+  for (const double &tag : _migration.arrived) { arrived.push_back((int64_t) tag); }
+  for (const double &tag : _migration.left) { left.push_back((int64_t) tag); }
+  json["type"] = "migrate";
+  json["arrived"] = arrived;
+  json["left"] = left;
+  const std::string to_send = json_to_str(json);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON,
+           _comm);
+  if (_stats != nullptr) { _stats->bytes_sent += to_send.size(); }
+}
+
+/// Empty polls spent spinning, then yielding, before the backoff strategy sleeps
+static const uint64_t backoff_spins = 64, backoff_yields = 64;
+
+/// The backoff strategy's first and longest sleeps, in microseconds
+static const uint64_t backoff_min_us = 1, backoff_max_us = 256;
+
+/**
+ * @brief Creates a waiter using the given strategy
+ */
+Waiter::Waiter(const ARBFNWait &_strategy) :
+    strategy(_strategy), max_ms(0.0), idle_count(0), armed(false), quitting(false)
+{
+}
+
+Waiter::~Waiter()
+{
+  {
+    std::lock_guard<std::mutex> lock(watchdog_mutex);
+    quitting = true;
+  }
+  watchdog_cv.notify_one();
+  if (watchdog.joinable()) { watchdog.join(); }
+}
+
+/**
+ * @brief Begins timing a wait, arming the watchdog if blocking
+ */
+void Waiter::start(const double &_max_ms)
+{
+  start_time = std::chrono::steady_clock::now();
+  max_ms = _max_ms;
+  progress();
+}
+
+/**
+ * @brief Restarts the timeout and the backoff
+ */
+void Waiter::progress()
+{
+  progress_time = std::chrono::steady_clock::now();
+  idle_count = 0;
+
+  if (strategy == ARBFN_WAIT_BLOCK && max_ms > 0.0) {
+    {
+      std::lock_guard<std::mutex> lock(watchdog_mutex);
+      if (!watchdog.joinable()) { watchdog = std::thread(&Waiter::watch, this); }
+      deadline = progress_time + std::chrono::microseconds((int64_t) (max_ms * 1000.0));
+      armed = true;
+    }
+    watchdog_cv.notify_one();
+  }
+}
+
+/**
+ * @brief Backs off after an empty poll, then checks the timeout
+ * @return False if the wait has timed out, true otherwise
+ */
+bool Waiter::idle()
+{
+  ++idle_count;
+
+  if (strategy == ARBFN_WAIT_BACKOFF && idle_count > backoff_spins) {
+    if (idle_count <= backoff_spins + backoff_yields) {
+      std::this_thread::yield();
+    } else {
+      const uint64_t doublings = idle_count - backoff_spins - backoff_yields - 1;
+      uint64_t sleep_us = backoff_max_us;
+      if (doublings < 16) { sleep_us = std::min(backoff_max_us, backoff_min_us << doublings); }
+      std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    }
+  }
+
+  // If it has been too long, indicate error
+  if (max_ms > 0.0) {
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - progress_time;
+    if (elapsed.count() > max_ms) {
+      std::cerr << "Timeout!\n";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Ends the current wait, recording its length
+ */
+void Waiter::stop()
+{
+  const std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start_time;
+  stats.record(elapsed.count());
+
+  if (strategy == ARBFN_WAIT_BLOCK) {
+    std::lock_guard<std::mutex> lock(watchdog_mutex);
+    armed = false;
+  }
+}
+
+/**
+ * @brief Body of the watchdog thread: Kills the process if a
+ * blocking wait outlives its deadline. MPI may not be called from
+ * this thread (LAMMPS does not ask for `MPI_THREAD_MULTIPLE`), so
+ * it relies upon the launcher to take down the other ranks.
+ */
+void Waiter::watch()
+{
+  std::unique_lock<std::mutex> lock(watchdog_mutex);
+  while (!quitting) {
+    if (!armed) {
+      watchdog_cv.wait(lock);
+    } else if (std::chrono::steady_clock::now() >= deadline) {
+      // The waiting thread is blocked inside MPI, so cannot notice
+      std::cerr << "Timeout!" << std::endl;
+      std::abort();
+    } else {
+      watchdog_cv.wait_until(lock, deadline);
+    }
+  }
+}
+
+/**
+ * @brief Yields the process-wide default waiter
+ */
+Waiter &default_waiter()
+{
+  static Waiter waiter(ARBFN_WAIT_BACKOFF);
+  return waiter;
+}
+
+SharedSegment::SharedSegment() :
+    token(0), fd(-1), base(nullptr), size(0), is_owner(false), is_linked(false)
+{
+}
+
+SharedSegment::~SharedSegment() { close(); }
+
+/**
+ * @brief Creates a new segment under a fresh name and token
+ * @return True on success, false on failure
+ */
+bool SharedSegment::create(const size_t &_size)
+{
+  static std::atomic<unsigned> next_segment(0);
+  std::random_device random;
+
+  close();
+
+  // Names need only be unique on this node
+  for (int attempt = 0; attempt < 16 && fd < 0; ++attempt) {
+    name = "/arbfn." + std::to_string(getpid()) + "." + std::to_string(next_segment++);
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno != EEXIST) { break; }
+  }
+  if (fd < 0) {
+    std::cerr << "Failed to create shared segment: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  is_owner = is_linked = true;
+  if (!reserve(std::max<size_t>(_size, ARBFN_SHARED_REQUEST_OFFSET))) {
+    close();
+    return false;
+  }
+
+  // Tokens stay below 2^53, so that JSON parsers read them exactly
+  token = (((uint64_t) random() << 32) ^ (uint64_t) random() ^ (uint64_t) getpid()) &
+          ((1ULL << 53) - 1);
+  std::memcpy(base, &token, sizeof(token));
+  return true;
+}
+
+/**
+ * @brief Opens a worker's segment, checking its token
+ * @return True on success, false on failure
+ */
+bool SharedSegment::open(const std::string &_name, const uint64_t &_token)
+{
+  uint64_t found;
+
+  close();
+
+  // Segments live in a flat namespace, and belong to this node
+  if (_name.size() < 2 || _name[0] != '/' || _name.find('/', 1) != std::string::npos) {
+    return false;
+  }
+  fd = shm_open(_name.c_str(), O_RDWR, 0600);
+  if (fd < 0) { return false; }
+
+  name = _name;
+  is_owner = is_linked = false;
+  if (!reserve(ARBFN_SHARED_REQUEST_OFFSET)) {
+    close();
+    return false;
+  }
+
+  std::memcpy(&found, base, sizeof(found));
+  if (found != _token) {
+    close();
+    return false;
+  }
+  token = _token;
+  return true;
+}
+
+/**
+ * @brief Maps at least the given number of bytes, growing the
+ * segment if it is ours
+ * @return True on success, false on failure
+ */
+bool SharedSegment::reserve(const size_t &_size)
+{
+  struct stat info;
+  size_t new_size;
+
+  if (_size <= size) { return true; }
+
+  if (is_owner) {
+    // Grow geometrically, so that growing atom counts rarely remap
+    new_size = std::max(_size, 2 * size);
+    if (ftruncate(fd, new_size) != 0) {
+      std::cerr << "Failed to grow shared segment: " << std::strerror(errno) << "\n";
+      return false;
+    }
+  } else {
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < _size) {
+      std::cerr << "Shared segment is smaller than its packets\n";
+      return false;
+    }
+    new_size = info.st_size;
+  }
+
+  if (base != nullptr) { munmap(base, size); }
+  void *const mapped = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "Failed to map shared segment: " << std::strerror(errno) << "\n";
+    base = nullptr;
+    size = 0;
+    return false;
+  }
+  base = static_cast<char *>(mapped);
+  size = new_size;
+  return true;
+}
+
+/**
+ * @brief Removes the segment's name, leaving it mapped
+ */
+void SharedSegment::unlink()
+{
+  if (is_linked) { shm_unlink(name.c_str()); }
+  is_linked = false;
+}
+
+/**
+ * @brief Unmaps and closes the segment, if any. A worker's segment
+ * is unlinked as well.
+ */
+void SharedSegment::close()
+{
+  unlink();
+  if (base != nullptr) { munmap(base, size); }
+  if (fd >= 0) { ::close(fd); }
+  fd = -1;
+  base = nullptr;
+  size = 0;
+}
+
+/**
+ * @brief Await an MPI packet from any source, failing if the waiter times out. The waiter must
+ * have been started.
+ * @param _waiter The waiter pacing the wait
+ * @param _into Where to save the raw bytes of the packet
+ * @param _received_from Where to save the MPI source of the sender
+ * @param _tag Where to save the MPI tag of the packet
+ * @param _comm The MPI communicator to use
+ * @return True on success, false on failure
+ */
+bool await_raw_packet(Waiter &_waiter, std::vector<char> &_into, uint &_received_from, int &_tag,
+                      MPI_Comm &_comm)
+{
+  MPI_Status status;
+  int flag, count;
+
+  while (true) {
+    // Check for message recv resolution
+    if (_waiter.strategy == ARBFN_WAIT_BLOCK) {
+      MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, _comm, &status);
+      flag = 1;
+    } else {
+      MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, _comm, &flag, &status);
+    }
+
+    if (flag) {
+      const MPI_Datatype type = (status.MPI_TAG == ARBFN_MPI_TAG_BINARY ? MPI_BYTE : MPI_CHAR);
+      MPI_Get_count(&status, type, &count);
+      _into.resize(count);
+      MPI_Recv(_into.data(), count, type, status.MPI_SOURCE, status.MPI_TAG, _comm, &status);
+      _waiter.progress();
+
+      // Empty packets carry no information
+      if (count > 0) {
+        _received_from = status.MPI_SOURCE;
+        _tag = status.MPI_TAG;
+        return true;
+      }
+      continue;
+    }
+
+    if (!_waiter.idle()) { return false; }
+  }
+}
+
+/**
+ * @brief Await a JSON MPI packet from any source, failing if the waiter times out. The waiter
+ * must have been started.
+ * @param _waiter The waiter pacing the wait
+ * @param _into The `boost::json` to save the packet into
+ * @param _received_from Where to save the MPI source of the sender
+ * @param _comm The MPI communicator to use
+ * @return True on success, false on failure
+ */
+bool await_packet(Waiter &_waiter, boost::json::object &_into, uint &_received_from,
+                  MPI_Comm &_comm)
+{
+  std::vector<char> response;
+  int tag;
+
+  do {
+    if (!await_raw_packet(_waiter, response, _received_from, tag, _comm)) { return false; }
+  } while (tag != ARBFN_MPI_TAG_JSON);
+
+  // Unwrap packet
+  _into =
+      boost::json::parse(boost::json::string_view(response.data(), response.size())).as_object();
+  return true;
+}
+
+/**
+ * @brief Checks a binary response packet which was received into
+ * the given buffer.
+ * @param _n The number of atoms expected
+ * @param _into The buffer holding the raw packet
+ * @return True on success, false if the packet was malformed
+ */
+bool from_binary(const size_t &_n, FixBuffer &_into)
+{
+  const bool is_reduced = (_into.precision != ARBFN_PRECISION_DOUBLE);
+  const std::vector<char> &received = (is_reduced ? _into.packed : _into.packet);
+  BinaryHeader header;
+
+  std::memcpy(&header, received.data(), sizeof(BinaryHeader));
+  if (header.n != _n) {
+    std::cerr << "Received malformed fix data from controller: Expected " << _n
+              << " atoms, but got " << header.n << "\n";
+    return false;
+  }
+
+  _into.n = _n;
+  if (received.size() != (is_reduced ? packed_size(_into)
+                                     : sizeof(BinaryHeader) + _into.width * _n * sizeof(double))) {
+    std::cerr << "Received truncated binary response from controller\n";
+    return false;
+  }
+
+  // Reduced fixes are widened back into columns
+  if (is_reduced) {
+    _into.resize(_n);
+    unpack(received.data(), _into);
+  }
+  return true;
+}
+
+/**
+ * @brief Posts the receive for a binary response (or waiting
+ * packet) directly into the fix buffer.
+ * @param _into The buffer to receive fix data into
+ * @param _pending The interchange to post the receive for
+ */
+void post_binary_recv(FixBuffer &_into, PendingInterchange &_pending)
+{
+  const bool is_reduced = (_into.precision != ARBFN_PRECISION_DOUBLE);
+  std::vector<char> &into = (is_reduced ? _into.packed : _into.packet);
+  _into.resize(_pending.n);
+  if (is_reduced) { into.resize(packed_size(_into)); }
+  MPI_Irecv(into.data(), into.size(), MPI_BYTE, _pending.controller_rank, ARBFN_MPI_TAG_BINARY,
+            _pending.comm, &_pending.recv_request);
+}
+
+/**
+ * @brief Makes an MPI datatype spanning pieces of memory which lie
+ * apart, in order
+ * @return The datatype, committed
+ */
+MPI_Datatype scattered_type(const std::vector<std::pair<const void *, size_t>> &_pieces)
+{
+  std::vector<int> lengths(_pieces.size());
+  std::vector<MPI_Aint> displacements(_pieces.size());
+  MPI_Datatype type;
+
+  for (size_t i = 0; i < _pieces.size(); ++i) {
+    lengths[i] = (int) _pieces[i].second;
+    MPI_Get_address(_pieces[i].first, &displacements[i]);
+  }
+  MPI_Type_create_hindexed(_pieces.size(), lengths.data(), displacements.data(), MPI_BYTE,
+                           &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+/**
+ * @brief Receives a JSON packet from the controller during a binary
+ * interchange, if one has arrived. Controllers may always fall back
+ * on a JSON "waiting" packet, but send nothing else.
+ * @param _controller_rank The rank of the controller
+ * @param _comm The MPI communicator in use
+ * @param _stats Where to count the packet
+ * @param _received Where to save whether a packet was received
+ * @return True on success, false if a packet other than "waiting"
+ * was received
+ */
+static bool receive_json_waiting(const uint &_controller_rank, MPI_Comm &_comm,
+                                 InterchangeStats &_stats, bool &_received)
+{
+  std::vector<char> packet;
+  MPI_Status status;
+  int flag, count;
+
+  MPI_Iprobe(_controller_rank, ARBFN_MPI_TAG_JSON, _comm, &flag, &status);
+  _received = flag;
+  if (!flag) { return true; }
+
+  MPI_Get_count(&status, MPI_CHAR, &count);
+  packet.resize(count);
+  MPI_Recv(packet.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, _comm, &status);
+  _stats.bytes_received += count;
+
+  const double start = MPI_Wtime();
+  const boost::json::value json =
+      boost::json::parse(boost::json::string_view(packet.data(), packet.size()));
+  _stats.parse_s += MPI_Wtime() - start;
+  if (json.at("type") != "waiting") {
+    std::cerr << "Controller sent JSON packet during binary interchange\n";
+    return false;
+  }
+  ++_stats.waiting_packets;
+  return true;
+}
+
+/**
+ * @brief Sends a request or delta without blocking, for either kind
+ * of `begin_interchange`
+ * @param _from The staged atoms to send
+ * @param _left For a delta, the tags of the atoms which have gone.
+ * Null for a full request.
+ * @param _num_fixes The number of fixes the response will hold
+ * @param _into The buffer to receive fix data into
+ * @param _max_ms The max number of milliseconds to await the response
+ * @param _format The wire format negotiated at registration
+ * @param _pending Where to save the state of the interchange
+ * @param _waiter How `finish_interchange` should wait for the response
+ * @param _segment The segment shared with the controller, if any
+ * @returns true on success, false on failure
+ */
+static bool begin_request(AtomBuffer &_from, const std::vector<double> *_left,
+                          const size_t &_num_fixes, FixBuffer &_into, const double &_max_ms,
+                          const uint &_controller_rank, MPI_Comm &_comm,
+                          const ARBFNFormat &_format, PendingInterchange &_pending,
+                          Waiter &_waiter, SharedSegment *_segment)
+{
+  // Atoms at reduced precision travel as a packed copy
+  const bool is_reduced = (_from.precision != ARBFN_PRECISION_DOUBLE);
+  std::vector<char> &request = (is_reduced ? _from.packed : _from.packet);
+  const size_t request_bytes = (is_reduced ? packed_size(_from) : _from.packet.size());
+  const size_t num_left = (_left != nullptr ? _left->size() : 0);
+  const size_t shared_bytes = request_bytes + num_left * sizeof(double);
+
+  if (_pending.active) {
+    std::cerr << "Cannot begin an interchange while another is pending\n";
+    return false;
+  }
+
+  // The segment must have room for both the request and its response
+  if (_format == ARBFN_FORMAT_SHARED) {
+    if (_segment == nullptr || !_segment->is_open()) {
+      std::cerr << "Cannot use the shared format without a shared segment\n";
+      return false;
+    } else if (!_segment->reserve(shared_response_offset(shared_bytes) + sizeof(BinaryHeader) +
+                                  _into.width * _num_fixes * sizeof(double))) {
+      return false;
+    }
+  } else if (_format == ARBFN_FORMAT_COLLECTIVE && _left != nullptr) {
+    std::cerr << "Cannot send a delta in the collective format\n";
+    return false;
+  }
+
+  _pending.active = true;
+  _pending.format = _format;
+  _pending.n = _num_fixes;
+  _pending.max_ms = _max_ms;
+  _pending.controller_rank = _controller_rank;
+  _pending.comm = _comm;
+  _pending.waiter = &_waiter;
+  _pending.stats.clear();
+  _pending.segment = _segment;
+
+  double start = MPI_Wtime();
+  if (_format == ARBFN_FORMAT_SHARED) {
+    BinaryHeader header;
+
+    // Only the header travels over MPI, and lands in place
+    post_binary_recv(_into, _pending);
+
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = (_left != nullptr ? ARBFN_PACKET_DELTA : ARBFN_PACKET_REQUEST);
+    header.n = _from.n;
+    header.fields = _from.fields;
+    header.expect_response = _max_ms;
+    std::memcpy(_from.packet.data(), &header, sizeof(BinaryHeader));
+
+    // Lay the packet out in the segment, as it would be sent
+    char *const in_segment = _segment->data() + ARBFN_SHARED_REQUEST_OFFSET;
+    if (is_reduced) {
+      pack(_from, in_segment);
+    } else {
+      std::memcpy(in_segment, _from.packet.data(), _from.packet.size());
+    }
+    if (num_left > 0) {
+      std::memcpy(in_segment + request_bytes, _left->data(), num_left * sizeof(double));
+    }
+    _pending.doorbell.header = header;
+    _pending.doorbell.bytes = shared_bytes;
+    _pending.stats.serialize_s += MPI_Wtime() - start;
+
+    // Ring the doorbell once the packet is visible to the controller
+    start = MPI_Wtime();
+    std::atomic_thread_fence(std::memory_order_release);
+    MPI_Isend(&_pending.doorbell, sizeof(SharedDoorbell), MPI_BYTE, _controller_rank,
+              ARBFN_MPI_TAG_BINARY, _comm, &_pending.send_request);
+    _pending.stats.send_s += MPI_Wtime() - start;
+    _pending.stats.bytes_sent += shared_bytes;
+  } else if (_format == ARBFN_FORMAT_COLLECTIVE) {
+    BinaryHeader header;
+
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_REQUEST;
+    header.n = _from.n;
+    header.fields = _from.fields;
+    header.expect_response = _max_ms;
+    std::memcpy(_from.packet.data(), &header, sizeof(BinaryHeader));
+    if (is_reduced) {
+      request.resize(request_bytes);
+      pack(_from, request.data());
+    }
+    _pending.bytes = request_bytes;
+    std::vector<char> &response =
+        (_into.precision != ARBFN_PRECISION_DOUBLE ? _into.packed : _into.packet);
+    _into.resize(_num_fixes);
+    response.resize(packed_size(_into));
+    _pending.stats.serialize_s += MPI_Wtime() - start;
+
+    // Every member posts the same collectives in the same order: The
+    // size of its request, the request, then the scatter of its fixes
+    start = MPI_Wtime();
+    MPI_Igather(&_pending.bytes, 1, MPI_UINT64_T, nullptr, 1, MPI_UINT64_T, _controller_rank,
+                _comm, &_pending.size_request);
+    MPI_Igatherv(request.data(), request_bytes, MPI_BYTE, nullptr, nullptr, nullptr, MPI_BYTE,
+                 _controller_rank, _comm, &_pending.send_request);
+    MPI_Iscatterv(nullptr, nullptr, nullptr, MPI_BYTE, response.data(), response.size(),
+                  MPI_BYTE, _controller_rank, _comm, &_pending.recv_request);
+    _pending.stats.send_s += MPI_Wtime() - start;
+    _pending.stats.bytes_sent += request_bytes;
+  } else if (_format == ARBFN_FORMAT_BINARY) {
+    BinaryHeader header;
+
+    // Binary responses have a known size, so land them in place
+    post_binary_recv(_into, _pending);
+
+    // The staging buffer is already a packet: Just fill in the header
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = (_left != nullptr ? ARBFN_PACKET_DELTA : ARBFN_PACKET_REQUEST);
+    header.n = _from.n;
+    header.fields = _from.fields;
+    header.expect_response = _max_ms;
+    std::memcpy(_from.packet.data(), &header, sizeof(BinaryHeader));
+    if (is_reduced) {
+      request.resize(request_bytes);
+      pack(_from, request.data());
+    }
+
+    // A delta ends with the tags of the atoms which have gone
+    if (num_left > 0) {
+      request.resize(request_bytes + num_left * sizeof(double));
+      std::memcpy(request.data() + request_bytes, _left->data(), num_left * sizeof(double));
+    }
+    _pending.stats.serialize_s += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    MPI_Isend(request.data(), request.size(), MPI_BYTE, _controller_rank, ARBFN_MPI_TAG_BINARY,
+              _comm, &_pending.send_request);
+    _pending.stats.send_s += MPI_Wtime() - start;
+    _pending.stats.bytes_sent += request.size();
+  } else {
+    // Write the text straight from the columns, reusing the buffer
+    if (!write_json_request(_from, _left, _max_ms, _from.packed)) {
+      std::cerr << non_finite_message;
+      return false;
+    }
+    _pending.stats.serialize_s += MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    MPI_Isend(_from.packed.data(), _from.packed.size(), MPI_CHAR, _controller_rank,
+              ARBFN_MPI_TAG_JSON, _comm, &_pending.send_request);
+    _pending.stats.send_s += MPI_Wtime() - start;
+    _pending.stats.bytes_sent += _from.packed.size();
+  }
+
+  return true;
+}
+
+/**
+ * @brief Begins an interchange: Sends the staged atom data without
+ * blocking.
+ * @returns true on success, false on failure
+ */
+bool begin_interchange(AtomBuffer &_from, FixBuffer &_into, const double &_max_ms,
+                       const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                       PendingInterchange &_pending, Waiter &_waiter, SharedSegment *_segment)
+{
+  return begin_request(_from, nullptr, _from.n, _into, _max_ms, _controller_rank, _comm, _format,
+                       _pending, _waiter, _segment);
+}
+
+/**
+ * @brief Begins an incremental interchange: Sends the staged
+ * changes without blocking.
+ * @returns true on success, false on failure
+ */
+bool begin_interchange(AtomDelta &_from, FixBuffer &_into, const double &_max_ms,
+                       const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                       PendingInterchange &_pending, Waiter &_waiter, SharedSegment *_segment)
+{
+  return begin_request(_from.changed, &_from.left, _from.snapshot.n, _into, _max_ms,
+                       _controller_rank, _comm, _format, _pending, _waiter, _segment);
+}
+
+/**
+ * @brief Finishes a binary interchange.
+ * @param _into The buffer the response is being received into
+ * @param _pending The pending interchange
+ * @returns true on success, false on failure
+ */
+bool finish_binary_interchange(FixBuffer &_into, PendingInterchange &_pending)
+{
+  Waiter &waiter = *_pending.waiter;
+  InterchangeStats &stats = _pending.stats;
+  std::vector<char> &received =
+      (_into.precision != ARBFN_PRECISION_DOUBLE ? _into.packed : _into.packet);
+  BinaryHeader header;
+  MPI_Status status;
+  int done, count;
+  bool waiting;
+
+  while (true) {
+    // Check whether the posted receive has landed
+    if (waiter.strategy == ARBFN_WAIT_BLOCK) {
+      MPI_Wait(&_pending.recv_request, &status);
+      done = 1;
+    } else {
+      MPI_Test(&_pending.recv_request, &done, &status);
+    }
+
+    if (done) {
+      waiter.progress();
+      MPI_Get_count(&status, MPI_BYTE, &count);
+      stats.bytes_received += count;
+      if ((size_t) count < sizeof(BinaryHeader)) {
+        std::cerr << "Controller sent truncated binary packet\n";
+        return false;
+      }
+      std::memcpy(&header, received.data(), sizeof(BinaryHeader));
+      if (header.magic != ARBFN_BINARY_MAGIC) {
+        std::cerr << "Controller sent binary packet w/ bad magic number\n";
+        return false;
+      } else if (header.type == ARBFN_PACKET_WAITING) {
+        ++stats.waiting_packets;
+        post_binary_recv(_into, _pending);
+        continue;
+      } else if (header.type != ARBFN_PACKET_RESPONSE) {
+        std::cerr << "Controller sent bad packet w/ type '" << header.type << "'\n";
+        return false;
+      }
+
+      // In the shared format, the fixes follow in the segment
+      if (_pending.format == ARBFN_FORMAT_SHARED) {
+        if ((size_t) count != sizeof(BinaryHeader)) {
+          std::cerr << "Controller sent binary packet in shared format\n";
+          return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const char *const response =
+            _pending.segment->data() + shared_response_offset(_pending.doorbell.bytes);
+        const size_t size = packed_size(_into);
+        std::memcpy(received.data() + sizeof(BinaryHeader), response + sizeof(BinaryHeader),
+                    size - sizeof(BinaryHeader));
+        stats.bytes_received += size - count;
+        break;
+      }
+      received.resize(count);
+      break;
+    }
+
+    if (!receive_json_waiting(_pending.controller_rank, _pending.comm, stats, waiting)) {
+      return false;
+    } else if (waiting) {
+      waiter.progress();
+      continue;
+    }
+
+    if (!waiter.idle()) { return false; }
+  }
+
+  // A blocking wait cannot notice JSON "waiting" packets as they
+  // arrive, so drain any which were sent before the response
+  if (waiter.strategy == ARBFN_WAIT_BLOCK) {
+    do {
+      if (!receive_json_waiting(_pending.controller_rank, _pending.comm, stats, waiting)) {
+        return false;
+      }
+    } while (waiting);
+  }
+
+  const double start = MPI_Wtime();
+  const bool result = from_binary(_pending.n, _into);
+  stats.parse_s += MPI_Wtime() - start;
+  return result;
+}
+
+/**
+ * @brief Finishes a collective interchange.
+ * @param _into The buffer the fixes are being scattered into
+ * @param _pending The pending interchange
+ * @returns true on success, false on failure
+ */
+bool finish_collective_interchange(FixBuffer &_into, PendingInterchange &_pending)
+{
+  Waiter &waiter = *_pending.waiter;
+  InterchangeStats &stats = _pending.stats;
+  BinaryHeader header;
+  int done;
+
+  // Nothing else travels within the group, so there are no "waiting"
+  // packets: The scatter lands once every member has been answered
+  while (true) {
+    if (waiter.strategy == ARBFN_WAIT_BLOCK) {
+      MPI_Wait(&_pending.recv_request, MPI_STATUS_IGNORE);
+      done = 1;
+    } else {
+      MPI_Test(&_pending.recv_request, &done, MPI_STATUS_IGNORE);
+    }
+    if (done) { break; }
+    if (!waiter.idle()) { return false; }
+  }
+  waiter.progress();
+  const std::vector<char> &received =
+      (_into.precision != ARBFN_PRECISION_DOUBLE ? _into.packed : _into.packet);
+  stats.bytes_received += received.size();
+
+  std::memcpy(&header, received.data(), sizeof(BinaryHeader));
+  if (header.magic != ARBFN_BINARY_MAGIC || header.type != ARBFN_PACKET_RESPONSE) {
+    std::cerr << "Controller scattered bad binary packet\n";
+    return false;
+  }
+
+  const double start = MPI_Wtime();
+  const bool result = from_binary(_pending.n, _into);
+  stats.parse_s += MPI_Wtime() - start;
+  return result;
+}
+
+/**
+ * @brief Finishes a JSON interchange.
+ * @param _into The buffer to receive fix data into
+ * @param _pending The pending interchange
+ * @returns true on success, false on failure
+ */
+bool finish_json_interchange(FixBuffer &_into, PendingInterchange &_pending)
+{
+  InterchangeStats &stats = _pending.stats;
+  std::string type;
+  uint received_from;
+  size_t count = 0;
+  int tag;
+
+  // Fixes are parsed straight into place as they are read
+  _into.resize(_pending.n);
+
+  // Await response
+  while (true) {
+    // Await any sort of packet
+    if (!await_raw_packet(*_pending.waiter, _into.packed, received_from, tag, _pending.comm)) {
+      std::cerr << "await_raw_packet failed\n";
+      return false;
+    } else if (received_from != _pending.controller_rank || tag != ARBFN_MPI_TAG_JSON) {
+      continue;
+    }
+    stats.bytes_received += _into.packed.size();
+
+    const double start = MPI_Wtime();
+    const bool parsed = parse_json_fixes(_into.packed, _into, type, count);
+    stats.parse_s += MPI_Wtime() - start;
+    if (!parsed) { return false; }
+
+    // If "waiting" packet, continue. Else, break.
+    if (type == "waiting") {
+      ++stats.waiting_packets;
+      continue;
+    } else if (type != "response") {
+      std::cerr << "Controller sent bad packet w/ type '" << type << "'\n";
+      return false;
+    }
+    break;
+  }
+
+  if (count != _pending.n) {
+    std::cerr << "Received malformed fix data from controller: Expected " << _pending.n
+              << " atoms, but got " << count << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Finishes an interchange begun by `begin_interchange`,
+ * blocking until the fix data has been received.
+ * @param _into The buffer passed to `begin_interchange`
+ * @param _pending The pending interchange
+ * @returns true on success, false on failure
+ */
+bool finish_interchange(FixBuffer &_into, PendingInterchange &_pending)
+{
+  bool result;
+
+  if (!_pending.active) {
+    std::cerr << "No interchange is pending\n";
+    return false;
+  }
+
+  // Parsing happens while the waiter runs, so is taken back out
+  const double waited_us = _pending.waiter->stats.total_us;
+  _pending.waiter->start(_pending.max_ms);
+  if (_pending.format == ARBFN_FORMAT_COLLECTIVE) {
+    result = finish_collective_interchange(_into, _pending);
+  } else if (_pending.format != ARBFN_FORMAT_JSON) {
+    result = finish_binary_interchange(_into, _pending);
+  } else {
+    result = finish_json_interchange(_into, _pending);
+  }
+  _pending.waiter->stop();
+  _pending.stats.wait_s +=
+      1e-6 * (_pending.waiter->stats.total_us - waited_us) - _pending.stats.parse_s;
+
+  if (result) {
+    // The request must have been delivered if it was answered
+    const double start = MPI_Wtime();
+    MPI_Wait(&_pending.size_request, MPI_STATUS_IGNORE);
+    MPI_Wait(&_pending.send_request, MPI_STATUS_IGNORE);
+    _pending.stats.send_s += MPI_Wtime() - start;
+    ++_pending.stats.interchanges;
+  } else if (_pending.format == ARBFN_FORMAT_COLLECTIVE) {
+    // Collectives can be neither cancelled nor freed, so are left to
+    // the group, which is of no more use
+  } else {
+    // Abandon whatever is still in flight
+    if (_pending.recv_request != MPI_REQUEST_NULL) {
+      MPI_Cancel(&_pending.recv_request);
+      MPI_Request_free(&_pending.recv_request);
+    }
+    MPI_Request_free(&_pending.send_request);
+  }
+  _pending.active = false;
+
+  return result;
+}
+
+/**
+ * @brief Send the staged atom data, then receive the fix data in
+ * place. This is blocking, but does not allow worker-side gridlocks.
+ * @param _from The staged atoms to send
+ * @param _into The buffer to receive fix data into
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _format The wire format negotiated at registration
+ * @param _waiter How to wait for the response
+ * @param _stats If not null, where to add the time and traffic
+ * @param _segment The segment shared with the controller, if any
+ * @returns true on success, false on failure
+ */
+bool interchange(AtomBuffer &_from, FixBuffer &_into, const double &_max_ms,
+                 const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                 Waiter &_waiter, InterchangeStats *_stats, SharedSegment *_segment)
+{
+  PendingInterchange pending;
+
+  if (!begin_interchange(_from, _into, _max_ms, _controller_rank, _comm, _format, pending,
+                         _waiter, _segment)) {
+    return false;
+  }
+  const bool result = finish_interchange(_into, pending);
+  if (_stats != nullptr) { _stats->add(pending.stats); }
+  return result;
+}
+
+/**
+ * @brief Send the staged changes, then receive the fix data for
+ * every atom of the snapshot in place.
+ * @returns true on success, false on failure
+ */
+bool interchange(AtomDelta &_from, FixBuffer &_into, const double &_max_ms,
+                 const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                 Waiter &_waiter, InterchangeStats *_stats, SharedSegment *_segment)
+{
+  PendingInterchange pending;
+
+  if (!begin_interchange(_from, _into, _max_ms, _controller_rank, _comm, _format, pending,
+                         _waiter, _segment)) {
+    return false;
+  }
+  const bool result = finish_interchange(_into, pending);
+  if (_stats != nullptr) { _stats->add(pending.stats); }
+  return result;
+}
+
+/**
+ * @brief Sends a multiplexed binary request straight from the
+ * staging buffers of the fixes due, then receives each part of the
+ * response straight into their fix buffers
+ * @returns true on success, false on failure
+ */
+static bool interchange_binary_parts(std::vector<MultiplexedFix> &_fixes,
+                                     const std::vector<size_t> &_parts, const double &_max_ms,
+                                     const uint &_controller_rank, MPI_Comm &_comm,
+                                     Waiter &_waiter, InterchangeStats &_stats)
+{
+  std::vector<std::pair<const void *, size_t>> pieces;
+  BinaryHeader header, received;
+  MPI_Request send_request, recv_request;
+  MPI_Status status;
+  int done, count;
+  bool waiting, result = false;
+
+  // Each part goes out as it lies in the fix's staging buffer
+  double start = MPI_Wtime();
+  header.magic = ARBFN_BINARY_MAGIC;
+  header.type = ARBFN_PACKET_MULTIPLEX;
+  header.n = _parts.size();
+  header.fields = 0;
+  header.expect_response = _max_ms;
+  pieces.emplace_back(&header, sizeof(BinaryHeader));
+  size_t request_bytes = sizeof(BinaryHeader);
+  for (const size_t &k : _parts) {
+    MultiplexedFix &fix = _fixes[k];
+    AtomBuffer &atoms = *fix.atoms;
+    BinaryHeader part;
+    part.magic = ARBFN_BINARY_MAGIC;
+    part.type = ARBFN_PACKET_REQUEST;
+    part.n = atoms.n;
+    part.fields = atoms.fields;
+    part.expect_response = _max_ms;
+    std::memcpy(atoms.packet.data(), &part, sizeof(BinaryHeader));
+    fix.sent.fix = k;
+    fix.sent.bytes = atoms.packet.size();
+    pieces.emplace_back(&fix.sent, sizeof(MultiplexPart));
+    pieces.emplace_back(atoms.packet.data(), atoms.packet.size());
+    request_bytes += sizeof(MultiplexPart) + atoms.packet.size();
+  }
+  MPI_Datatype request_type = scattered_type(pieces);
+
+  // The response holds the same parts in the same order, so each
+  // lands in place (as does any "waiting" packet, in the header)
+  pieces.clear();
+  pieces.emplace_back(&received, sizeof(BinaryHeader));
+  size_t response_bytes = sizeof(BinaryHeader);
+  for (const size_t &k : _parts) {
+    MultiplexedFix &fix = _fixes[k];
+    fix.fixes->resize(fix.atoms->n);
+    pieces.emplace_back(&fix.received, sizeof(MultiplexPart));
+    pieces.emplace_back(fix.fixes->packet.data(), fix.fixes->packet.size());
+    response_bytes += sizeof(MultiplexPart) + fix.fixes->packet.size();
+  }
+  MPI_Datatype response_type = scattered_type(pieces);
+  _stats.serialize_s += MPI_Wtime() - start;
+
+  start = MPI_Wtime();
+  MPI_Irecv(MPI_BOTTOM, 1, response_type, _controller_rank, ARBFN_MPI_TAG_BINARY, _comm,
+            &recv_request);
+  MPI_Isend(MPI_BOTTOM, 1, request_type, _controller_rank, ARBFN_MPI_TAG_BINARY, _comm,
+            &send_request);
+  _stats.send_s += MPI_Wtime() - start;
+  _stats.bytes_sent += request_bytes;
+
+  while (true) {
+    if (_waiter.strategy == ARBFN_WAIT_BLOCK) {
+      MPI_Wait(&recv_request, &status);
+      done = 1;
+    } else {
+      MPI_Test(&recv_request, &done, &status);
+    }
+
+    if (done) {
+      _waiter.progress();
+      MPI_Get_elements(&status, response_type, &count);
+      _stats.bytes_received += count;
+      if ((size_t) count < sizeof(BinaryHeader) || received.magic != ARBFN_BINARY_MAGIC) {
+        std::cerr << "Controller sent bad binary packet\n";
+        break;
+      } else if (received.type == ARBFN_PACKET_WAITING) {
+        ++_stats.waiting_packets;
+        MPI_Irecv(MPI_BOTTOM, 1, response_type, _controller_rank, ARBFN_MPI_TAG_BINARY, _comm,
+                  &recv_request);
+        continue;
+      } else if (received.type != ARBFN_PACKET_MULTIPLEX || received.n != _parts.size() ||
+                 (size_t) count != response_bytes) {
+        std::cerr << "Controller sent bad multiplexed packet\n";
+        break;
+      }
+      result = true;
+      break;
+    }
+
+    if (!receive_json_waiting(_controller_rank, _comm, _stats, waiting)) {
+      break;
+    } else if (waiting) {
+      _waiter.progress();
+      continue;
+    }
+
+    if (!_waiter.idle()) { break; }
+  }
+
+  // A blocking wait cannot notice JSON "waiting" packets as they
+  // arrive, so drain any which were sent before the response
+  while (result && _waiter.strategy == ARBFN_WAIT_BLOCK) {
+    result = receive_json_waiting(_controller_rank, _comm, _stats, waiting);
+    if (!waiting) { break; }
+  }
+
+  // Each part must answer the fix it was sent by
+  start = MPI_Wtime();
+  for (size_t k = 0; k < _parts.size() && result; ++k) {
+    const MultiplexedFix &fix = _fixes[_parts[k]];
+    BinaryHeader part;
+    std::memcpy(&part, fix.fixes->packet.data(), sizeof(BinaryHeader));
+    if (fix.received.fix != _parts[k] || fix.received.bytes != fix.fixes->packet.size() ||
+        part.magic != ARBFN_BINARY_MAGIC ||
+        part.type != ARBFN_PACKET_RESPONSE || part.n != fix.fixes->n) {
+      std::cerr << "Controller sent bad part for fix '" << fix.id << "'\n";
+      result = false;
+    }
+  }
+  _stats.parse_s += MPI_Wtime() - start;
+
+  if (result) {
+    start = MPI_Wtime();
+    MPI_Wait(&send_request, MPI_STATUS_IGNORE);
+    _stats.send_s += MPI_Wtime() - start;
+  } else {
+    // Abandon whatever is still in flight
+    if (recv_request != MPI_REQUEST_NULL) {
+      MPI_Cancel(&recv_request);
+      MPI_Request_free(&recv_request);
+    }
+    MPI_Request_free(&send_request);
+  }
+  MPI_Type_free(&request_type);
+  MPI_Type_free(&response_type);
+  return result;
+}
+
+/**
+ * @brief Sends a multiplexed JSON request, then parses the response
+ * straight into the fix buffers of the fixes due
+ * @returns true on success, false on failure
+ */
+static bool interchange_json_parts(std::vector<MultiplexedFix> &_fixes,
+                                   const std::vector<size_t> &_parts, const double &_max_ms,
+                                   const uint &_controller_rank, MPI_Comm &_comm,
+                                   Waiter &_waiter, InterchangeStats &_stats)
+{
+  std::vector<char> &request = _fixes[_parts[0]].atoms->packed;
+  std::vector<char> &response = _fixes[_parts[0]].fixes->packed;
+  MPI_Request send_request;
+  std::string type;
+  uint received_from;
+  int tag;
+
+  double start = MPI_Wtime();
+  if (!write_json_parts(_fixes, _parts, _max_ms, request)) {
+    std::cerr << non_finite_message;
+    return false;
+  }
+  for (const size_t &k : _parts) { _fixes[k].fixes->resize(_fixes[k].atoms->n); }
+  _stats.serialize_s += MPI_Wtime() - start;
+
+  start = MPI_Wtime();
+  MPI_Isend(request.data(), request.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON,
+            _comm, &send_request);
+  _stats.send_s += MPI_Wtime() - start;
+  _stats.bytes_sent += request.size();
+
+  while (true) {
+    if (!await_raw_packet(_waiter, response, received_from, tag, _comm)) {
+      std::cerr << "await_raw_packet failed\n";
+      MPI_Request_free(&send_request);
+      return false;
+    } else if (received_from != _controller_rank || tag != ARBFN_MPI_TAG_JSON) {
+      continue;
+    }
+    _stats.bytes_received += response.size();
+
+    start = MPI_Wtime();
+    const bool parsed = parse_json_parts(response, _fixes, _parts, type);
+    _stats.parse_s += MPI_Wtime() - start;
+    if (!parsed) {
+      MPI_Request_free(&send_request);
+      return false;
+    } else if (type == "waiting") {
+      ++_stats.waiting_packets;
+      continue;
+    } else if (type != "response") {
+      std::cerr << "Controller sent bad packet w/ type '" << type << "'\n";
+      MPI_Request_free(&send_request);
+      return false;
+    }
+    break;
+  }
+
+  start = MPI_Wtime();
+  MPI_Wait(&send_request, MPI_STATUS_IGNORE);
+  _stats.send_s += MPI_Wtime() - start;
+  return true;
+}
+
+/**
+ * @brief Sends the staged atoms of some of several fixes registered
+ * together as a single request, then receives each of their fixes
+ * in place from a single response
+ * @returns true on success, false on failure
+ */
+bool interchange(std::vector<MultiplexedFix> &_fixes, const std::vector<size_t> &_parts,
+                 const double &_max_ms, const uint &_controller_rank, MPI_Comm &_comm,
+                 const ARBFNFormat &_format, Waiter &_waiter, InterchangeStats *_stats)
+{
+  InterchangeStats stats;
+  bool result;
+
+  if (_parts.empty()) { return true; }
+  if (_format != ARBFN_FORMAT_JSON && _format != ARBFN_FORMAT_BINARY) {
+    std::cerr << "Several fixes may only interchange in the JSON or binary format\n";
+    return false;
+  }
+
+  // Parsing happens while the waiter runs, so is taken back out
+  const double waited_us = _waiter.stats.total_us;
+  _waiter.start(_max_ms);
+  if (_format == ARBFN_FORMAT_BINARY) {
+    result =
+        interchange_binary_parts(_fixes, _parts, _max_ms, _controller_rank, _comm, _waiter, stats);
+  } else {
+    result =
+        interchange_json_parts(_fixes, _parts, _max_ms, _controller_rank, _comm, _waiter, stats);
+  }
+  _waiter.stop();
+  stats.wait_s += 1e-6 * (_waiter.stats.total_us - waited_us) - stats.serialize_s -
+                  stats.send_s - stats.parse_s;
+
+  if (result) { ++stats.interchanges; }
+  if (_stats != nullptr) { _stats->add(stats); }
+  return result;
+}
+
+/**
+ * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
+ * @param _n The number of atoms/fixes in the arrays.
+ * @param _from An array of atom data to send
+ * @param _into An array of fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _format The wire format negotiated at registration
+ * @returns true on success, false on failure
+ */
+bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
+                 const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format)
+{
+  AtomBuffer atoms;
+  FixBuffer fixes;
+  uint64_t fields;
+
+  // Transpose into a staging buffer
+  fields = ARBFN_FIELD_X | ARBFN_FIELD_V | ARBFN_FIELD_F;
+  if (_n > 0 && _from[0].is_dipole) { fields |= ARBFN_FIELD_MU; }
+  atoms.resize(_n, fields);
+
+  double *const x[3] = {atoms.column(ARBFN_FIELD_X, 0), atoms.column(ARBFN_FIELD_X, 1),
+                        atoms.column(ARBFN_FIELD_X, 2)};
+  double *const v[3] = {atoms.column(ARBFN_FIELD_V, 0), atoms.column(ARBFN_FIELD_V, 1),
+                        atoms.column(ARBFN_FIELD_V, 2)};
+  double *const f[3] = {atoms.column(ARBFN_FIELD_F, 0), atoms.column(ARBFN_FIELD_F, 1),
+                        atoms.column(ARBFN_FIELD_F, 2)};
+  for (size_t i = 0; i < _n; ++i) {
+    x[0][i] = _from[i].x;
+    x[1][i] = _from[i].y;
+    x[2][i] = _from[i].z;
+    v[0][i] = _from[i].vx;
+    v[1][i] = _from[i].vy;
+    v[2][i] = _from[i].vz;
+    f[0][i] = _from[i].fx;
+    f[1][i] = _from[i].fy;
+    f[2][i] = _from[i].fz;
+  }
+  if (fields & ARBFN_FIELD_MU) {
+    double *const mu[3] = {atoms.column(ARBFN_FIELD_MU, 0), atoms.column(ARBFN_FIELD_MU, 1),
+                           atoms.column(ARBFN_FIELD_MU, 2)};
+    for (size_t i = 0; i < _n; ++i) {
+      mu[0][i] = _from[i].mux;
+      mu[1][i] = _from[i].muy;
+      mu[2][i] = _from[i].muz;
+    }
+  }
+
+  if (!interchange(atoms, fixes, _max_ms, _controller_rank, _comm, _format)) { return false; }
+
+  // Transpose back out of the fix buffer
+  const double *const dfx = fixes.column(0);
+  const double *const dfy = fixes.column(1);
+  const double *const dfz = fixes.column(2);
+  for (size_t i = 0; i < _n; ++i) {
+    _into[i].dfx = dfx[i];
+    _into[i].dfy = dfy[i];
+    _into[i].dfz = dfz[i];
+  }
+
+  return true;
+}
+
+/**
+ * @brief Counts the controllers: The first reduction of discovery
+ * @param _comm The ARBFN communicator
+ * @param _is_controller Whether the calling rank is a controller
+ * @return The number of controllers
+ */
+static int count_controllers(MPI_Comm &_comm, const bool &_is_controller)
+{
+  int num_controllers = (_is_controller ? 1 : 0);
+  MPI_Allreduce(MPI_IN_PLACE, &num_controllers, 1, MPI_INT, MPI_SUM, _comm);
+  return num_controllers;
+}
+
+/**
+ * @brief Counts the workers which picked each controller: The
+ * second reduction of discovery
+ * @param _comm The ARBFN communicator
+ * @param _num_controllers The number of controllers
+ * @param _pick The index of the controller picked, or negative
+ * @param _counts Where to save the number of workers per controller
+ */
+static void count_picks(MPI_Comm &_comm, const int &_num_controllers, const int &_pick,
+                        std::vector<int> &_counts)
+{
+  _counts.assign(_num_controllers, 0);
+  if (_pick >= 0) { _counts[_pick] = 1; }
+  MPI_Allreduce(MPI_IN_PLACE, _counts.data(), _num_controllers, MPI_INT, MPI_SUM, _comm);
+}
+
+/**
+ * @brief Finds the controllers and picks one, from a worker
+ * @return True on success, false if there are no controllers
+ */
+bool discover_controller(uint &_controller_rank, MPI_Comm &_comm, const double &_position)
 {
-  boost::json::object j;
+  std::vector<int> counts;
+  int rank;
 
-  j["x"] = _what.x;
-  j["vx"] = _what.vx;
-  j["fx"] = _what.fx;
-  j["y"] = _what.y;
-  j["vy"] = _what.vy;
-  j["fy"] = _what.fy;
-  j["z"] = _what.z;
-  j["vz"] = _what.vz;
-  j["fz"] = _what.fz;
+  MPI_Comm_rank(_comm, &rank);
+  const int num_controllers = count_controllers(_comm, false);
+  if (num_controllers == 0) {
+    std::cerr << "No ARBFN controllers were found\n";
+    return false;
+  }
 
-  if (_what.is_dipole) {
-    j["mux"] = _what.mux;
-    j["muy"] = _what.muy;
-    j["muz"] = _what.muz;
+  // Controllers hold the lowest ranks, so picking needs only their number
+  int pick = (rank - num_controllers) % num_controllers;
+  if (_position >= 0.0) {
+    pick = std::min((int) (_position * num_controllers), num_controllers - 1);
   }
+  count_picks(_comm, num_controllers, pick, counts);
+  _controller_rank = pick;
 
-  return j;
+  return true;
 }
 
 /**
- * @brief Parses some JSON object into raw fix data.
- * @param _to_parse The JSON object to load from
- * @return The deserialized version of the object
+ * @brief Takes part in discovery from a controller
+ * @return The number of workers which picked this controller
  */
-FixData from_json(const boost::json::value &_to_parse)
+uint discover_workers(MPI_Comm &_comm, uint &_num_controllers)
 {
-  FixData f;
+  std::vector<int> counts;
+  int rank;
 
-  f.dfx = _to_parse.at("dfx").as_double();
-  f.dfy = _to_parse.at("dfy").as_double();
-  f.dfz = _to_parse.at("dfz").as_double();
+  MPI_Comm_rank(_comm, &rank);
+  _num_controllers = count_controllers(_comm, true);
+  count_picks(_comm, _num_controllers, -1, counts);
 
-  return f;
+  return counts[rank];
 }
 
 /**
- * @brief Await an MPI packet for some amount of time, throwing an error if none arrives.
- * @param _max_ms The max number of milliseconds to wait before error
- * @param _into The `boost::json` to save the packet into
- * @param _rng Random number generator
- * @param _time_dist Uniform int range for use w/ `_rng`
- * @param _received_from Where to save the MPI source of the sender
- * @param _comm The MPI communicator to use
- * @return True on success, false on failure
+ * @brief Sends a registration packet to the controller.
+ * @return True on success, false on error.
  */
-bool await_packet(const double &_max_ms, boost::json::object &_into, std::random_device &_rng,
-                  std::uniform_int_distribution<uint> &_time_dist, uint &_received_from,
-                  MPI_Comm &_comm)
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm)
 {
-  bool got_any_packet;
-  std::chrono::high_resolution_clock::time_point send_time, now;
-  std::string response;
-  uint64_t elapsed_us;
-  MPI_Status status;
-  int flag;
-  char *buffer;
+  ARBFNFormat format = ARBFN_FORMAT_JSON;
+  return send_registration(_controller_rank, _comm, format);
+}
 
-  got_any_packet = false;
-  send_time = std::chrono::high_resolution_clock::now();
-  while (!got_any_packet) {
-    // Check for message recv resolution
-    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, _comm, &flag, &status);
-    if (flag && status._ucount > 0) {
-      buffer = new char[status._ucount + 1];
-      MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, _comm, &status);
-      buffer[status._ucount] = '\0';
-      response = buffer;
-      delete[] buffer;
+/**
+ * @brief Sends a registration packet to the controller, requesting
+ * the given wire format and announcing the fields to be sent.
+ * @return True on success, false on error.
+ */
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       const uint64_t &_fields)
+{
+  ARBFNMode mode = ARBFN_MODE_REQUEST;
+  return send_registration(_controller_rank, _comm, _format, _fields, mode);
+}
 
-      got_any_packet = true;
-      _received_from = status.MPI_SOURCE;
+/// The names of the modes in registration packets, by `ARBFNMode`
+static const char *const mode_names[3] = {"request", "grid", "delta"};
 
-      break;
-    }
+/// The names of the formats in registration packets, by `ARBFNFormat`.
+/// Collective packets are binary ones, so are asked for as such.
+static const char *const format_names[4] = {"json", "binary", "shared", "binary"};
 
-    // Update time elapsed
-    now = std::chrono::high_resolution_clock::now();
-    elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - send_time).count();
 
-    // If it has been too long, indicate error
-    if (elapsed_us / 1000.0 > _max_ms && _max_ms > 0.0) {
-      // Indicate error
-      std::cerr << "Timeout!\n";
-      return false;
-    }
+/**
+ * @brief Awaits the members of the group of a controller's
+ * collective workers, then makes it along with them
+ * @param _controller_rank The rank of the controller
+ * @param _comm The ARBFN communicator
+ * @param _group Where to save the group
+ * @return True on success, false on error
+ */
+static bool join_group(const uint &_controller_rank, MPI_Comm &_comm, MPI_Comm &_group)
+{
+  boost::json::object json;
+  Waiter &waiter = default_waiter();
+  std::vector<int> ranks;
+  uint received_from;
+  bool result;
+
+  // The controller sends the members once every worker has registered
+  waiter.start(10000.0);
+  do {
+    json.clear();
+    result = await_packet(waiter, json, received_from, _comm);
+  } while (result &&
+           (received_from != _controller_rank || !json.contains("type") ||
+            json.at("type") != "group"));
+  waiter.stop();
+  if (!result) { return false; }
 
-    // Else, sleep for a bit
-    std::this_thread::sleep_for(std::chrono::microseconds(_time_dist(_rng)));
+  const boost::json::value *const members = json.if_contains("ranks");
+  if (members != nullptr && members->is_array()) {
+    for (const boost::json::value &rank : members->as_array()) {
+      ranks.push_back(rank.to_number<int>());
+    }
+  }
+  if (ranks.empty() || ranks[0] != (int) _controller_rank) {
+    std::cerr << "Controller sent group without itself first\n";
+    return false;
   }
 
-  // Unwrap packet
-  _into = boost::json::parse(response).as_object();
+  // Only the members take part, so other workers need not know of it
+  MPI_Group everyone, group;
+  MPI_Comm_group(_comm, &everyone);
+  MPI_Group_incl(everyone, ranks.size(), ranks.data(), &group);
+  MPI_Comm_create_group(_comm, group, ARBFN_MPI_TAG_GROUP, &_group);
+  MPI_Group_free(&group);
+  MPI_Group_free(&everyone);
   return true;
 }
 
 /**
- * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
- * @param _n The number of atoms/fixes in the arrays.
- * @param _from An array of atom data to send
- * @param _into An array of fix data that was received
- * @param _max_ms The max number of milliseconds to await each response
- * @returns true on success, false on failure
+ * @brief Sends a registration packet to the controller, requesting
+ * the given wire format and mode, and announcing the fields to be
+ * sent.
+ * @return True on success, false on error.
  */
-bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
-                 const uint &_controller_rank, MPI_Comm &_comm)
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       const uint64_t &_fields, ARBFNMode &_mode, TileCache *_cache,
+                       Migration *_migration, uint64_t *_terms, SharedSegment *_segment,
+                       MPI_Comm *_group, ARBFNPrecision *_precision)
 {
-  bool got_fix, result;
-  boost::json::object json_send, json_recv;
-  std::random_device rng;
-  std::uniform_int_distribution<uint> time_dist(0, 500);
-  uint received_from;
-  boost::json::array list;
+  boost::json::object json;
+  Waiter &waiter = default_waiter();
   std::string to_send;
+  uint received_from;
+  bool result;
 
-  // Prepare and send the packet
-  json_send["type"] = "request";
-  json_send["expectResponse"] = _max_ms;
-  for (size_t i = 0; i < _n; ++i) { list.push_back(to_json(_from[i])); }
-  json_send["atoms"] = list;
+  // Memory is only shared outside grid mode, and only if the
+  // controller can open the segment (EG is on the same node)
+  if (_format == ARBFN_FORMAT_SHARED &&
+      (_segment == nullptr || _mode == ARBFN_MODE_GRID || !_segment->create(1 << 16))) {
+    _format = ARBFN_FORMAT_BINARY;
+  }
 
-  to_send = json_to_str(json_send);
-  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, 0, _comm);
+  // Collectives need a group, and carry only full requests
+  if (_format == ARBFN_FORMAT_COLLECTIVE && (_group == nullptr || _mode != ARBFN_MODE_REQUEST)) {
+    _format = ARBFN_FORMAT_BINARY;
+  }
 
-  // Await response
-  got_fix = false;
-  while (!got_fix) {
-    // Await any sort of packet
-    result = await_packet(_max_ms, json_recv, rng, time_dist, received_from, _comm);
-    if (!result) {
-      std::cerr << "await_packet failed\n";
-      return false;
-    } else if (received_from != _controller_rank) {
-      continue;
+  json["type"] = "register";
+  json["format"] = format_names[_format];
+  if (_format == ARBFN_FORMAT_SHARED) {
+    json["segment"] = _segment->name;
+    json["token"] = _segment->token;
+  } else if (_format == ARBFN_FORMAT_COLLECTIVE) {
+    json["collective"] = true;
+  }
+  boost::json::array fields;
+  for (const FieldInfo &info : field_info) {
+    if (_fields & info.field) { fields.push_back(info.name); }
+  }
+  json["fields"] = fields;
+  if (_mode != ARBFN_MODE_REQUEST) { json["mode"] = mode_names[_mode]; }
+  const bool migrate =
+      _migration != nullptr && (_fields & ARBFN_FIELD_ID) && _mode != ARBFN_MODE_GRID;
+  if (migrate) { json["migrate"] = true; }
+  const uint64_t terms = (_terms != nullptr && _mode != ARBFN_MODE_GRID ? *_terms : 0);
+  for (const TermInfo &info : term_info) {
+    if (terms & info.term) { json[info.name] = true; }
+  }
+  const ARBFNPrecision precision =
+      (_precision != nullptr && _format != ARBFN_FORMAT_JSON && _mode != ARBFN_MODE_GRID
+           ? *_precision
+           : ARBFN_PRECISION_DOUBLE);
+  if (precision != ARBFN_PRECISION_DOUBLE) { json["precision"] = precision_name(precision); }
+  to_send = json_to_str(json);
+
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON,
+           _comm);
+
+  waiter.start(10000.0);
+  do {
+    json.clear();
+    result = await_packet(waiter, json, received_from, _comm);
+  } while (result &&
+           (received_from != _controller_rank || !json.contains("type") ||
+            json.at("type") != "ack"));
+  waiter.stop();
+
+  // Once answered, the controller holds the segment open if it
+  // agreed to share it, so its name is no longer needed
+  if (_format == ARBFN_FORMAT_SHARED) {
+    _segment->unlink();
+    if (!result || !json.contains("format") || json.at("format") != "shared") {
+      _segment->close();
+      _format = ARBFN_FORMAT_BINARY;
     }
+  }
+  if (!result) { return false; }
 
-    // If "waiting" packet, continue. Else, break.
-    if (json_recv.at("type") == "waiting") {
-      continue;
-    } else {
-      if (json_recv["type"] != "response") {
-        std::cerr << "Controller sent bad packet w/ type '" << json_recv["type"] << "'\n";
-        return false;
+  // Controllers which predate the binary format will not mention it
+  if (!json.contains("format") || json.at("format") != format_names[_format]) {
+    _format = (json.contains("format") && json.at("format") == "binary" ? ARBFN_FORMAT_BINARY
+                                                                        : ARBFN_FORMAT_JSON);
+  }
+  if (!json.contains("mode") || json.at("mode") != mode_names[_mode]) {
+    _mode = ARBFN_MODE_REQUEST;
+  }
+  if (_migration != nullptr) {
+    _migration->clear();
+    _migration->enabled = migrate && json.contains("migrate") && json.at("migrate") == true;
+  }
+  if (_precision != nullptr) {
+    const bool agreed = _format != ARBFN_FORMAT_JSON && json.contains("precision") &&
+                        json.at("precision") == precision_name(precision);
+    *_precision = (agreed ? precision : ARBFN_PRECISION_DOUBLE);
+  }
+  if (_terms != nullptr) {
+    *_terms = 0;
+    for (const TermInfo &info : term_info) {
+      if ((terms & info.term) && json.contains(info.name) && json.at(info.name) == true) {
+        *_terms |= info.term;
       }
-      got_fix = true;
-      break;
     }
   }
 
-  // Transcribe fix data
-  if (json_recv.at("atoms").as_array().size() != _n) {
-    std::cerr << "Received malformed fix data from controller: Expected " << _n
-              << " atoms, but got " << json_recv.at("atoms").as_array().size() << "\n";
-    return false;
+  // Controllers which serve one worker at a time send binary packets
+  // instead. The group is made the first time only.
+  if (_format == ARBFN_FORMAT_COLLECTIVE) {
+    if (!json.contains("collective") || json.at("collective") != true) {
+      _format = ARBFN_FORMAT_BINARY;
+    } else if (*_group == MPI_COMM_NULL && !join_group(_controller_rank, _comm, *_group)) {
+      return false;
+    }
+  }
+
+  // In grid mode, the ack describes the grid and how it is tiled
+  if (_mode == ARBFN_MODE_GRID && _cache != nullptr) {
+    const boost::json::value *const grid = json.if_contains("grid");
+    const boost::json::object *const layout = (grid ? grid->if_object() : nullptr);
+    if (layout == nullptr || !layout->contains("dims") || !layout->contains("lo") ||
+        !layout->contains("hi") || !layout->contains("tile")) {
+      std::cerr << "Controller agreed to grid mode without describing its grid\n";
+      return false;
+    }
+
+    const boost::json::array &dims = layout->at("dims").as_array();
+    _cache->clear();
+    _cache->layout.dims[0] = dims.at(0).to_number<uint64_t>();
+    _cache->layout.dims[1] = dims.at(1).to_number<uint64_t>();
+    _cache->layout.dims[2] = dims.at(2).to_number<uint64_t>();
+    for (size_t d = 0; d < 3; ++d) {
+      _cache->layout.lo[d] = layout->at("lo").as_array().at(d).to_number<double>();
+      _cache->layout.hi[d] = layout->at("hi").as_array().at(d).to_number<double>();
+    }
+    _cache->tile_size = layout->at("tile").to_number<uint64_t>();
+    if (_cache->tile_size == 0 || _cache->layout.size() == 0) {
+      std::cerr << "Controller described an empty grid\n";
+      return false;
+    }
   }
-  for (size_t i = 0; i < _n; ++i) { _into[i] = from_json(json_recv.at("atoms").as_array().at(i)); }
 
   return true;
 }
 
 /**
- * @brief Sends a registration packet to the controller.
+ * @brief Sends a registration packet for several fixes at once,
+ * each announcing its own fields and terms.
  * @return True on success, false on error.
  */
-bool send_registration(uint &_controller_rank, MPI_Comm &_comm)
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       std::vector<MultiplexedFix> &_fixes)
 {
   boost::json::object json;
-  std::random_device rng;
-  std::uniform_int_distribution<uint> time_dist(0, 500);
+  Waiter &waiter = default_waiter();
   std::string to_send;
-  int world_size, rank;
+  uint received_from;
   bool result;
 
-  MPI_Comm_rank(_comm, &rank);
-  MPI_Comm_size(_comm, &world_size);
+  // Parts share one packet, so cannot share memory or a scatter
+  if (_format != ARBFN_FORMAT_JSON) { _format = ARBFN_FORMAT_BINARY; }
 
   json["type"] = "register";
+  json["format"] = format_names[_format];
+  boost::json::array parts;
+  for (const MultiplexedFix &fix : _fixes) {
+    boost::json::object part;
+    part["fix"] = fix.id;
+    boost::json::array fields;
+    for (const FieldInfo &info : field_info) {
+      if (fix.fields & info.field) { fields.push_back(info.name); }
+    }
+    part["fields"] = fields;
+    for (const TermInfo &info : term_info) {
+      if (fix.terms & info.term) { part[info.name] = true; }
+    }
+    parts.push_back(part);
+  }
+  json["fixes"] = parts;
   to_send = json_to_str(json);
 
-  for (int i = 0; i < world_size; ++i) {
-    if (i != rank) { MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, i, 0, _comm); }
-  }
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON,
+           _comm);
 
-  json.clear();
+  waiter.start(10000.0);
   do {
-    result = await_packet(10000.0, json, rng, time_dist, _controller_rank, _comm);
-    if (!result) { return false; }
-  } while (!json.contains("type") || json.at("type") != "ack");
+    json.clear();
+    result = await_packet(waiter, json, received_from, _comm);
+  } while (result &&
+           (received_from != _controller_rank || !json.contains("type") ||
+            json.at("type") != "ack"));
+  waiter.stop();
+  if (!result) { return false; }
+
+  // Controllers which serve one fix per worker ack a plain
+  // registration, knowing nothing of the parts
+  const boost::json::value *const acked = json.if_contains("fixes");
+  if (acked == nullptr || !acked->is_array() || acked->as_array().size() != _fixes.size()) {
+    std::cerr << "Controller does not serve several `fix arbfn' instances per process\n";
+    return false;
+  }
+
+  _format = (json.contains("format") && json.at("format") == "binary" ? ARBFN_FORMAT_BINARY
+                                                                      : ARBFN_FORMAT_JSON);
+  for (size_t k = 0; k < _fixes.size(); ++k) {
+    const boost::json::value &part = acked->as_array().at(k);
+    const uint64_t asked = _fixes[k].terms;
+    _fixes[k].terms = 0;
+    for (const TermInfo &info : term_info) {
+      if ((asked & info.term) && part.is_object() && part.as_object().contains(info.name) &&
+          part.at(info.name) == true) {
+        _fixes[k].terms |= info.term;
+      }
+    }
+  }
 
   return true;
 }
@@ -227,5 +2794,471 @@ bool send_registration(uint &_controller_rank, MPI_Comm &_comm)
 void send_deregistration(const int &_controller_rank, MPI_Comm &_comm)
 {
   std::string to_send = "{\"type\": \"deregister\"}";
-  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, 0, _comm);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON, _comm);
+}
+
+/**
+ * @brief Leaves the group, if any, then sends a deregistration
+ * packet to the controller and drains any grids in flight
+ */
+void send_deregistration(const int &_controller_rank, MPI_Comm &_comm, const ARBFNMode &_mode,
+                         MPI_Comm *_group)
+{
+  std::vector<char> packet;
+  MPI_Status status;
+  int count;
+
+  // The controller always awaits the next gather of sizes, so the
+  // group is left by gathering a size which no request can have
+  if (_group != nullptr && *_group != MPI_COMM_NULL) {
+    const uint64_t leaving = ARBFN_GROUP_LEAVING;
+    MPI_Request request;
+    MPI_Igather(&leaving, 1, MPI_UINT64_T, nullptr, 1, MPI_UINT64_T, 0, *_group, &request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    MPI_Comm_free(_group);
+  }
+
+  send_deregistration(_controller_rank, _comm);
+  if (_mode != ARBFN_MODE_GRID) { return; }
+
+  // Messages between two ranks arrive in order, so the ack comes last
+  while (true) {
+    MPI_Probe(_controller_rank, MPI_ANY_TAG, _comm, &status);
+    const MPI_Datatype type = (status.MPI_TAG == ARBFN_MPI_TAG_BINARY ? MPI_BYTE : MPI_CHAR);
+    MPI_Get_count(&status, type, &count);
+    packet.resize(count);
+    MPI_Recv(packet.data(), count, type, _controller_rank, status.MPI_TAG, _comm, &status);
+
+    if (status.MPI_TAG == ARBFN_MPI_TAG_JSON && count > 0) {
+      const boost::json::value json =
+          boost::json::parse(boost::json::string_view(packet.data(), packet.size()));
+      if (json.is_object() && json.as_object().contains("type") && json.at("type") == "ack") {
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Yields the number of tiles along an axis of a grid
+ */
+uint64_t tiles_along(const ForceGrid &_grid, const uint64_t &_tile_size, const size_t &_axis)
+{
+  return (_grid.dims[_axis] + _tile_size - 1) / _tile_size;
+}
+
+/**
+ * @brief Splits a tile index into its position along each axis
+ */
+static void tile_position(const ForceGrid &_grid, const uint64_t &_tile_size,
+                          const uint64_t &_tile, uint64_t _into[3])
+{
+  const uint64_t along_x = tiles_along(_grid, _tile_size, 0);
+  const uint64_t along_y = tiles_along(_grid, _tile_size, 1);
+  _into[0] = _tile % along_x;
+  _into[1] = (_tile / along_x) % along_y;
+  _into[2] = _tile / (along_x * along_y);
+}
+
+/**
+ * @brief Copies one tile out of a grid, as a grid of its own
+ */
+void extract_tile(const ForceGrid &_grid, const uint64_t &_tile_size, const uint64_t &_tile,
+                  ForceGrid &_into)
+{
+  uint64_t position[3], first[3], count[3];
+  tile_position(_grid, _tile_size, _tile, position);
+  for (size_t d = 0; d < 3; ++d) {
+    first[d] = position[d] * _tile_size;
+    count[d] = std::min(_tile_size, _grid.dims[d] - first[d]);
+    _into.lo[d] = _grid.node(d, first[d]);
+    _into.hi[d] = _grid.node(d, first[d] + count[d] - 1);
+  }
+
+  _into.resize(count[0], count[1], count[2]);
+  for (size_t c = 0; c < 3; ++c) {
+    const double *const from = _grid.column(c);
+    double *const to = _into.column(c);
+    for (size_t k = 0; k < count[2]; ++k) {
+      for (size_t j = 0; j < count[1]; ++j) {
+        const double *const row = from + _grid.index(first[0], first[1] + j, first[2] + k);
+        std::copy(row, row + count[0], to + _into.index(0, j, k));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Encodes a tile of a grid as a packet in the given format
+ */
+void encode_grid(const ForceGrid &_tile, const uint64_t &_index, const ARBFNFormat &_format,
+                 std::vector<char> &_into)
+{
+  const size_t n = _tile.size();
+
+  if (_format == ARBFN_FORMAT_BINARY) {
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_PACKET_GRID;
+    header.n = n;
+    header.fields = 0;
+    header.expect_response = 0.0;
+
+    double shape[10];
+    for (size_t d = 0; d < 3; ++d) {
+      shape[d] = (double) _tile.dims[d];
+      shape[3 + d] = _tile.lo[d];
+      shape[6 + d] = _tile.hi[d];
+    }
+    shape[9] = (double) _index;
+
+    _into.resize(sizeof(BinaryHeader) + sizeof(shape) + 3 * n * sizeof(double));
+    std::memcpy(_into.data(), &header, sizeof(BinaryHeader));
+    std::memcpy(_into.data() + sizeof(BinaryHeader), shape, sizeof(shape));
+    std::memcpy(_into.data() + sizeof(BinaryHeader) + sizeof(shape), _tile.values.data(),
+                3 * n * sizeof(double));
+  } else {
+    boost::json::object json;
+    boost::json::array dims, lo, hi;
+
+    json["type"] = "grid";
+    json["tile"] = _index;
+    for (size_t d = 0; d < 3; ++d) {
+      dims.push_back(_tile.dims[d]);
+      lo.push_back(_tile.lo[d]);
+      hi.push_back(_tile.hi[d]);
+    }
+    json["dims"] = dims;
+    json["lo"] = lo;
+    json["hi"] = hi;
+
+    static const char *const keys[3] = {"dfx", "dfy", "dfz"};
+    for (size_t c = 0; c < 3; ++c) {
+      boost::json::array column;
+      const double *const values = _tile.column(c);
+      for (size_t i = 0; i < n; ++i) { column.push_back(values[i]); }
+      json[keys[c]] = column;
+    }
+
+    const std::string text = json_to_str(json);
+    _into.assign(text.begin(), text.end());
+  }
+}
+
+/**
+ * @brief Decodes a grid packet in either format
+ * @param _packet The raw packet
+ * @param _tag The MPI tag it was received with
+ * @param _into Where to save the tile
+ * @param _index Where to save the index of the tile
+ * @return True on success, false if the packet was not a grid
+ */
+static bool decode_grid(const std::vector<char> &_packet, const int &_tag, ForceGrid &_into,
+                        uint64_t &_index)
+{
+  if (_tag == ARBFN_MPI_TAG_BINARY) {
+    BinaryHeader header;
+    double shape[10];
+
+    if (_packet.size() < sizeof(BinaryHeader) + sizeof(shape)) {
+      std::cerr << "Controller sent truncated binary grid\n";
+      return false;
+    }
+    std::memcpy(&header, _packet.data(), sizeof(BinaryHeader));
+    std::memcpy(shape, _packet.data() + sizeof(BinaryHeader), sizeof(shape));
+    if (header.magic != ARBFN_BINARY_MAGIC || header.type != ARBFN_PACKET_GRID) {
+      std::cerr << "Controller sent bad binary packet while grid was expected\n";
+      return false;
+    }
+
+    _into.resize((uint64_t) shape[0], (uint64_t) shape[1], (uint64_t) shape[2]);
+    if (_into.size() != header.n ||
+        _packet.size() != sizeof(BinaryHeader) + sizeof(shape) + 3 * header.n * sizeof(double)) {
+      std::cerr << "Controller sent truncated binary grid\n";
+      return false;
+    }
+    for (size_t d = 0; d < 3; ++d) {
+      _into.lo[d] = shape[3 + d];
+      _into.hi[d] = shape[6 + d];
+    }
+    _index = (uint64_t) shape[9];
+    std::memcpy(_into.values.data(), _packet.data() + sizeof(BinaryHeader) + sizeof(shape),
+                3 * header.n * sizeof(double));
+    return true;
+  }
+
+  const boost::json::value parsed =
+      boost::json::parse(boost::json::string_view(_packet.data(), _packet.size()));
+  const boost::json::object *const json = parsed.if_object();
+  if (json == nullptr || !json->contains("type") || json->at("type") != "grid") {
+    std::cerr << "Controller sent bad packet while grid was expected\n";
+    return false;
+  }
+
+  const boost::json::array &dims = json->at("dims").as_array();
+  _into.resize(dims.at(0).to_number<uint64_t>(), dims.at(1).to_number<uint64_t>(),
+               dims.at(2).to_number<uint64_t>());
+  for (size_t d = 0; d < 3; ++d) {
+    _into.lo[d] = json->at("lo").as_array().at(d).to_number<double>();
+    _into.hi[d] = json->at("hi").as_array().at(d).to_number<double>();
+  }
+  _index = json->at("tile").to_number<uint64_t>();
+
+  static const char *const keys[3] = {"dfx", "dfy", "dfz"};
+  for (size_t c = 0; c < 3; ++c) {
+    const boost::json::array &column = json->at(keys[c]).as_array();
+    if (column.size() != _into.size()) {
+      std::cerr << "Controller sent malformed grid: Expected " << _into.size()
+                << " nodes, but got " << column.size() << "\n";
+      return false;
+    }
+    double *const values = _into.column(c);
+    for (size_t i = 0; i < column.size(); ++i) { values[i] = column[i].to_number<double>(); }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Copies a cached tile into the cache's local grid
+ */
+static void place_tile(TileCache &_cache, const uint64_t &_index, const ForceGrid &_tile)
+{
+  uint64_t position[3], offset[3];
+  tile_position(_cache.layout, _cache.tile_size, _index, position);
+  for (size_t d = 0; d < 3; ++d) {
+    offset[d] = (position[d] - _cache.tile_lo[d]) * _cache.tile_size;
+  }
+
+  for (size_t c = 0; c < 3; ++c) {
+    const double *const from = _tile.column(c);
+    double *const to = _cache.local.column(c);
+    for (size_t k = 0; k < _tile.dims[2]; ++k) {
+      for (size_t j = 0; j < _tile.dims[1]; ++j) {
+        const double *const row = from + _tile.index(0, j, k);
+        std::copy(row, row + _tile.dims[0],
+                  to + _cache.local.index(offset[0], offset[1] + j, offset[2] + k));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Files a tile received from the controller, if it is still
+ * wanted
+ * @param _kept Where to save whether the tile was kept
+ * @return True on success, false if the tile has the wrong shape
+ */
+static bool receive_tile(TileCache &_cache, const uint64_t &_index, ForceGrid &_tile,
+                         bool &_kept)
+{
+  _kept = false;
+  const auto it = _cache.tiles.find(_index);
+  if (it == _cache.tiles.end()) { return true; }
+
+  uint64_t position[3];
+  tile_position(_cache.layout, _cache.tile_size, _index, position);
+  for (size_t d = 0; d < 3; ++d) {
+    const uint64_t first = position[d] * _cache.tile_size;
+    if (_tile.dims[d] != std::min(_cache.tile_size, _cache.layout.dims[d] - first)) {
+      std::cerr << "Controller sent tile " << _index << " w/ wrong shape\n";
+      return false;
+    }
+  }
+
+  std::swap(it->second, _tile);
+  place_tile(_cache, _index, it->second);
+  _kept = true;
+  return true;
+}
+
+/**
+ * @brief Fetches and drops tiles so that exactly those covering a
+ * box are cached
+ * @return True on success, false on failure
+ */
+bool fetch_tiles(TileCache &_cache, const double _lo[3], const double _hi[3],
+                 const double &_max_ms, const uint &_controller_rank, MPI_Comm &_comm,
+                 Waiter &_waiter)
+{
+  const ForceGrid &layout = _cache.layout;
+  uint64_t tile_lo[3], tile_hi[3];
+
+  // Find the nodes around the box, then the tiles holding them
+  for (size_t d = 0; d < 3; ++d) {
+    uint64_t first = 0, last = 0;
+    if (layout.dims[d] > 1) {
+      const double last_node = (double) (layout.dims[d] - 1);
+      const double scale = last_node / (layout.hi[d] - layout.lo[d]);
+      const double from = std::floor((_lo[d] - layout.lo[d]) * scale);
+      const double to = std::ceil((_hi[d] - layout.lo[d]) * scale);
+      first = (uint64_t) std::min(std::max(from, 0.0), last_node);
+      last = (uint64_t) std::min(std::max(to, 0.0), last_node);
+    }
+    tile_lo[d] = first / _cache.tile_size;
+    tile_hi[d] = std::max(first, last) / _cache.tile_size;
+  }
+
+  if (_cache.local.size() > 0 && std::equal(tile_lo, tile_lo + 3, _cache.tile_lo) &&
+      std::equal(tile_hi, tile_hi + 3, _cache.tile_hi)) {
+    return true;
+  }
+
+  // Only ask for what is not already cached
+  const uint64_t along_x = tiles_along(layout, _cache.tile_size, 0);
+  const uint64_t along_y = tiles_along(layout, _cache.tile_size, 1);
+  std::map<uint64_t, ForceGrid> kept;
+  boost::json::array fetch, drop;
+  for (uint64_t k = tile_lo[2]; k <= tile_hi[2]; ++k) {
+    for (uint64_t j = tile_lo[1]; j <= tile_hi[1]; ++j) {
+      for (uint64_t i = tile_lo[0]; i <= tile_hi[0]; ++i) {
+        const uint64_t index = i + along_x * (j + along_y * k);
+        const auto it = _cache.tiles.find(index);
+        if (it == _cache.tiles.end()) {
+          fetch.push_back(index);
+          kept[index];
+        } else {
+          std::swap(kept[index], it->second);
+          _cache.tiles.erase(it);
+        }
+      }
+    }
+  }
+  for (const auto &p : _cache.tiles) { drop.push_back(p.first); }
+  std::swap(_cache.tiles, kept);
+
+  // Assemble the local grid as tiles arrive
+  uint64_t counts[3];
+  for (size_t d = 0; d < 3; ++d) {
+    const uint64_t first = tile_lo[d] * _cache.tile_size;
+    const uint64_t last = std::min((tile_hi[d] + 1) * _cache.tile_size, layout.dims[d]) - 1;
+    counts[d] = last - first + 1;
+    _cache.local.lo[d] = layout.node(d, first);
+    _cache.local.hi[d] = layout.node(d, last);
+    _cache.tile_lo[d] = tile_lo[d];
+    _cache.tile_hi[d] = tile_hi[d];
+  }
+  _cache.local.resize(counts[0], counts[1], counts[2]);
+  for (const auto &p : _cache.tiles) {
+    if (p.second.size() > 0) { place_tile(_cache, p.first, p.second); }
+  }
+
+  if (fetch.empty() && drop.empty()) { return true; }
+
+  boost::json::object json;
+  json["type"] = "tiles";
+  json["fetch"] = fetch;
+  json["drop"] = drop;
+  const std::string to_send = json_to_str(json);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_MPI_TAG_JSON,
+           _comm);
+
+  // Tiles pushed before the request may be interleaved with those
+  // fetched, but every tile fetched arrives after the request
+  std::vector<char> packet;
+  ForceGrid tile;
+  uint64_t index;
+  uint received_from;
+  int tag;
+  size_t missing = fetch.size();
+  bool result = true;
+
+  _waiter.start(_max_ms);
+  while (result && missing > 0) {
+    result = await_raw_packet(_waiter, packet, received_from, tag, _comm);
+    if (!result || received_from != _controller_rank) { continue; }
+    result = decode_grid(packet, tag, tile, index);
+
+    if (!result) { continue; }
+
+    const auto it = _cache.tiles.find(index);
+    const bool was_missing = (it != _cache.tiles.end() && it->second.size() == 0);
+    bool kept;
+    result = receive_tile(_cache, index, tile, kept);
+    if (kept && was_missing) { --missing; }
+  }
+  _waiter.stop();
+
+  return result;
+}
+
+/**
+ * @brief Receives any pushed tiles without blocking
+ * @return True on success, false if a bad packet was received
+ */
+bool poll_grid(TileCache &_cache, const uint &_controller_rank, MPI_Comm &_comm, bool &_updated)
+{
+  std::vector<char> packet;
+  ForceGrid tile;
+  uint64_t index;
+  MPI_Status status;
+  int flag, count;
+
+  _updated = false;
+  while (true) {
+    MPI_Iprobe(_controller_rank, MPI_ANY_TAG, _comm, &flag, &status);
+    if (!flag) { return true; }
+
+    const MPI_Datatype type = (status.MPI_TAG == ARBFN_MPI_TAG_BINARY ? MPI_BYTE : MPI_CHAR);
+    MPI_Get_count(&status, type, &count);
+    packet.resize(count);
+    MPI_Recv(packet.data(), count, type, _controller_rank, status.MPI_TAG, _comm, &status);
+
+    // Empty packets carry no information, and dropped tiles are stale
+    if (count == 0) { continue; }
+    bool kept;
+    if (!decode_grid(packet, status.MPI_TAG, tile, index) ||
+        !receive_tile(_cache, index, tile, kept)) {
+      return false;
+    }
+    _updated = _updated || kept;
+  }
+}
+
+/**
+ * @brief Interpolates force deltas from a grid, trilinearly
+ */
+void interpolate(const ForceGrid &_grid, const AtomBuffer &_atoms, FixBuffer &_into)
+{
+  const size_t n = _atoms.n;
+  const size_t strides[3] = {1, _grid.dims[0], _grid.dims[0] * _grid.dims[1]};
+  double scale[3], last[3];
+  size_t steps[3];
+
+  // A dimension with a single node has nowhere to step to
+  for (size_t d = 0; d < 3; ++d) {
+    last[d] = (_grid.dims[d] > 1 ? (double) (_grid.dims[d] - 1) : 0.0);
+    scale[d] = (last[d] > 0.0 ? last[d] / (_grid.hi[d] - _grid.lo[d]) : 0.0);
+    steps[d] = (last[d] > 0.0 ? strides[d] : 0);
+  }
+
+  _into.resize(n);
+  const double *const pos[3] = {_atoms.column(ARBFN_FIELD_X, 0), _atoms.column(ARBFN_FIELD_X, 1),
+                                _atoms.column(ARBFN_FIELD_X, 2)};
+  const double *const values[3] = {_grid.column(0), _grid.column(1), _grid.column(2)};
+  double *const out[3] = {_into.column(0), _into.column(1), _into.column(2)};
+  const size_t sx = steps[0], sy = steps[1], sz = steps[2];
+
+  for (size_t j = 0; j < n; ++j) {
+    // Find the cell holding the atom, and its offset therein
+    size_t base = 0;
+    double w[3];
+    for (size_t d = 0; d < 3; ++d) {
+      const double t = std::min(std::max((pos[d][j] - _grid.lo[d]) * scale[d], 0.0), last[d]);
+      const double cell = std::min(std::floor(t), std::max(last[d] - 1.0, 0.0));
+      w[d] = t - cell;
+      base += (size_t) cell * strides[d];
+    }
+
+    for (size_t c = 0; c < 3; ++c) {
+      const double *const v = values[c] + base;
+      const double c00 = v[0] + w[0] * (v[sx] - v[0]);
+      const double c10 = v[sy] + w[0] * (v[sy + sx] - v[sy]);
+      const double c01 = v[sz] + w[0] * (v[sz + sx] - v[sz]);
+      const double c11 = v[sz + sy] + w[0] * (v[sz + sy + sx] - v[sz + sy]);
+      const double c0 = c00 + w[1] * (c10 - c00);
+      const double c1 = c01 + w[1] * (c11 - c01);
+      out[c][j] = c0 + w[2] * (c1 - c0);
+    }
+  }
 }
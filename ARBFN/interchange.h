@@ -7,16 +7,281 @@
 #define ARBFN_INTERCHANGE_H
 
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
 #include <mpi.h>
-#include <random>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 /**
  * @brief The color all ARBFN comms will be expected to have
  */
 const static int ARBFN_MPI_COLOR = 56789;
 
+/**
+ * @brief The `MPI_Comm_split` keys of controllers and workers when
+ * splitting off the ARBFN comm. Controllers sort first, so they
+ * always hold ranks 0 through N - 1.
+ */
+const static int ARBFN_MPI_KEY_CONTROLLER = 0;
+const static int ARBFN_MPI_KEY_WORKER = 1;
+
+/**
+ * @brief The MPI tag used for JSON (text) packets
+ */
+const static int ARBFN_MPI_TAG_JSON = 0;
+
+/**
+ * @brief The MPI tag used for binary (packed) packets
+ */
+const static int ARBFN_MPI_TAG_BINARY = 1;
+
+/**
+ * @brief The tag with which each controller makes the group of its
+ * collective workers (see `MPI_Comm_create_group`)
+ */
+const static int ARBFN_MPI_TAG_GROUP = 2;
+
+/**
+ * @brief The size which a collective worker gathers in place of a
+ * request, to leave its group
+ */
+const static uint64_t ARBFN_GROUP_LEAVING = UINT64_MAX;
+
+/**
+ * @brief The first four bytes of every binary packet ("ARBF")
+ */
+const static uint32_t ARBFN_BINARY_MAGIC = 0x46425241;
+
+/**
+ * @brief The wire formats which a worker and controller may agree
+ * upon at registration time
+ * @var ARBFN_FORMAT_SHARED Binary packets, passed through memory
+ * shared by a worker and a controller on the same node (see
+ * `SharedSegment`). Controllers on other nodes agree to
+ * `ARBFN_FORMAT_BINARY` instead.
+ * @var ARBFN_FORMAT_COLLECTIVE Binary packets, gathered from and
+ * scattered to all of a controller's collective workers at once,
+ * over the group made at registration. Only bulk controllers agree
+ * to it, and others to `ARBFN_FORMAT_BINARY` instead.
+ */
+enum ARBFNFormat {
+  ARBFN_FORMAT_JSON = 0,
+  ARBFN_FORMAT_BINARY = 1,
+  ARBFN_FORMAT_SHARED = 2,
+  ARBFN_FORMAT_COLLECTIVE = 3
+};
+
+/**
+ * @brief How a worker obtains its forces, as agreed upon at
+ * registration time
+ * @var ARBFN_MODE_REQUEST Send atoms to the controller every step
+ * @var ARBFN_MODE_GRID Interpolate forces from the tiles of a grid
+ * held by the controller, which pushes them again as they change
+ * @var ARBFN_MODE_DELTA Send only the atoms which changed since the
+ * last step (see `AtomDelta`)
+ */
+enum ARBFNMode { ARBFN_MODE_REQUEST = 0, ARBFN_MODE_GRID = 1, ARBFN_MODE_DELTA = 2 };
+
+/**
+ * @brief The widths at which the columns of binary packets may
+ * travel, as agreed upon at registration time. Types and IDs always
+ * travel as doubles, so stay exact.
+ * @var ARBFN_PRECISION_DOUBLE As doubles. The default.
+ * @var ARBFN_PRECISION_SINGLE As floats, rounded to nearest: Each
+ * value is off by at most 2^-24 (about 6e-8) of itself, or by half
+ * the least float (about 7e-46) if it underflows.
+ * @var ARBFN_PRECISION_QUANTIZED As 16-bit integers, spread evenly
+ * between the least and greatest value of each column of each
+ * packet: Each value is off by at most 1/131070 of that column's
+ * spread (and by up to about 2e-319 more in columns spread by less
+ * than about 1e-303, whose step underflows), and a column of equal
+ * values is exact. Values must be finite.
+ */
+enum ARBFNPrecision {
+  ARBFN_PRECISION_DOUBLE = 0,
+  ARBFN_PRECISION_SINGLE = 1,
+  ARBFN_PRECISION_QUANTIZED = 2
+};
+
+/// The greatest integer a quantized value travels as
+const static double ARBFN_QUANTIZED_MAX = 65535.0;
+
+/**
+ * @brief Yields the name of the given precision
+ * @param _precision The precision to name
+ * @return Its name in registration packets (EG `"single"`)
+ */
+const char *precision_name(const ARBFNPrecision &_precision);
+
+/**
+ * @brief Looks up a precision by name
+ * @param _name The name, as in `fix arbfn ... precision`
+ * @param _into Where to save the precision
+ * @return True if a precision has the given name
+ */
+bool precision_from_name(const std::string &_name, ARBFNPrecision &_into);
+
+/**
+ * @brief The strategies a worker may use to await the controller
+ * @var ARBFN_WAIT_POLL Busy-poll without ever sleeping. Lowest
+ * latency, but occupies a core for the whole wait.
+ * @var ARBFN_WAIT_BACKOFF Busy-poll briefly, then yield, then sleep
+ * for exponentially longer intervals. The default.
+ * @var ARBFN_WAIT_BLOCK Block inside MPI, with a watchdog thread
+ * enforcing the max delay by killing the process. Cheapest on the
+ * CPU, but latency depends upon the MPI implementation's progress
+ * engine.
+ */
+enum ARBFNWait { ARBFN_WAIT_POLL = 0, ARBFN_WAIT_BACKOFF = 1, ARBFN_WAIT_BLOCK = 2 };
+
+/**
+ * @brief The packet types which may appear in a binary header.
+ * Multiplexed packets carry the requests or responses of several
+ * fixes at once (see `MultiplexPart`).
+ */
+enum ARBFNPacketType {
+  ARBFN_PACKET_REQUEST = 0,
+  ARBFN_PACKET_RESPONSE = 1,
+  ARBFN_PACKET_WAITING = 2,
+  ARBFN_PACKET_GRID = 3,
+  ARBFN_PACKET_DELTA = 4,
+  ARBFN_PACKET_MULTIPLEX = 5
+};
+
+/**
+ * @brief Bitflags for the per-atom fields carried by a request.
+ * Vector fields (position, velocity, force and dipole moment) are
+ * a block of three columns (x, y, z), while scalar fields (charge,
+ * type and tag) are a single column. In binary packets, type and
+ * tag are sent as doubles, which is exact for values below 2^53.
+ */
+enum ARBFNField {
+  ARBFN_FIELD_X = 1 << 0,
+  ARBFN_FIELD_V = 1 << 1,
+  ARBFN_FIELD_F = 1 << 2,
+  ARBFN_FIELD_MU = 1 << 3,
+  ARBFN_FIELD_Q = 1 << 4,
+  ARBFN_FIELD_TYPE = 1 << 5,
+  ARBFN_FIELD_ID = 1 << 6
+};
+
+/**
+ * @brief The fields sent when none are specified
+ */
+const static uint64_t ARBFN_DEFAULT_FIELDS = ARBFN_FIELD_X | ARBFN_FIELD_V | ARBFN_FIELD_F;
+
+/**
+ * @brief Yields the number of columns a field occupies
+ * @param _field The field to check
+ * @return 3 for vector fields, 1 for scalar fields
+ */
+inline size_t field_width(const uint64_t &_field)
+{
+  return _field >= ARBFN_FIELD_Q ? 1 : 3;
+}
+
+/**
+ * @brief Yields the total number of columns some fields occupy
+ * @param _fields Bitwise OR of the `ARBFNField`s
+ */
+inline size_t field_columns(const uint64_t &_fields)
+{
+  size_t columns = 0;
+  for (uint64_t bit = 1; bit <= _fields; bit <<= 1) {
+    if (_fields & bit) { columns += field_width(bit); }
+  }
+  return columns;
+}
+
+/**
+ * @brief Looks up a field by the name used in `fix arbfn` and in
+ * registration packets (`x`, `v`, `f`, `mu`, `q`, `type`, `id`)
+ * @param _name The name of the field
+ * @return The field, or 0 if no field has the given name
+ */
+uint64_t field_from_name(const std::string &_name);
+
+/**
+ * @brief Yields the name of the given field
+ * @param _field The field to name
+ * @return The name used in `fix arbfn` and registration packets
+ */
+const char *field_name(const uint64_t &_field);
+
+/**
+ * @brief Yields the per-atom JSON key of one component of a field
+ * @param _field The field
+ * @param _component 0, 1 or 2 for the x, y or z component (always
+ * 0 for scalar fields)
+ * @return The key (EG `"vy"`), or nullptr if there is no such key
+ */
+const char *field_key(const uint64_t &_field, const size_t &_component);
+
+/**
+ * @brief Bitflags for the optional per-atom terms which may follow
+ * the force deltas in responses, in ascending bit order, once
+ * agreed upon at registration
+ * @var ARBFN_TERM_RATES The rates of change of the force deltas per
+ * unit time (three columns)
+ * @var ARBFN_TERM_ENERGY The potential energy of each atom in the
+ * controller's field (one column)
+ * @var ARBFN_TERM_VIRIAL Each atom's contribution to the virial, in
+ * energy units (six columns: xx, yy, zz, xy, xz and yz)
+ */
+enum ARBFNTerm {
+  ARBFN_TERM_RATES = 1 << 0,
+  ARBFN_TERM_ENERGY = 1 << 1,
+  ARBFN_TERM_VIRIAL = 1 << 2
+};
+
+/**
+ * @brief Yields the number of columns a term occupies
+ */
+inline size_t term_width(const uint64_t &_term)
+{
+  return _term == ARBFN_TERM_ENERGY ? 1 : (_term == ARBFN_TERM_VIRIAL ? 6 : 3);
+}
+
+/**
+ * @brief Yields the name of the given term
+ * @param _term The term to name
+ * @return The key asking for it in registration packets (EG
+ * `"energy"`)
+ */
+const char *term_name(const uint64_t &_term);
+
+/**
+ * @brief Yields the per-atom JSON key of one column of a term
+ * @param _term The term
+ * @param _component The column within the term
+ * @return The key (EG `"virial_xy"`), or nullptr if there is no
+ * such key
+ */
+const char *term_key(const uint64_t &_term, const size_t &_component);
+
+/// The most characters `format_double` writes
+const static size_t ARBFN_MAX_DOUBLE_CHARS = 32;
+
+/**
+ * @brief Writes a double as JSON text, such that it parses back as
+ * the same double (rather than as an integer). JSON has no NaN or
+ * infinity, so those are written as `null`, which readers reject as
+ * a missing number.
+ * @param _into Where to write, with room for at least
+ * `ARBFN_MAX_DOUBLE_CHARS` characters
+ * @param _what The value to write
+ * @return The number of characters written, not counting the
+ * terminating null
+ */
+size_t format_double(char *_into, const double &_what);
+
 /**
  * @struct AtomData
  * @brief Represents a single atom to be transferred
@@ -55,6 +320,949 @@ struct FixData {
   double dfx, dfy, dfz;
 };
 
+/**
+ * @struct BinaryHeader
+ * @brief The fixed-size header which leads every binary packet,
+ * followed by columns of `n` values each:
+ * - A request holds, for each set bit of `fields` in ascending
+ *   order, that field's columns: Three for vector fields (x, y and
+ *   z components) and one for `q`, `type` and `id`. There are
+ *   `field_columns(fields)` in all (see `binary_field_offset`).
+ * - A response holds the `dfx`, `dfy` and `dfz` columns, then those
+ *   of each `ARBFNTerm` agreed to at registration, in ascending
+ *   order of bit (see `FixBuffer::term_column`). Its `fields` is 0.
+ * - A delta is laid out as a request, followed by the departed tags
+ *   (see `AtomDelta`), and a grid as described by `ForceGrid`. A
+ *   "waiting" packet is the header alone.
+ * - A multiplexed packet, with `n` the number of parts, holds a
+ *   `MultiplexPart` prefix before each part's own packet.
+ *
+ * Columns are doubles, unless a reduced `ARBFNPrecision` was agreed
+ * to. Then each request or response column (but those of `type` and
+ * `id`, which stay doubles) is either `n` floats, or the column's
+ * least value and step as two doubles followed by `n` 16-bit
+ * integers. Either is zero-padded to a multiple of 8 bytes (see
+ * `pack`). All values are in the native byte order of the sender.
+ * @var BinaryHeader::magic Always `ARBFN_BINARY_MAGIC`
+ * @var BinaryHeader::type One of `ARBFNPacketType`
+ * @var BinaryHeader::n The number of atoms in the packet
+ * @var BinaryHeader::fields Bitwise OR of `ARBFNField` flags
+ * @var BinaryHeader::expect_response The max ms the worker waits
+ */
+struct BinaryHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t n;
+  uint64_t fields;
+  double expect_response;
+};
+
+/**
+ * @brief Finds the offset (in doubles, past the header) of the
+ * first column of a field within a binary request.
+ * @param _fields The fields present in the packet
+ * @param _field The field to locate
+ * @param _n The number of atoms in the packet
+ * @return The offset of the first column of the field
+ */
+inline size_t binary_field_offset(const uint64_t &_fields, const ARBFNField &_field,
+                                  const size_t &_n)
+{
+  size_t columns = 0;
+  for (uint64_t bit = 1; bit < (uint64_t) _field; bit <<= 1) {
+    if (_fields & bit) { columns += field_width(bit); }
+  }
+  return columns * _n;
+}
+
+/**
+ * @brief Locates the first column of a field within a binary
+ * request packet. For vector fields, the y and z columns follow
+ * it, each `n` long.
+ * @param _packet The raw packet, beginning with its `BinaryHeader`
+ * @param _field The field to locate
+ * @return A pointer to the first column, or nullptr if the field
+ * is not present in the packet
+ */
+inline const double *binary_field(const char *_packet, const ARBFNField &_field)
+{
+  BinaryHeader header;
+
+  std::memcpy(&header, _packet, sizeof(BinaryHeader));
+  if (!(header.fields & _field)) { return nullptr; }
+
+  return reinterpret_cast<const double *>(_packet + sizeof(BinaryHeader)) +
+      binary_field_offset(header.fields, _field, header.n);
+}
+
+/**
+ * @struct AtomBuffer
+ * @brief A reusable structure-of-arrays staging area for atoms to
+ * be transferred. The storage is laid out exactly as a binary
+ * request packet, so it can be sent without any copying. Resizing
+ * never releases capacity, so steady-state use does not allocate.
+ * @var AtomBuffer::packet The header followed by the columns
+ * @var AtomBuffer::n The number of atoms currently staged
+ * @var AtomBuffer::fields Bitwise OR of the `ARBFNField`s staged
+ * @var AtomBuffer::placed If not null, a packet held elsewhere (EG
+ * in a `SharedSegment`) which the columns are read from instead of
+ * `packet`
+ * @var AtomBuffer::precision The precision at which the atoms
+ * travel, as agreed at registration. Unless double, they travel as
+ * `packed` (see `pack`) rather than as `packet`.
+ * @var AtomBuffer::packed The packet at reduced precision, or the
+ * request as JSON text, as it last travelled
+ * @var AtomBuffer::threads The number of OpenMP threads which may
+ * share the encoding of the atoms (see `fix arbfn/omp`)
+ * @var AtomBuffer::chunks Each thread's share of the JSON text, kept
+ * between steps so that encoding does not allocate
+ */
+struct AtomBuffer {
+  std::vector<char> packet;
+  size_t n = 0;
+  uint64_t fields = 0;
+  char *placed = nullptr;
+  ARBFNPrecision precision = ARBFN_PRECISION_DOUBLE;
+  std::vector<char> packed;
+  size_t threads = 1;
+  mutable std::vector<std::vector<char>> chunks;
+
+  /**
+   * @brief Sets the number of atoms and fields to be staged. Any
+   * previously staged values are invalidated, and the buffer holds
+   * its own packet again.
+   * @param _n The number of atoms
+   * @param _fields Bitwise OR of the `ARBFNField`s to stage
+   */
+  void resize(const size_t &_n, const uint64_t &_fields)
+  {
+    n = _n;
+    fields = _fields;
+    placed = nullptr;
+    packet.resize(sizeof(BinaryHeader) + field_columns(_fields) * n * sizeof(double));
+  }
+
+  /**
+   * @brief Views a packet held elsewhere, without copying it. It
+   * must outlive its use through this buffer.
+   * @param _packet The packet, beginning with its `BinaryHeader`
+   * @param _n The number of atoms in it
+   * @param _fields Bitwise OR of the `ARBFNField`s in it
+   */
+  void place(char *_packet, const size_t &_n, const uint64_t &_fields)
+  {
+    n = _n;
+    fields = _fields;
+    placed = _packet;
+  }
+
+  /**
+   * @brief Yields the packet, wherever it is held
+   */
+  char *data() { return (placed != nullptr ? placed : packet.data()); }
+
+  /**
+   * @brief Yields the packet, wherever it is held
+   */
+  const char *data() const { return (placed != nullptr ? placed : packet.data()); }
+
+  /**
+   * @brief Yields one component column of a staged field
+   * @param _field The field, which must be staged
+   * @param _component 0, 1 or 2 for the x, y or z component (always
+   * 0 for scalar fields)
+   * @return A pointer to the `n` values of the column
+   */
+  double *column(const ARBFNField &_field, const size_t &_component)
+  {
+    return reinterpret_cast<double *>(data() + sizeof(BinaryHeader)) +
+        binary_field_offset(fields, _field, n) + _component * n;
+  }
+
+  /**
+   * @brief Yields one component column of a staged field
+   * @param _field The field, which must be staged
+   * @param _component 0, 1 or 2 for the x, y or z component (always
+   * 0 for scalar fields)
+   * @return A pointer to the `n` values of the column
+   */
+  const double *column(const ARBFNField &_field, const size_t &_component) const
+  {
+    return reinterpret_cast<const double *>(data() + sizeof(BinaryHeader)) +
+        binary_field_offset(fields, _field, n) + _component * n;
+  }
+};
+
+/**
+ * @struct FixBuffer
+ * @brief A reusable structure-of-arrays buffer for received fix
+ * data. The storage is laid out exactly as a binary response
+ * packet, so binary responses are received into it in place.
+ * @var FixBuffer::packet The header followed by the columns
+ * @var FixBuffer::n The number of fixes held
+ * @var FixBuffer::width The number of columns: 3 for the force
+ * deltas, then those of each of the `terms`
+ * @var FixBuffer::terms The `ARBFNTerm`s which follow the force
+ * deltas, as agreed at registration (see `set_terms`)
+ * @var FixBuffer::placed If not null, a packet held elsewhere (EG in
+ * a `SharedSegment`) which the columns are written to instead of
+ * `packet`
+ * @var FixBuffer::precision The precision at which the fixes
+ * travel, as agreed at registration. Unless double, they travel as
+ * `packed` (see `pack`) rather than as `packet`.
+ * @var FixBuffer::packed The packet at reduced precision, or the
+ * response as JSON text, as it last travelled
+ * @var FixBuffer::threads The number of OpenMP threads which may
+ * share the decoding of reduced-precision fixes (see `fix
+ * arbfn/omp`)
+ */
+struct FixBuffer {
+  std::vector<char> packet;
+  size_t n = 0;
+  size_t width = 3;
+  uint64_t terms = 0;
+  char *placed = nullptr;
+  ARBFNPrecision precision = ARBFN_PRECISION_DOUBLE;
+  std::vector<char> packed;
+  size_t threads = 1;
+
+  /**
+   * @brief Sets the terms which follow the force deltas, and with
+   * them the width. Takes effect upon the next `resize` or `place`.
+   * @param _terms Bitwise OR of the `ARBFNTerm`s
+   */
+  void set_terms(const uint64_t &_terms)
+  {
+    terms = _terms;
+    width = 3;
+    for (uint64_t term = 1; term <= _terms; term <<= 1) {
+      if (_terms & term) { width += term_width(term); }
+    }
+  }
+
+  /**
+   * @brief Yields the first column of a term
+   * @param _term The term, which must be held
+   */
+  size_t term_column(const uint64_t &_term) const
+  {
+    size_t column = 3;
+    for (uint64_t term = 1; term < _term; term <<= 1) {
+      if (terms & term) { column += term_width(term); }
+    }
+    return column;
+  }
+
+  /**
+   * @brief Sets the number of fixes to be held, in the buffer's own
+   * packet
+   * @param _n The number of fixes
+   */
+  void resize(const size_t &_n)
+  {
+    n = _n;
+    placed = nullptr;
+    packet.resize(sizeof(BinaryHeader) + width * n * sizeof(double));
+  }
+
+  /**
+   * @brief Holds the fixes in a packet held elsewhere, without
+   * copying. It must have room for `width` columns of `_n` values,
+   * and outlive its use through this buffer.
+   * @param _packet The packet, beginning with its `BinaryHeader`
+   * @param _n The number of fixes
+   */
+  void place(char *_packet, const size_t &_n)
+  {
+    n = _n;
+    placed = _packet;
+  }
+
+  /**
+   * @brief Yields the packet, wherever it is held
+   */
+  char *data() { return (placed != nullptr ? placed : packet.data()); }
+
+  /**
+   * @brief Yields the packet, wherever it is held
+   */
+  const char *data() const { return (placed != nullptr ? placed : packet.data()); }
+
+  /**
+   * @brief Yields one column of the fixes
+   * @param _component 0, 1 or 2 for dfx, dfy or dfz, or a column of
+   * a term (see `term_column`)
+   * @return A pointer to the `n` values of the column
+   */
+  double *column(const size_t &_component)
+  {
+    return reinterpret_cast<double *>(data() + sizeof(BinaryHeader)) + _component * n;
+  }
+
+  /**
+   * @brief Yields one column of the fixes
+   * @param _component 0, 1 or 2 for dfx, dfy or dfz, or a column of
+   * a term (see `term_column`)
+   * @return A pointer to the `n` values of the column
+   */
+  const double *column(const size_t &_component) const
+  {
+    return reinterpret_cast<const double *>(data() + sizeof(BinaryHeader)) + _component * n;
+  }
+};
+
+/**
+ * @brief Yields the size of the packet the staged atoms travel as,
+ * at their precision
+ * @param _atoms The staged atoms
+ * @return The size in bytes, header included
+ */
+size_t packed_size(const AtomBuffer &_atoms);
+
+/**
+ * @brief Yields the size of the packet the fixes travel as, at
+ * their precision
+ * @param _fixes The fixes
+ * @return The size in bytes, header included
+ */
+size_t packed_size(const FixBuffer &_fixes);
+
+/**
+ * @brief Writes the staged atoms as a packet at their precision.
+ * Beyond the header (copied as is), each column is written in turn:
+ * As `n` doubles, `n` floats, or (quantized) a double holding its
+ * least value and a double holding the step between integers,
+ * followed by `n` 16-bit integers. Each column is padded with zeros
+ * to a multiple of 8 bytes.
+ * @param _from The staged atoms
+ * @param _into Where to write the packet, with room for
+ * `packed_size` bytes
+ */
+void pack(const AtomBuffer &_from, char *_into);
+
+/**
+ * @brief Reads staged atoms back from a packet written by `pack`
+ * @param _from The packet
+ * @param _into Where to stage the atoms, already sized to match the
+ * packet's header, and at its precision
+ */
+void unpack(const char *_from, AtomBuffer &_into);
+
+/**
+ * @brief Writes fixes as a packet at their precision, as `pack`
+ * does atoms
+ * @param _from The fixes
+ * @param _into Where to write the packet, with room for
+ * `packed_size` bytes
+ */
+void pack(const FixBuffer &_from, char *_into);
+
+/**
+ * @brief Reads fixes back from a packet written by `pack`
+ * @param _from The packet
+ * @param _into Where to hold the fixes, already sized to match the
+ * packet's header, and at its precision
+ */
+void unpack(const char *_from, FixBuffer &_into);
+
+/**
+ * @struct AtomDelta
+ * @brief A worker's side of incremental requests (see `fix arbfn
+ * ... mode delta`). Each request only carries the atoms which are
+ * new, or which changed by more than `tolerance` in any value since
+ * they were last sent, plus the tags of atoms which have gone. Both
+ * sides keep the atoms as last sent, sorted by tag, and responses
+ * cover all of them in that order. Atoms must include their IDs.
+ *
+ * In a binary delta packet, the `BinaryHeader` (of `type` 4, with
+ * `n` the number of atoms sent) is followed by their columns as in
+ * a request, then by the departed tags as doubles.
+ * @var AtomDelta::tolerance The largest change in any value which
+ * is not sent
+ * @var AtomDelta::snapshot The atoms as last sent, sorted by tag
+ * @var AtomDelta::changed The atoms to send, sorted by tag
+ * @var AtomDelta::left The tags of the atoms which have gone, in
+ * ascending order
+ */
+struct AtomDelta {
+  double tolerance = 0.0;
+  AtomBuffer snapshot, changed;
+  std::vector<double> left;
+
+  // Reused scratch space
+  AtomBuffer merged;
+  std::vector<size_t> order, rows;
+
+  /**
+   * @brief Forgets every atom sent, EG after re-registering
+   */
+  void clear()
+  {
+    snapshot.resize(0, 0);
+    changed.resize(0, 0);
+    left.clear();
+  }
+};
+
+/**
+ * @brief Finds the changes between the atoms last sent and the
+ * current ones, then takes the current ones as sent
+ * @param _current The current atoms, in any order, with IDs
+ * @param _delta Where to save the changes
+ */
+void stage_delta(const AtomBuffer &_current, AtomDelta &_delta);
+
+/**
+ * @brief Applies a delta to a copy of the atoms last sent, as kept
+ * by both workers and controllers
+ * @param _mirror The atoms last sent, sorted by tag, to be updated
+ * @param _changed The atoms sent, sorted by tag
+ * @param _left The tags of the atoms which have gone, ascending
+ * @param _num_left The number of such tags
+ * @param _scratch Space in which to merge them
+ * @return True on success, false if the fields do not match
+ */
+bool apply_delta(AtomBuffer &_mirror, const AtomBuffer &_changed, const double *_left,
+                 const size_t &_num_left, AtomBuffer &_scratch);
+
+/**
+ * @struct Migration
+ * @brief A worker's record of which atoms it holds, by tag, so that
+ * it can tell the controller which arrived and which left (see
+ * `notify_migration`). Controllers may then keep per-atom state
+ * across steps, and across ranks as atoms migrate.
+ * @var Migration::enabled Whether the controller agreed to be told
+ * @var Migration::held The tags held as of the last notification,
+ * in ascending order
+ * @var Migration::arrived The tags which arrived in the last
+ * notification, in ascending order
+ * @var Migration::left The tags which left in the last
+ * notification, in ascending order
+ */
+struct Migration {
+  bool enabled = false;
+  std::vector<double> held, arrived, left;
+
+  // Reused scratch space
+  std::vector<double> current;
+
+  /**
+   * @brief Forgets every atom held, EG after re-registering
+   */
+  void clear()
+  {
+    held.clear();
+    arrived.clear();
+    left.clear();
+  }
+};
+
+/**
+ * @struct ForceGrid
+ * @brief Force deltas tabulated on a regular grid of nodes spanning
+ * a box, from which workers in grid mode interpolate. The nodes
+ * include both corners of the box. A dimension with a single node
+ * is constant, EG `dims[2] = 1` for 2D systems.
+ *
+ * Controllers send grids one tile at a time (see `TileCache`), each
+ * tile being a grid of its own. In a binary grid packet, the
+ * `BinaryHeader` (with `n` the number of nodes) is followed by ten
+ * doubles (`dims`, `lo`, `hi` and the tile's index), then the
+ * `dfx`, `dfy` and `dfz` columns, each of `n` doubles.
+ * @var ForceGrid::dims The number of nodes along each axis
+ * @var ForceGrid::lo The lower corner of the box
+ * @var ForceGrid::hi The upper corner of the box
+ * @var ForceGrid::values The three columns, each indexed by
+ * `index`, one after another
+ */
+struct ForceGrid {
+  uint64_t dims[3] = {0, 0, 0};
+  double lo[3] = {0.0, 0.0, 0.0};
+  double hi[3] = {0.0, 0.0, 0.0};
+  std::vector<double> values;
+
+  /**
+   * @brief Sets the number of nodes along each axis. Any previous
+   * values are invalidated.
+   */
+  void resize(const uint64_t &_nx, const uint64_t &_ny, const uint64_t &_nz)
+  {
+    dims[0] = _nx;
+    dims[1] = _ny;
+    dims[2] = _nz;
+    values.resize(3 * size());
+  }
+
+  /**
+   * @brief Yields the number of nodes
+   */
+  size_t size() const { return dims[0] * dims[1] * dims[2]; }
+
+  /**
+   * @brief Yields the position of a node within each column
+   */
+  size_t index(const size_t &_i, const size_t &_j, const size_t &_k) const
+  {
+    return _i + dims[0] * (_j + dims[1] * _k);
+  }
+
+  /**
+   * @brief Yields the position of the given node along an axis
+   */
+  double node(const size_t &_axis, const size_t &_i) const
+  {
+    if (dims[_axis] < 2) { return lo[_axis]; }
+    return lo[_axis] + _i * (hi[_axis] - lo[_axis]) / (dims[_axis] - 1);
+  }
+
+  /**
+   * @brief Yields one component column of the force deltas
+   * @param _component 0, 1 or 2 for dfx, dfy or dfz
+   */
+  double *column(const size_t &_component) { return values.data() + _component * size(); }
+
+  /**
+   * @brief Yields one component column of the force deltas
+   * @param _component 0, 1 or 2 for dfx, dfy or dfz
+   */
+  const double *column(const size_t &_component) const
+  {
+    return values.data() + _component * size();
+  }
+};
+
+/**
+ * @struct TileCache
+ * @brief The tiles of a controller's grid held by a worker in grid
+ * mode. The grid is cut into tiles of `tile_size` nodes along each
+ * axis (fewer at its upper faces), numbered with x varying fastest.
+ * Only the tiles around the worker's own region are fetched, and
+ * are assembled into `local` for interpolation.
+ * @var TileCache::layout The `dims`, `lo` and `hi` of the whole
+ * grid, without values
+ * @var TileCache::tile_size The number of nodes along each axis of
+ * a tile
+ * @var TileCache::tiles The cached tiles, by index
+ * @var TileCache::local The cached tiles as a single grid
+ * @var TileCache::tile_lo The first cached tile along each axis
+ * @var TileCache::tile_hi The last cached tile along each axis
+ */
+struct TileCache {
+  ForceGrid layout;
+  uint64_t tile_size = 0;
+  std::map<uint64_t, ForceGrid> tiles;
+  ForceGrid local;
+  uint64_t tile_lo[3] = {0, 0, 0};
+  uint64_t tile_hi[3] = {0, 0, 0};
+
+  /**
+   * @brief Forgets all tiles, EG after re-registering
+   */
+  void clear()
+  {
+    tiles.clear();
+    local.resize(0, 0, 0);
+  }
+};
+
+/**
+ * @brief Yields the number of tiles along an axis of a grid
+ * @param _grid The grid (only its `dims` are used)
+ * @param _tile_size The number of nodes along each axis of a tile
+ * @param _axis The axis
+ */
+uint64_t tiles_along(const ForceGrid &_grid, const uint64_t &_tile_size, const size_t &_axis);
+
+/**
+ * @brief Copies one tile out of a grid, as a grid of its own
+ * @param _grid The whole grid
+ * @param _tile_size The number of nodes along each axis of a tile
+ * @param _tile The index of the tile
+ * @param _into Where to save the tile
+ */
+void extract_tile(const ForceGrid &_grid, const uint64_t &_tile_size, const uint64_t &_tile,
+                  ForceGrid &_into);
+
+/**
+ * @struct WaitStats
+ * @brief Latency statistics over a number of waits
+ * @var WaitStats::count The number of waits recorded
+ * @var WaitStats::total_us The sum of all wait times
+ * @var WaitStats::total_sq_us The sum of all squared wait times
+ * @var WaitStats::min_us The shortest wait
+ * @var WaitStats::max_us The longest wait
+ */
+struct WaitStats {
+  uint64_t count = 0;
+  double total_us = 0.0;
+  double total_sq_us = 0.0;
+  double min_us = 0.0;
+  double max_us = 0.0;
+
+  /**
+   * @brief Records a single wait
+   * @param _us The length of the wait in microseconds
+   */
+  void record(const double &_us)
+  {
+    min_us = (count == 0 || _us < min_us) ? _us : min_us;
+    max_us = (count == 0 || _us > max_us) ? _us : max_us;
+    total_us += _us;
+    total_sq_us += _us * _us;
+    ++count;
+  }
+
+  /**
+   * @brief Forgets all recorded waits
+   */
+  void clear() { *this = WaitStats(); }
+};
+
+/**
+ * @class Waiter
+ * @brief Paces the polling loops which await the controller
+ * according to an `ARBFNWait` strategy, enforces the max delay and
+ * records how long each wait took. A wait is bracketed by `start`
+ * and `stop`; in between, polling loops call `idle` whenever a
+ * poll comes up empty (never in the blocking strategy).
+ */
+class Waiter {
+ public:
+  /**
+   * @brief Creates a waiter using the given strategy
+   * @param _strategy The strategy to use
+   */
+  Waiter(const ARBFNWait &_strategy = ARBFN_WAIT_BACKOFF);
+  ~Waiter();
+
+  Waiter(const Waiter &) = delete;
+  Waiter &operator=(const Waiter &) = delete;
+
+  /**
+   * @brief Begins timing a wait
+   * @param _max_ms The max number of ms to wait, or 0 for no limit
+   */
+  void start(const double &_max_ms);
+
+  /**
+   * @brief Notes that a packet arrived but the wait goes on (EG a
+   * "waiting" packet), restarting the timeout and the backoff
+   */
+  void progress();
+
+  /**
+   * @brief Called when a poll comes up empty: Backs off according
+   * to the strategy, then checks the timeout
+   * @return False if the wait has timed out, true otherwise
+   */
+  bool idle();
+
+  /**
+   * @brief Ends the current wait, recording its length
+   */
+  void stop();
+
+  /// The strategy in use. Must not change during a wait.
+  ARBFNWait strategy;
+
+  /// Statistics over all completed waits
+  WaitStats stats;
+
+ protected:
+  /// Body of the watchdog thread used by the blocking strategy
+  void watch();
+
+  std::chrono::steady_clock::time_point start_time, progress_time;
+  double max_ms;
+  uint64_t idle_count;
+
+  // Watchdog state
+  std::thread watchdog;
+  std::mutex watchdog_mutex;
+  std::condition_variable watchdog_cv;
+  std::chrono::steady_clock::time_point deadline;
+  bool armed, quitting;
+};
+
+/**
+ * @brief Yields the waiter used when none is specified. It uses
+ * the backoff strategy.
+ * @return A process-wide default waiter
+ */
+Waiter &default_waiter();
+
+/**
+ * @struct InterchangeStats
+ * @brief Where the time and traffic of interchanges went. The
+ * interchange functions fill in everything but `gather_s` and
+ * `scatter_s`, which are left to the caller.
+ * @var InterchangeStats::gather_s Seconds spent staging atoms
+ * @var InterchangeStats::serialize_s Seconds spent encoding requests
+ * @var InterchangeStats::send_s Seconds spent handing requests to MPI
+ * @var InterchangeStats::wait_s Seconds spent awaiting responses,
+ * less the time spent parsing packets
+ * @var InterchangeStats::parse_s Seconds spent decoding packets
+ * @var InterchangeStats::scatter_s Seconds spent applying fixes
+ * @var InterchangeStats::bytes_sent Request bytes sent
+ * @var InterchangeStats::bytes_received Bytes received, including
+ * "waiting" packets
+ * @var InterchangeStats::waiting_packets "waiting" packets received
+ * @var InterchangeStats::interchanges Interchanges finished
+ */
+struct InterchangeStats {
+  double gather_s = 0.0;
+  double serialize_s = 0.0;
+  double send_s = 0.0;
+  double wait_s = 0.0;
+  double parse_s = 0.0;
+  double scatter_s = 0.0;
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_received = 0;
+  uint64_t waiting_packets = 0;
+  uint64_t interchanges = 0;
+
+  /**
+   * @brief Adds another set of statistics to these
+   * @param _other The statistics to add
+   */
+  void add(const InterchangeStats &_other)
+  {
+    gather_s += _other.gather_s;
+    serialize_s += _other.serialize_s;
+    send_s += _other.send_s;
+    wait_s += _other.wait_s;
+    parse_s += _other.parse_s;
+    scatter_s += _other.scatter_s;
+    bytes_sent += _other.bytes_sent;
+    bytes_received += _other.bytes_received;
+    waiting_packets += _other.waiting_packets;
+    interchanges += _other.interchanges;
+  }
+
+  /**
+   * @brief Forgets all recorded statistics
+   */
+  void clear() { *this = InterchangeStats(); }
+};
+
+/**
+ * @brief Where the request packet lies within a `SharedSegment`
+ */
+const static size_t ARBFN_SHARED_REQUEST_OFFSET = 64;
+
+/**
+ * @brief Finds where the response packet lies within a
+ * `SharedSegment`: Just past the request, on a 64-byte boundary
+ * @param _request_bytes The size of the request packet
+ * @return The offset of the response packet
+ */
+inline size_t shared_response_offset(const size_t &_request_bytes)
+{
+  return ARBFN_SHARED_REQUEST_OFFSET + (_request_bytes + 63) / 64 * 64;
+}
+
+/**
+ * @struct SharedDoorbell
+ * @brief Tells a controller that a request awaits in the segment it
+ * shares with a worker, which sends it as a binary packet
+ * @var SharedDoorbell::header A copy of the request's header
+ * @var SharedDoorbell::bytes The size of the request packet,
+ * including any departed tags
+ */
+struct SharedDoorbell {
+  BinaryHeader header;
+  uint64_t bytes;
+};
+
+/**
+ * @class SharedSegment
+ * @brief A block of POSIX shared memory through which a worker and
+ * a controller on the same node pass binary packets, in
+ * `ARBFN_FORMAT_SHARED`. The worker writes its request at
+ * `ARBFN_SHARED_REQUEST_OFFSET`, then sends a `SharedDoorbell` over
+ * MPI. The controller reads the atoms and writes the fixes in
+ * place, at `shared_response_offset`, then sends just the
+ * response's `BinaryHeader` back. Neither side touches the segment
+ * while the other holds it. Its first 8 bytes hold a random token,
+ * so that a controller can tell the segment apart from any other of
+ * the same name (EG on another node).
+ *
+ * The worker creates the segment as it registers, and unlinks its
+ * name once the controller has answered, so nothing is left behind
+ * in `/dev/shm` if either side dies.
+ */
+class SharedSegment {
+ public:
+  SharedSegment();
+
+  /**
+   * @brief Unmaps and closes the segment, if any
+   */
+  ~SharedSegment();
+
+  SharedSegment(const SharedSegment &) = delete;
+  SharedSegment &operator=(const SharedSegment &) = delete;
+
+  /**
+   * @brief Creates a new segment under a fresh name and token, from
+   * a worker. Any segment held is closed first.
+   * @param _size The size to start with, in bytes
+   * @return True on success, false on failure
+   */
+  bool create(const size_t &_size);
+
+  /**
+   * @brief Opens a worker's segment, from a controller. Any segment
+   * held is closed first.
+   * @param _name The name of the segment
+   * @param _token The token the worker announced
+   * @return True on success, false if there is no such segment on
+   * this node, or if its token differs
+   */
+  bool open(const std::string &_name, const uint64_t &_token);
+
+  /**
+   * @brief Makes sure that at least the given number of bytes are
+   * mapped. The worker which created the segment grows it as
+   * needed, while a controller maps however far it has been grown.
+   * @param _size The number of bytes needed
+   * @return True on success, false on failure
+   */
+  bool reserve(const size_t &_size);
+
+  /**
+   * @brief Removes the segment's name, leaving it mapped
+   */
+  void unlink();
+
+  /**
+   * @brief Unmaps and closes the segment, if any. A worker's segment
+   * is unlinked as well.
+   */
+  void close();
+
+  /**
+   * @brief Yields the start of the mapped segment
+   */
+  char *data() { return base; }
+
+  /**
+   * @brief Whether a segment is held
+   */
+  bool is_open() const { return base != nullptr; }
+
+  /// The name of the segment, as passed to `shm_open`
+  std::string name;
+
+  /// The token which identifies the segment
+  uint64_t token;
+
+ protected:
+  int fd;
+  char *base;
+  size_t size;
+  bool is_owner, is_linked;
+};
+
+/**
+ * @struct PendingInterchange
+ * @brief The state of an interchange which has been begun, but not
+ * yet finished. The buffers it was begun with must not be touched
+ * until it is finished.
+ * @var PendingInterchange::active Whether an interchange is pending
+ * @var PendingInterchange::format The wire format in use
+ * @var PendingInterchange::n The number of atoms sent
+ * @var PendingInterchange::max_ms The max ms to await the response
+ * @var PendingInterchange::controller_rank The rank of the controller
+ * @var PendingInterchange::comm The MPI communicator in use
+ * @var PendingInterchange::send_request The nonblocking send
+ * @var PendingInterchange::recv_request The nonblocking receive
+ * (binary format only)
+ * @var PendingInterchange::size_request The nonblocking gather of
+ * the request's size (collective format only)
+ * @var PendingInterchange::bytes The size of the request being
+ * gathered (collective format only)
+ * @var PendingInterchange::waiter The waiter pacing the response
+ * @var PendingInterchange::stats The time and traffic of this
+ * interchange so far, cleared when it is begun
+ * @var PendingInterchange::segment The segment shared with the
+ * controller (shared format only)
+ * @var PendingInterchange::doorbell The doorbell being sent (shared
+ * format only)
+ */
+struct PendingInterchange {
+  bool active = false;
+  ARBFNFormat format = ARBFN_FORMAT_JSON;
+  size_t n = 0;
+  double max_ms = 0.0;
+  uint controller_rank = 0;
+  MPI_Comm comm = MPI_COMM_NULL;
+  MPI_Request send_request = MPI_REQUEST_NULL;
+  MPI_Request recv_request = MPI_REQUEST_NULL;
+  MPI_Request size_request = MPI_REQUEST_NULL;
+  uint64_t bytes = 0;
+  Waiter *waiter = nullptr;
+  InterchangeStats stats;
+  SharedSegment *segment = nullptr;
+  SharedDoorbell doorbell;
+};
+
+/**
+ * @struct MultiplexPart
+ * @brief Precedes each part of a multiplexed binary packet, which
+ * carries a request (or response) for each of several fixes on one
+ * worker. The packet's `BinaryHeader` (of `type` 5, with `n` the
+ * number of parts) is followed by each part in turn: This, then the
+ * part's own packet, as it would otherwise have travelled alone.
+ * Responses hold the parts of their request, in the same order.
+ * @var MultiplexPart::fix The position of the part's fix within the
+ * registration
+ * @var MultiplexPart::bytes The size of the part's packet
+ */
+struct MultiplexPart {
+  uint64_t fix;
+  uint64_t bytes;
+};
+
+/**
+ * @struct MultiplexedFix
+ * @brief One of several fixes on a worker (EG `fix arbfn` instances)
+ * which register together, then send a single request per step for
+ * all of those due (see the multiplexed `send_registration` and
+ * `interchange`). They use request mode, and values travel as
+ * doubles.
+ * @var MultiplexedFix::id The fix's ID, which tags its part of JSON
+ * packets
+ * @var MultiplexedFix::fields The per-atom fields it sends
+ * @var MultiplexedFix::terms The `ARBFNTerm`s it asks for, then those
+ * the controller agreed to
+ * @var MultiplexedFix::atoms Its staged atoms
+ * @var MultiplexedFix::fixes Where to receive its fixes, holding the
+ * terms agreed to
+ * @var MultiplexedFix::sent The prefix of its part of the latest
+ * binary request
+ * @var MultiplexedFix::received The prefix of its part of the latest
+ * binary response
+ */
+struct MultiplexedFix {
+  std::string id;
+  uint64_t fields = ARBFN_DEFAULT_FIELDS;
+  uint64_t terms = 0;
+  AtomBuffer *atoms = nullptr;
+  FixBuffer *fixes = nullptr;
+  MultiplexPart sent, received;
+};
+
+/**
+ * @brief Makes an MPI datatype spanning pieces of memory which lie
+ * apart, in order, so that a packet made of them (EG a multiplexed
+ * one) is sent or received in place rather than assembled. Send or
+ * receive one of it at `MPI_BOTTOM`, then free it.
+ * @param _pieces The address and size of each piece
+ * @return The datatype, committed
+ */
+MPI_Datatype scattered_type(const std::vector<std::pair<const void *, size_t>> &_pieces);
+
 /**
  * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
  * @param _n The number of atoms/fixes in the arrays.
@@ -63,18 +1271,247 @@ struct FixData {
  * @param _max_ms The max number of milliseconds to await each response
  * @param _controller_rank The rank of the controller within the provided communicator
  * @param _comm The MPI communicator to use
+ * @param _format The wire format negotiated at registration
  * @returns true on success, false on failure
  */
 bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
-                 const uint &_controller_rank, MPI_Comm &_comm);
+                 const uint &_controller_rank, MPI_Comm &_comm,
+                 const ARBFNFormat &_format = ARBFN_FORMAT_JSON);
+
+/**
+ * @brief Send the staged atom data, then receive the fix data in
+ * place. This is blocking, but does not allow worker-side
+ * gridlocks. Neither buffer allocates once it has grown to size.
+ * @param _from The staged atoms to send
+ * @param _into The buffer to receive fix data into
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use. In the collective
+ * format, the group made by `send_registration`, in which the
+ * controller is rank 0.
+ * @param _format The wire format negotiated at registration
+ * @param _waiter The waiter with which to await the response
+ * @param _stats If not null, where to add the time and traffic of
+ * this interchange
+ * @param _segment The segment shared with the controller, as set up
+ * by `send_registration`. Needed in the shared format only.
+ * @returns true on success, false on failure
+ */
+bool interchange(AtomBuffer &_from, FixBuffer &_into, const double &_max_ms,
+                 const uint &_controller_rank, MPI_Comm &_comm,
+                 const ARBFNFormat &_format = ARBFN_FORMAT_JSON,
+                 Waiter &_waiter = default_waiter(), InterchangeStats *_stats = nullptr,
+                 SharedSegment *_segment = nullptr);
+
+/**
+ * @brief As above, but sends only the changes staged by
+ * `stage_delta`. The fixes received are for every atom of the
+ * snapshot, in its order (sorted by tag).
+ */
+bool interchange(AtomDelta &_from, FixBuffer &_into, const double &_max_ms,
+                 const uint &_controller_rank, MPI_Comm &_comm,
+                 const ARBFNFormat &_format = ARBFN_FORMAT_JSON,
+                 Waiter &_waiter = default_waiter(), InterchangeStats *_stats = nullptr,
+                 SharedSegment *_segment = nullptr);
+
+/**
+ * @brief Begins an interchange: Sends the staged atom data without
+ * blocking and, for the binary format, posts the receive for the
+ * response directly into `_into`. Neither buffer may be touched
+ * until `finish_interchange` is called.
+ * @param _from The staged atoms to send
+ * @param _into The buffer to receive fix data into
+ * @param _max_ms The max number of milliseconds `finish_interchange` will await the response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use (the group, in the
+ * collective format)
+ * @param _format The wire format negotiated at registration
+ * @param _pending Where to save the state of the interchange
+ * @param _waiter The waiter with which `finish_interchange` will await the response
+ * @param _segment The segment shared with the controller. Needed in
+ * the shared format only, and must not be touched until
+ * `finish_interchange` is called.
+ * @returns true on success, false on failure
+ */
+bool begin_interchange(AtomBuffer &_from, FixBuffer &_into, const double &_max_ms,
+                       const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                       PendingInterchange &_pending, Waiter &_waiter = default_waiter(),
+                       SharedSegment *_segment = nullptr);
+
+/**
+ * @brief As above, but sends only the changes staged by
+ * `stage_delta`, and awaits fixes for every atom of the snapshot
+ */
+bool begin_interchange(AtomDelta &_from, FixBuffer &_into, const double &_max_ms,
+                       const uint &_controller_rank, MPI_Comm &_comm, const ARBFNFormat &_format,
+                       PendingInterchange &_pending, Waiter &_waiter = default_waiter(),
+                       SharedSegment *_segment = nullptr);
+
+/**
+ * @brief Finishes an interchange begun by `begin_interchange`,
+ * blocking until the fix data has been received. This does not
+ * allow worker-side gridlocks. Afterwards, `_pending.stats` holds
+ * the time and traffic of the whole interchange.
+ * @param _into The buffer which was passed to `begin_interchange`
+ * @param _pending The pending interchange
+ * @returns true on success, false on failure
+ */
+bool finish_interchange(FixBuffer &_into, PendingInterchange &_pending);
+
+/**
+ * @brief Sends the staged atoms of some of several fixes registered
+ * together as a single request, then receives each of their fixes
+ * in place from a single response. This is blocking, but does not
+ * allow worker-side gridlocks. In the JSON format, the text of both
+ * travels in the `packed` buffers of the first part.
+ * @param _fixes The fixes, as registered
+ * @param _parts The positions of those to send, in ascending order.
+ * Each must have its `atoms` staged, and its `fixes` set to the
+ * terms agreed to.
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _format The wire format negotiated at registration: JSON
+ * or binary
+ * @param _waiter The waiter with which to await the response
+ * @param _stats If not null, where to add the time and traffic of
+ * this interchange
+ * @returns true on success, false on failure
+ */
+bool interchange(std::vector<MultiplexedFix> &_fixes, const std::vector<size_t> &_parts,
+                 const double &_max_ms, const uint &_controller_rank, MPI_Comm &_comm,
+                 const ARBFNFormat &_format, Waiter &_waiter = default_waiter(),
+                 InterchangeStats *_stats = nullptr);
+
+/**
+ * @brief Finds the controllers and picks one, from a worker. Every
+ * rank of the ARBFN comm must take part in discovery exactly once,
+ * right after splitting it off: Workers call this, controllers call
+ * `discover_workers`. The ARBFN comm must have been split using
+ * `ARBFN_MPI_KEY_WORKER`.
+ * @param _controller_rank Where to save the rank of the controller
+ * @param _comm The ARBFN communicator
+ * @param _position Where this worker lies, from 0 to 1: Workers
+ * are split evenly among controllers by position. If negative,
+ * they are dealt out to controllers in rank order instead.
+ * @return True on success, false if there are no controllers
+ */
+bool discover_controller(uint &_controller_rank, MPI_Comm &_comm,
+                         const double &_position = -1.0);
+
+/**
+ * @brief Takes part in discovery from a controller, yielding the
+ * number of workers which picked it. The ARBFN comm must have been
+ * split using `ARBFN_MPI_KEY_CONTROLLER`.
+ * @param _comm The ARBFN communicator
+ * @param _num_controllers Where to save the number of controllers,
+ * which hold ranks 0 through `_num_controllers - 1`
+ * @return The number of workers which will register with this
+ * controller
+ */
+uint discover_workers(MPI_Comm &_comm, uint &_num_controllers);
 
 /**
  * @brief Sends a registration packet to the controller.
- * @param _controller_rank The rank of the controller instance
+ * @param _controller_rank The rank of the controller instance, as
+ * found by `discover_controller`
+ * @param _comm The communicator to use
+ * @return True on success, false on error.
+ */
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm);
+
+/**
+ * @brief Sends a registration packet to the controller, requesting
+ * the given wire format. If the controller does not confirm the
+ * format in its `ack`, JSON is used.
+ * @param _controller_rank The rank of the controller instance, as
+ * found by `discover_controller`
+ * @param _comm The communicator to use
+ * @param _format The requested format. Overwritten with the format
+ * the controller agreed to.
+ * @param _fields The per-atom fields which requests will carry
+ * @return True on success, false on error.
+ */
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       const uint64_t &_fields = ARBFN_DEFAULT_FIELDS);
+
+/**
+ * @brief Sends a registration packet to the controller, requesting
+ * the given wire format and mode. If the controller does not
+ * confirm either in its `ack`, JSON and request mode are used. In
+ * grid mode, follow this with `fetch_tiles`.
+ * @param _controller_rank The rank of the controller instance, as
+ * found by `discover_controller`
  * @param _comm The communicator to use
+ * @param _format The requested format. Overwritten with the format
+ * the controller agreed to.
+ * @param _fields The per-atom fields which requests will carry
+ * @param _mode The requested mode. Overwritten with the mode the
+ * controller agreed to.
+ * @param _cache Where to save the layout of the grid announced in
+ * the `ack`, in grid mode. Any cached tiles are forgotten.
+ * @param _migration If given, and IDs are among the fields outside
+ * grid mode, asks to notify the controller of migration. Saves
+ * whether it agreed, and forgets every atom held.
+ * @param _terms If given, asks for these `ARBFNTerm`s to follow
+ * each force delta, outside grid mode. Overwritten with those the
+ * controller agreed to, which fix buffers must then hold (see
+ * `FixBuffer::set_terms`).
+ * @param _segment Where to create the segment to share with the
+ * controller, when requesting the shared format. Without it, the
+ * binary format is requested instead. Closed again unless the
+ * controller agrees, EG because it runs on another node, in which
+ * case the binary format is used.
+ * @param _group Where to save the group of the controller and its
+ * collective workers, when requesting the collective format in
+ * request mode. Without it, the binary format is requested instead.
+ * Made once every worker has registered with the controller, then
+ * kept when re-registering.
+ * @param _precision If given, asks for binary packets to travel at
+ * this precision, outside grid mode. Overwritten with the precision
+ * the controller agreed to (double unless it agrees, or in JSON),
+ * at which atom and fix buffers must then be.
  * @return True on success, false on error.
  */
-bool send_registration(uint &_controller_rank, MPI_Comm &_comm);
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       const uint64_t &_fields, ARBFNMode &_mode, TileCache *_cache = nullptr,
+                       Migration *_migration = nullptr, uint64_t *_terms = nullptr,
+                       SharedSegment *_segment = nullptr, MPI_Comm *_group = nullptr,
+                       ARBFNPrecision *_precision = nullptr);
+
+/**
+ * @brief Sends a registration packet for several fixes at once,
+ * which then interchange together (see `MultiplexedFix`). Only
+ * controllers built on the library serve them.
+ * @param _controller_rank The rank of the controller instance, as
+ * found by `discover_controller`
+ * @param _comm The communicator to use
+ * @param _format The requested format: JSON, or binary (which the
+ * shared and collective ones fall back on). Overwritten with the
+ * format the controller agreed to.
+ * @param _fixes The fixes, numbered in this order. Their terms are
+ * overwritten with those the controller agreed to.
+ * @return True on success, false on error, including if the
+ * controller does not serve several fixes per worker
+ */
+bool send_registration(const uint &_controller_rank, MPI_Comm &_comm, ARBFNFormat &_format,
+                       std::vector<MultiplexedFix> &_fixes);
+
+/**
+ * @brief Tells the controller which atoms have arrived at this
+ * worker and which have left it since the last call, if any have.
+ * Call it before sending a request for the same atoms, EG whenever
+ * atoms may have migrated. Does nothing unless the controller agreed
+ * to be told at registration.
+ * @param _atoms The atoms about to be sent, in any order, with IDs
+ * @param _migration The worker's record of the atoms it holds
+ * @param _controller_rank The rank of the controller
+ * @param _comm The communicator to use
+ * @param _stats Where to count the bytes sent, if anywhere
+ */
+void notify_migration(const AtomBuffer &_atoms, Migration &_migration,
+                      const uint &_controller_rank, MPI_Comm &_comm,
+                      InterchangeStats *_stats = nullptr);
 
 /**
  * @brief Sends a deregistration packet to the controller.
@@ -83,4 +1520,72 @@ bool send_registration(uint &_controller_rank, MPI_Comm &_comm);
  */
 void send_deregistration(const int &_controller_rank, MPI_Comm &_comm);
 
+/**
+ * @brief Sends a deregistration packet to the controller. In grid
+ * mode, then discards any grids still in flight until the
+ * controller acknowledges, so that none are left unreceived.
+ * @param _controller_rank The MPI rank of the controller
+ * @param _comm The communicator to use
+ * @param _mode The mode agreed upon at registration
+ * @param _group If given and not null, the group to leave (and
+ * free) first. All collective workers of a controller must leave
+ * together, as they took part in each interchange together.
+ */
+void send_deregistration(const int &_controller_rank, MPI_Comm &_comm, const ARBFNMode &_mode,
+                         MPI_Comm *_group = nullptr);
+
+/**
+ * @brief Encodes a tile of a grid as a packet in the given format,
+ * for controllers to send with the matching tag.
+ * @param _tile The tile to encode, as from `extract_tile`
+ * @param _index The index of the tile
+ * @param _format The wire format of the packet
+ * @param _into Where to save the packet
+ */
+void encode_grid(const ForceGrid &_tile, const uint64_t &_index, const ARBFNFormat &_format,
+                 std::vector<char> &_into);
+
+/**
+ * @brief Makes sure that the tiles covering a box are cached,
+ * fetching those which are not from the controller and dropping
+ * those no longer needed, then reassembles `local`. Does nothing if
+ * the box still needs the same tiles. Atoms which stray outside the
+ * box may take the values at its faces, so it should include a
+ * margin.
+ * @param _cache The cache, as set up by `send_registration`
+ * @param _lo The lower corner of the box
+ * @param _hi The upper corner of the box
+ * @param _max_ms The max number of milliseconds to wait, or 0 for
+ * no limit
+ * @param _controller_rank The rank of the controller
+ * @param _comm The communicator to use
+ * @param _waiter The waiter with which to await the tiles
+ * @return True on success, false on failure
+ */
+bool fetch_tiles(TileCache &_cache, const double _lo[3], const double _hi[3],
+                 const double &_max_ms, const uint &_controller_rank, MPI_Comm &_comm,
+                 Waiter &_waiter = default_waiter());
+
+/**
+ * @brief Receives any tiles which the controller has pushed since
+ * the last call, without blocking, and updates the cache with them.
+ * @param _cache The cache to update
+ * @param _controller_rank The rank of the controller
+ * @param _comm The communicator to use
+ * @param _updated Where to save whether a tile arrived
+ * @return True on success, false if a bad packet was received
+ */
+bool poll_grid(TileCache &_cache, const uint &_controller_rank, MPI_Comm &_comm,
+               bool &_updated);
+
+/**
+ * @brief Interpolates the force deltas of some atoms from a grid,
+ * trilinearly. Atoms outside the grid take the values at its
+ * nearest face.
+ * @param _grid The grid to interpolate from
+ * @param _atoms The atoms, which must include positions
+ * @param _into Where to save the force deltas
+ */
+void interpolate(const ForceGrid &_grid, const AtomBuffer &_atoms, FixBuffer &_into);
+
 #endif
@@ -0,0 +1,10 @@
+'''
+A vectorized controller library for ARBFN, built on mpi4py and
+NumPy. See `arbfn.controller`.
+'''
+
+from .controller import (BulkRequestHandler, Controller, ProtocolError,
+                         RequestHandler, WorkerRequest)
+
+__all__ = ['BulkRequestHandler', 'Controller', 'ProtocolError',
+           'RequestHandler', 'WorkerRequest']
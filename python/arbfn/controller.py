@@ -0,0 +1,555 @@
+'''
+The reusable controller-side server for Python, mirroring the C++
+one in `ARBFN/controller.h`. It handles the communicator splits,
+discovery, registration in either wire format, "waiting" packets
+and shutdown, and hands each request to a callback as NumPy arrays.
+
+Binary requests are received straight into reused arrays, and
+responses sent straight out of them, via mpi4py's buffer
+interface, so no Python objects are made per atom. JSON requests
+must still be parsed, but are transcribed a column at a time.
+'''
+
+import json
+import math
+import sys
+from typing import Callable, Dict, List, Optional
+
+import numpy as np
+from mpi4py import MPI as mpi
+
+
+ARBFN_MPI_COLOR: int = 56789
+ARBFN_MPI_KEY_CONTROLLER: int = 0
+ARBFN_MPI_TAG_JSON: int = 0
+ARBFN_MPI_TAG_BINARY: int = 1
+
+ARBFN_BINARY_MAGIC: int = 0x46425241
+ARBFN_PACKET_REQUEST: int = 0
+ARBFN_PACKET_RESPONSE: int = 1
+ARBFN_PACKET_WAITING: int = 2
+
+# The header which begins every binary packet, in native byte order
+BINARY_HEADER = np.dtype([('magic', np.uint32), ('type', np.uint32),
+                          ('n', np.uint64), ('fields', np.uint64),
+                          ('expect_response', np.float64)])
+assert BINARY_HEADER.itemsize == 32
+
+# Each field's bit, name and per-atom JSON keys, in ascending bit
+# order
+FIELDS = [
+    (1, 'x', ('x', 'y', 'z')),
+    (2, 'v', ('vx', 'vy', 'vz')),
+    (4, 'f', ('fx', 'fy', 'fz')),
+    (8, 'mu', ('mux', 'muy', 'muz')),
+    (16, 'q', ('q',)),
+    (32, 'type', ('type',)),
+    (64, 'id', ('id',)),
+]
+ARBFN_DEFAULT_FIELDS: int = 1 | 2 | 4
+
+# Each term's bit, name and per-atom JSON keys, in ascending bit
+# order
+TERMS = [
+    (1, 'rates', ('dfx_dt', 'dfy_dt', 'dfz_dt')),
+    (2, 'energy', ('energy',)),
+    (4, 'virial', ('virial_xx', 'virial_yy', 'virial_zz',
+                   'virial_xy', 'virial_xz', 'virial_yz')),
+]
+
+
+class ProtocolError(RuntimeError):
+    '''
+    Raised when a worker breaks the protocol
+    '''
+
+
+class WorkerRequest:
+    '''
+    One worker's request, as handed to handlers. Every array is a
+    view into the controller's reused buffers, so is only valid
+    until the handler returns.
+    :ivar rank: The rank of the worker in the ARBFN communicator
+    :ivar index: The position of this request within its batch, for
+        bulk handlers
+    :ivar n: The number of atoms
+    :ivar atoms: The columns of each field which the worker sends,
+        by name (EG `'x'` or `'id'`): Arrays of shape `(3, n)` for
+        vector fields, and `(n,)` for scalar ones. Types and IDs are
+        held as doubles.
+    :ivar fixes: The force deltas to write, of shape `(3, n)`, zeroed
+    :ivar terms: The columns of each term which the worker asked
+        for, by name, to write: `'rates'` of shape `(3, n)`,
+        `'energy'` of shape `(n,)` and `'virial'` of shape `(6, n)`
+        (xx, yy, zz, xy, xz, yz), zeroed
+    '''
+
+    def __init__(self, rank: int, index: int, columns: np.ndarray,
+                 fields: int, fixes: np.ndarray, terms: int) -> None:
+        self.rank: int = rank
+        self.index: int = index
+        self.n: int = columns.shape[1]
+        self.atoms: Dict[str, np.ndarray] = {}
+        self.terms: Dict[str, np.ndarray] = {}
+        self.fixes: np.ndarray = fixes[0:3]
+
+        row: int = 0
+        for bit, name, keys in FIELDS:
+            if fields & bit:
+                width: int = len(keys)
+                self.atoms[name] = (columns[row] if width == 1
+                                    else columns[row:row + width])
+                row += width
+
+        row = 3
+        for bit, name, keys in TERMS:
+            if terms & bit:
+                width = len(keys)
+                self.terms[name] = (fixes[row] if width == 1
+                                    else fixes[row:row + width])
+                row += width
+
+
+RequestHandler = Callable[[WorkerRequest], None]
+BulkRequestHandler = Callable[[List[WorkerRequest]], None]
+
+
+def field_keys(fields: int) -> List[str]:
+    '''
+    Yields the per-atom JSON keys of the given fields, in the order
+    their columns are sent
+    :param fields: Bitwise OR of the fields
+    :returns: The key of each column
+    '''
+
+    return [key for bit, _, keys in FIELDS if fields & bit for key in keys]
+
+
+def term_keys(terms: int) -> List[str]:
+    '''
+    Yields the per-atom JSON keys of a response with the given terms,
+    in the order their columns are sent
+    :param terms: Bitwise OR of the terms
+    :returns: The key of each column, starting with the force deltas
+    '''
+
+    return ['dfx', 'dfy', 'dfz'] + [key for bit, _, keys in TERMS
+                                    if terms & bit for key in keys]
+
+
+def json_number(value: float) -> str:
+    '''
+    Writes a double as JSON text. JSON has no NaN or infinity, so
+    those are written as null, which workers reject as a missing
+    number.
+    :param value: The value to write
+    :returns: The text
+    '''
+
+    return repr(value) if math.isfinite(value) else 'null'
+
+
+def reserve(buffer: np.ndarray, size: int) -> np.ndarray:
+    '''
+    Yields a byte buffer of at least the given size, reusing the
+    given one if it is large enough
+    :param buffer: The buffer to reuse
+    :param size: The size needed, in bytes
+    :returns: The buffer to use
+    '''
+
+    if buffer.size >= size:
+        return buffer
+    return np.empty(max(size, 2 * buffer.size), dtype=np.uint8)
+
+
+class Worker:
+    '''
+    Everything known about one registered worker, along with its
+    reusable buffers
+    :ivar binary: Whether the worker agreed to the binary format
+    :ivar fields: The fields announced at registration
+    :ivar terms: The terms agreed to at registration
+    :ivar has_request: Whether a request awaits its response
+    :ivar packet: The latest request: A binary packet, or (in JSON)
+        the same layout transcribed from the text
+    :ivar n: The number of atoms in the latest request
+    :ivar response: The response packet, holding the fixes
+    '''
+
+    def __init__(self) -> None:
+        self.binary: bool = False
+        self.fields: int = ARBFN_DEFAULT_FIELDS
+        self.terms: int = 0
+        self.has_request: bool = False
+        self.packet: np.ndarray = np.empty(0, dtype=np.uint8)
+        self.n: int = 0
+        self.response: np.ndarray = np.empty(0, dtype=np.uint8)
+
+    def width(self) -> int:
+        '''
+        :returns: The number of columns of each response
+        '''
+
+        return len(term_keys(self.terms))
+
+    def columns(self) -> np.ndarray:
+        '''
+        :returns: The columns of the latest request, of shape
+            `(columns, n)`
+        '''
+
+        # The shape is given in full, as a rank may hold no atoms
+        columns: int = len(field_keys(self.fields))
+        size: int = 8 * columns * self.n
+        return self.packet[32:32 + size].view(np.float64).reshape(
+            columns, self.n)
+
+    def fixes(self) -> np.ndarray:
+        '''
+        :returns: The columns of the response, of shape `(width, n)`
+        '''
+
+        size: int = 8 * self.width() * self.n
+        return self.response[32:32 + size].view(np.float64).reshape(
+            self.width(), self.n)
+
+
+class Controller:
+    '''
+    Serves the workers which pick this controller until all of them
+    have deregistered. Only request mode is offered: Workers which
+    ask for grid mode get no grid (and stop), while those which ask
+    for delta mode, the shared or collective formats, reduced
+    precision or migration fall back to what is offered (binary
+    requests of doubles, without migration).
+    :ivar comm: The ARBFN communicator
+    :ivar peers: Connects all controllers (in rank order), for
+        reductions within bulk handlers. Every controller must then
+        serve at least one worker, so that all of them take part in
+        each reduction.
+    :ivar requests: The number of requests answered so far
+    '''
+
+    def __init__(self, allow_binary: bool = True) -> None:
+        '''
+        Performs both communicator splits expected of a controller,
+        then takes part in discovery
+        :param allow_binary: Whether to accept the binary wire format
+        '''
+
+        self.allow_binary: bool = allow_binary
+        self.requests: int = 0
+        self.workers: Dict[int, Worker] = {}
+        self.known_workers: set = set()
+
+        # Comm split 1 (LAMMPS internal: Useless to us)
+        self.junk_comm: mpi.Comm = mpi.COMM_WORLD.Split(0, 0)
+
+        # Comm split 2 (ARBFN alignment: Produced real comm)
+        self.comm: mpi.Comm = mpi.COMM_WORLD.Split(
+            ARBFN_MPI_COLOR, ARBFN_MPI_KEY_CONTROLLER)
+
+        # Discovery: Count the controllers, then the workers which
+        # picked each one
+        num_controllers = np.ones(1, dtype=np.intc)
+        self.comm.Allreduce(mpi.IN_PLACE, num_controllers, op=mpi.SUM)
+        counts = np.zeros(num_controllers[0], dtype=np.intc)
+        self.comm.Allreduce(mpi.IN_PLACE, counts, op=mpi.SUM)
+        self.num_expected: int = int(counts[self.comm.Get_rank()])
+
+        # Only the controllers, which hold the lowest ranks, take part
+        everyone: mpi.Group = self.comm.Get_group()
+        controllers: mpi.Group = everyone.Incl(list(range(num_controllers[0])))
+        self.peers: mpi.Comm = self.comm.Create_group(controllers, 0)
+        controllers.Free()
+        everyone.Free()
+
+    def free(self) -> None:
+        '''
+        Frees the communicators
+        '''
+
+        self.peers.Free()
+        self.comm.Free()
+        self.junk_comm.Free()
+
+    def serve(self, handler: RequestHandler) -> bool:
+        '''
+        Answers each request as soon as its fixes are ready, until all
+        workers have deregistered, then performs the final barrier
+        :param handler: Computes the fixes for each request
+        :returns: True on success, false on a protocol error
+        '''
+
+        try:
+            while not self.finished():
+                source: Optional[int] = self.receive()
+                if source is None:
+                    continue
+
+                worker: Worker = self.workers[source]
+                handler(self.request(source, worker, 0))
+                self.respond(source, worker)
+        except ProtocolError as error:
+            print(error, file=sys.stderr)
+            return False
+
+        # Final barrier, mirroring LAMMPS's own shutdown
+        mpi.COMM_WORLD.Barrier()
+        return True
+
+    def serve_bulk(self, handler: BulkRequestHandler) -> bool:
+        '''
+        Holds each request (sending "waiting" packets) until every
+        worker which picked this controller has registered and sent a
+        request, then answers them all at once. Continues until all
+        workers have deregistered, then performs the final barrier.
+        :param handler: Computes the fixes for all requests at once
+        :returns: True on success, false on a protocol error
+        '''
+
+        try:
+            while not self.finished():
+                source: Optional[int] = self.receive()
+
+                # Registrations and deregistrations may also complete a
+                # batch
+                num_pending: int = sum(worker.has_request
+                                       for worker in self.workers.values())
+                if num_pending == 0:
+                    continue
+                elif (num_pending != len(self.workers)
+                      or not self.all_registered()):
+                    if source is not None:
+                        self.send_waiting(source, self.workers[source])
+                    continue
+
+                batch: List[WorkerRequest] = [
+                    self.request(rank, self.workers[rank], index)
+                    for index, rank in enumerate(sorted(self.workers))]
+                handler(batch)
+                for request in batch:
+                    self.respond(request.rank, self.workers[request.rank])
+        except ProtocolError as error:
+            print(error, file=sys.stderr)
+            return False
+
+        # Final barrier, mirroring LAMMPS's own shutdown
+        mpi.COMM_WORLD.Barrier()
+        return True
+
+    def all_registered(self) -> bool:
+        '''
+        :returns: Whether every worker which picked this controller
+            has registered at least once
+        '''
+
+        return len(self.known_workers) >= self.num_expected
+
+    def finished(self) -> bool:
+        '''
+        :returns: Whether every worker has registered, then
+            deregistered
+        '''
+
+        return self.all_registered() and not self.workers
+
+    def request(self, rank: int, worker: Worker, index: int) -> WorkerRequest:
+        '''
+        Views a worker's latest request, with zeroed fixes
+        :param rank: The rank of the worker
+        :param worker: The worker
+        :param index: The position of the request within its batch
+        :returns: The request to hand to handlers
+        '''
+
+        fixes: np.ndarray = worker.fixes()
+        fixes.fill(0.0)
+        return WorkerRequest(rank, index, worker.columns(), worker.fields,
+                             fixes, worker.terms)
+
+    def receive(self) -> Optional[int]:
+        '''
+        Receives one packet and acts upon it
+        :returns: The rank of the worker which sent it, if it was a
+            request, else None
+        '''
+
+        status: mpi.Status = mpi.Status()
+        self.comm.Probe(mpi.ANY_SOURCE, mpi.ANY_TAG, status)
+        source: int = status.Get_source()
+        count: int = status.Get_count(mpi.BYTE)
+        worker: Optional[Worker] = self.workers.get(source)
+
+        # Binary packets are always requests, and land directly in
+        # columns
+        if status.Get_tag() == ARBFN_MPI_TAG_BINARY:
+            if worker is None:
+                self.comm.Recv([bytearray(count), count, mpi.BYTE], source,
+                               ARBFN_MPI_TAG_BINARY)
+                raise ProtocolError(
+                    f'Unregistered worker {source} sent binary request')
+
+            worker.packet = reserve(worker.packet, count)
+            self.comm.Recv([worker.packet, count, mpi.BYTE], source,
+                           ARBFN_MPI_TAG_BINARY)
+            if count < 32:
+                raise ProtocolError(
+                    f'Worker {source} sent truncated binary packet')
+            header = worker.packet[:32].view(BINARY_HEADER)[0]
+            if (header['magic'] != ARBFN_BINARY_MAGIC
+                    or header['type'] != ARBFN_PACKET_REQUEST):
+                raise ProtocolError(f'Worker {source} sent bad binary packet')
+            worker.n = int(header['n'])
+            worker.fields = int(header['fields'])
+            width: int = len(field_keys(worker.fields))
+            if count != 32 + 8 * width * worker.n:
+                raise ProtocolError(
+                    f'Worker {source} sent truncated binary packet')
+            return self.stage(source, worker)
+
+        # Otherwise, JSON
+        text = bytearray(count)
+        self.comm.Recv([text, count, mpi.CHAR], source, status.Get_tag())
+
+        # Empty packets carry no information
+        if count == 0:
+            return None
+        packet = json.loads(text)
+        kind = packet.get('type') if isinstance(packet, dict) else None
+
+        # Register a new worker, or re-register at the start of a run
+        if kind == 'register':
+            self.known_workers.add(source)
+            worker = self.workers.setdefault(source, Worker())
+            worker.has_request = False
+
+            # Workers which predate field selection send the defaults
+            names = packet.get('fields')
+            worker.fields = ARBFN_DEFAULT_FIELDS
+            if isinstance(names, list):
+                worker.fields = sum(bit for bit, name, _ in FIELDS
+                                    if name in names)
+
+            # Memory cannot be shared from here, so the shared format
+            # falls back to binary packets over MPI
+            worker.binary = (self.allow_binary and
+                             packet.get('format') in ('binary', 'shared'))
+
+            # Any terms asked for follow the force deltas in each
+            # response
+            worker.terms = sum(bit for bit, name, _ in TERMS
+                               if packet.get(name) is True)
+
+            ack = {'type': 'ack'}
+            if worker.binary:
+                ack['format'] = 'binary'
+            for bit, name, _ in TERMS:
+                if worker.terms & bit:
+                    ack[name] = True
+            self.send_json(source, json.dumps(ack, separators=(',', ':')))
+            return None
+
+        # Erase a worker
+        elif kind == 'deregister':
+            self.workers.pop(source, None)
+            return None
+
+        # Stage a request
+        elif kind == 'request':
+            if worker is None:
+                raise ProtocolError(
+                    f'Unregistered worker {source} sent request')
+            atoms = packet.get('atoms')
+            if not isinstance(atoms, list):
+                raise ProtocolError(
+                    f'Worker {source} sent request without atoms')
+
+            # Transcribe the atoms into the same layout as a binary
+            # request, a column at a time
+            keys: List[str] = field_keys(worker.fields)
+            worker.n = len(atoms)
+            worker.packet = reserve(worker.packet,
+                                    32 + 8 * len(keys) * worker.n)
+            columns: np.ndarray = worker.columns()
+            for column, key in zip(columns, keys):
+                try:
+                    column[:] = np.fromiter((atom[key] for atom in atoms),
+                                            dtype=np.float64, count=worker.n)
+                except (KeyError, TypeError, ValueError):
+                    raise ProtocolError(
+                        f"Worker {source} sent atom without numeric '{key}'")
+            return self.stage(source, worker)
+
+        raise ProtocolError(
+            f"Worker {source} sent bad packet w/ type '{kind}'")
+
+    def stage(self, source: int, worker: Worker) -> int:
+        '''
+        Readies the response to a worker's request
+        :param source: The rank of the worker
+        :param worker: The worker
+        :returns: The rank of the worker
+        '''
+
+        worker.response = reserve(worker.response,
+                                  32 + 8 * worker.width() * worker.n)
+        worker.has_request = True
+        return source
+
+    def respond(self, rank: int, worker: Worker) -> None:
+        '''
+        Sends a worker the fixes for its request
+        :param rank: The rank of the worker
+        :param worker: The worker, whose fixes are ready
+        '''
+
+        # The response buffer is already laid out as a binary packet
+        if worker.binary:
+            size: int = 32 + 8 * worker.width() * worker.n
+            header = worker.response[:32].view(BINARY_HEADER)
+            header['magic'] = ARBFN_BINARY_MAGIC
+            header['type'] = ARBFN_PACKET_RESPONSE
+            header['n'] = worker.n
+            header['fields'] = 0
+            header['expect_response'] = 0.0
+            self.comm.Send([worker.response, size, mpi.BYTE], rank,
+                           ARBFN_MPI_TAG_BINARY)
+        else:
+            # Each row of fixes is formatted at once, as doubles
+            row: str = '{' + ','.join(f'"{key}":%s'
+                                      for key in term_keys(worker.terms)) + '}'
+            fixes = worker.fixes().T.tolist()
+            self.send_json(rank, '{"type":"response","atoms":['
+                           + ','.join(row % tuple(map(json_number, fix))
+                                      for fix in fixes) + ']}')
+
+        worker.has_request = False
+        self.requests += 1
+
+    def send_waiting(self, rank: int, worker: Worker) -> None:
+        '''
+        Tells a worker that its request is held
+        :param rank: The rank of the worker
+        :param worker: The worker
+        '''
+
+        if worker.binary:
+            header = np.zeros(1, dtype=BINARY_HEADER)
+            header['magic'] = ARBFN_BINARY_MAGIC
+            header['type'] = ARBFN_PACKET_WAITING
+            header['n'] = worker.n
+            self.comm.Send([header.view(np.uint8), mpi.BYTE], rank,
+                           ARBFN_MPI_TAG_BINARY)
+        else:
+            self.send_json(rank, '{"type":"waiting"}')
+
+    def send_json(self, rank: int, text: str) -> None:
+        '''
+        Sends a JSON packet to a worker
+        :param rank: The rank of the worker
+        :param text: The packet
+        '''
+
+        self.comm.Send([text.encode(), mpi.CHAR], rank, ARBFN_MPI_TAG_JSON)
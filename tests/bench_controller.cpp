@@ -0,0 +1,44 @@
+/*
+A controller for benchmarking the interchange, built upon the
+controller library in `ARBFN/controller.h`. Its handlers do no
+work, so that only the cost of the protocol is measured.
+
+Usage: bench_controller.out MODE [THREADS]
+    MODE     `noop` answers each request as soon as it arrives,
+             while `bulk` holds requests until every worker has
+             sent one, as a global computation would
+    THREADS  The number of threads to run handlers on
+*/
+
+#include "../ARBFN/controller.h"
+#include <cstddef>
+#include <iostream>
+#include <mpi.h>
+#include <string>
+#include <vector>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+int main(int argc, char *argv[])
+{
+  const bool is_bulk = (argc > 1 && std::string(argv[1]) == "bulk");
+  const size_t num_threads = (argc > 2 ? std::stoul(argv[2]) : 1);
+
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+
+  bool result;
+  {
+    Controller controller(true, num_threads);
+
+    // The fixes are already zeroed, so there is nothing to do
+    if (is_bulk) {
+      result = controller.serve_bulk([](std::vector<WorkerRequest> &) {});
+    } else {
+      result = controller.serve([](WorkerRequest &) {});
+    }
+  }
+
+  MPI_Finalize();
+  return (result ? 0 : 1);
+}
@@ -0,0 +1,185 @@
+/*
+A synthetic worker for benchmarking the interchange without
+LAMMPS. Each step, it stages random atoms and times a single
+`interchange` call, then prints one CSV row of statistics for
+this rank (see `bench_controller.cpp` and `make bench`).
+
+Usage: bench_worker.out ATOMS FORMAT WAIT FIELDS CONTROLLER WORKERS
+    ATOMS       The number of atoms on this rank
+    FORMAT      `json`, `binary`, `shared` or `collective`
+    WAIT        `poll`, `backoff` or `block`
+    FIELDS      Field names joined by `+`, EG `x+v+f`
+    CONTROLLER  The controller in use, copied into the CSV
+    WORKERS     The number of workers, copied into the CSV
+
+Run it with no arguments to print the CSV header.
+*/
+
+#include "../ARBFN/interchange.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+const static double max_ms = 10000.0;
+
+/// The columns of each CSV row
+const static char *const csv_header =
+    "controller,workers,format,wait,fields,rank,atoms,steps,p50_us,p90_us,p99_us,max_us,"
+    "mean_us,serialize_us,wait_us,parse_us,mb_per_s";
+
+/**
+ * @brief Picks how many steps to time, so that large payloads do
+ * not take forever
+ */
+size_t num_steps(const size_t &_atoms)
+{
+  return std::max<size_t>(10, std::min<size_t>(1000, 2000000 / std::max<size_t>(_atoms, 1)));
+}
+
+/**
+ * @brief Yields the given percentile of some sorted samples
+ */
+double percentile(const std::vector<double> &_sorted, const double &_p)
+{
+  const size_t i = (size_t) (_p / 100.0 * (_sorted.size() - 1) + 0.5);
+  return _sorted[std::min(i, _sorted.size() - 1)];
+}
+
+/**
+ * @brief Fills every staged column with random values
+ */
+void randomize(AtomBuffer &_atoms, std::mt19937 &_rng)
+{
+  std::uniform_real_distribution<double> dist(-100.0, 100.0);
+
+  for (uint64_t bit = 1; bit <= _atoms.fields; bit <<= 1) {
+    if (!(_atoms.fields & bit)) { continue; }
+    for (size_t c = 0; c < field_width(bit); ++c) {
+      double *const column = _atoms.column((ARBFNField) bit, c);
+      for (size_t j = 0; j < _atoms.n; ++j) { column[j] = dist(_rng); }
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 7) {
+    std::cout << csv_header << "\n";
+    return 0;
+  }
+
+  const size_t atoms = std::stoul(argv[1]);
+  const std::string format_name = argv[2], wait_name = argv[3], field_names = argv[4];
+  const std::string controller_name = argv[5], num_workers = argv[6];
+
+  ARBFNFormat format = (format_name == "binary" ? ARBFN_FORMAT_BINARY : ARBFN_FORMAT_JSON);
+  if (format_name == "shared") { format = ARBFN_FORMAT_SHARED; }
+  if (format_name == "collective") { format = ARBFN_FORMAT_COLLECTIVE; }
+  Waiter waiter(ARBFN_WAIT_BACKOFF);
+  if (wait_name == "poll") {
+    waiter.strategy = ARBFN_WAIT_POLL;
+  } else if (wait_name == "block") {
+    waiter.strategy = ARBFN_WAIT_BLOCK;
+  }
+
+  uint64_t fields = 0;
+  std::stringstream names(field_names);
+  std::string name;
+  while (std::getline(names, name, '+')) { fields |= field_from_name(name); }
+  if (fields == 0) { fields = ARBFN_DEFAULT_FIELDS; }
+
+  uint controller_rank;
+  MPI_Comm comm, junk_comm;
+  ARBFNMode mode = ARBFN_MODE_REQUEST;
+  SharedSegment segment;
+  MPI_Comm group = MPI_COMM_NULL;
+
+  MPI_Init(NULL, NULL);
+  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, ARBFN_MPI_KEY_WORKER, &comm);
+
+  if (!discover_controller(controller_rank, comm) ||
+      !send_registration(controller_rank, comm, format, fields, mode, nullptr, nullptr, nullptr,
+                         &segment, &group)) {
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Failed to register with a controller\n";
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  // Collective workers send over their group, led by the controller
+  MPI_Comm &link = (format == ARBFN_FORMAT_COLLECTIVE ? group : comm);
+  const uint link_rank = (format == ARBFN_FORMAT_COLLECTIVE ? 0 : controller_rank);
+
+  // Warm up first, so connection setup and allocation are excluded
+  const size_t steps = num_steps(atoms);
+  const size_t warmup = std::max<size_t>(1, steps / 10);
+  std::mt19937 rng(rank);
+  AtomBuffer to_send;
+  FixBuffer to_recv;
+  InterchangeStats stats;
+  std::vector<double> latencies_us;
+  latencies_us.reserve(steps);
+
+  for (size_t step = 0; step < warmup + steps; ++step) {
+    to_send.resize(atoms, fields);
+    randomize(to_send, rng);
+
+    InterchangeStats step_stats;
+    const double start = MPI_Wtime();
+    if (!interchange(to_send, to_recv, max_ms, link_rank, link, format, waiter, &step_stats,
+                     &segment)) {
+      std::cerr << __FILE__ << ":" << __LINE__ << "> "
+                << "Interchange failed\n";
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const double elapsed_us = 1e6 * (MPI_Wtime() - start);
+
+    if (step >= warmup) {
+      latencies_us.push_back(elapsed_us);
+      stats.add(step_stats);
+    }
+  }
+
+  send_deregistration(controller_rank, comm, mode, &group);
+
+  // One row for this rank; the header is printed separately
+  std::vector<double> sorted = latencies_us;
+  std::sort(sorted.begin(), sorted.end());
+  double total_us = 0.0;
+  for (const double &us : latencies_us) { total_us += us; }
+
+  const double bytes = (double) (stats.bytes_sent + stats.bytes_received);
+  std::stringstream row;
+  row << controller_name << "," << num_workers << ","
+      << (format == ARBFN_FORMAT_COLLECTIVE
+              ? "collective"
+              : (format == ARBFN_FORMAT_SHARED
+                     ? "shared"
+                     : (format == ARBFN_FORMAT_BINARY ? "binary" : "json")))
+      << "," << wait_name << ","
+      << field_names << "," << rank << "," << atoms << "," << steps << ","
+      << percentile(sorted, 50.0) << "," << percentile(sorted, 90.0) << ","
+      << percentile(sorted, 99.0) << "," << sorted.back() << "," << total_us / steps << ","
+      << 1e6 * stats.serialize_s / steps << "," << 1e6 * stats.wait_s / steps << ","
+      << 1e6 * stats.parse_s / steps << "," << bytes / total_us << "\n";
+  std::cout << row.str() << std::flush;
+
+  // Final sync
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Comm_free(&comm);
+  MPI_Comm_free(&junk_comm);
+  MPI_Finalize();
+
+  return 0;
+}
@@ -4,36 +4,34 @@ arbitrary C++ controllers: Just make sure you start the
 controller with the rest of the LAMMPS MPI jobs!
 
 This is an edge repulsion system (NOT an edge dampening system).
+
+It speaks both wire formats: Workers which register with
+`"format": "binary"` are acknowledged as such and send packed
+binary requests, while all others use JSON.
 */
 
-#include <boost/json/src.hpp>
+#include "../ARBFN/interchange.h"
+#include <boost/json.hpp>
+#include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <mpi.h>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
 
-/// The color all ARBFN comms will be expected to have
-const static int ARBFN_MPI_COLOR = 56789;
-
-/// Uses the atom data sent by the worker to determine the force deltas
-void single_particle_fix(const boost::json::value &atom, double &dfx, double &dfy, double &dfz)
+/// Determines the force deltas from an atom's position and force
+void edge_repulsion(const double &x, const double &y, const double &fx, const double &fy,
+                    double &dfx, double &dfy, double &dfz)
 {
   dfx = dfy = dfz = 0.0;
 
-  double x, y, z, fx, fy, fz;
-  x = atom.at("x").as_double();
-  y = atom.at("y").as_double();
-  z = atom.at("z").as_double();
-  fx = atom.at("fx").as_double();
-  fy = atom.at("fy").as_double();
-  fz = atom.at("fz").as_double();
-
   // Edge repulsion
   dfx = pow(x - 10.0, -7) + pow(x + 10.0, -7);
   dfy = pow(y - 10.0, -7) + pow(y + 10.0, -7);
@@ -41,6 +39,42 @@ void single_particle_fix(const boost::json::value &atom, double &dfx, double &df
   dfy = (dfy < 0.0 ? -1.0 : 1.0) * fmin(abs(dfy), fmax(0.1, 1.5 * abs(fy)));
 }
 
+/// Uses the atom data sent by the worker to determine the force deltas
+void single_particle_fix(const boost::json::value &atom, double &dfx, double &dfy, double &dfz)
+{
+  // Workers may omit forces via `fix arbfn ... fields`
+  const boost::json::object &obj = atom.as_object();
+  const double fx = (obj.contains("fx") ? obj.at("fx").as_double() : 0.0);
+  const double fy = (obj.contains("fy") ? obj.at("fy").as_double() : 0.0);
+
+  edge_repulsion(obj.at("x").as_double(), obj.at("y").as_double(), fx, fy, dfx, dfy, dfz);
+}
+
+/// Answers a packed binary request in kind
+void binary_fix(const std::vector<char> &request, const int &source, MPI_Comm &comm)
+{
+  BinaryHeader header;
+  std::memcpy(&header, request.data(), sizeof(BinaryHeader));
+  const size_t n = header.n;
+  const double *const x = binary_field(request.data(), ARBFN_FIELD_X);
+  const double *const f = binary_field(request.data(), ARBFN_FIELD_F);
+
+  // Response: Header followed by the dfx, dfy and dfz columns
+  std::vector<char> response(sizeof(BinaryHeader) + 3 * n * sizeof(double));
+  double *const df = reinterpret_cast<double *>(&response[sizeof(BinaryHeader)]);
+  for (size_t i = 0; i < n; ++i) {
+    // Workers may omit forces via `fix arbfn ... fields`
+    const double fx = (f != nullptr ? f[i] : 0.0);
+    const double fy = (f != nullptr ? f[n + i] : 0.0);
+    edge_repulsion(x[i], x[n + i], fx, fy, df[i], df[n + i], df[2 * n + i]);
+  }
+
+  header.type = ARBFN_PACKET_RESPONSE;
+  header.fields = 0;
+  std::memcpy(response.data(), &header, sizeof(BinaryHeader));
+  MPI_Send(response.data(), response.size(), MPI_BYTE, source, ARBFN_MPI_TAG_BINARY, comm);
+}
+
 int main()
 {
   // The real and discardable communicators, respectively
@@ -53,7 +87,12 @@ int main()
   MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
 
   // Comm split 2 (ARBFN alignment: Produced real comm)
-  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
+  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, ARBFN_MPI_KEY_CONTROLLER, &comm);
+
+  // Discovery: Count ourselves as a controller, then learn how
+  // many workers picked us
+  uint num_controllers;
+  discover_workers(comm, num_controllers);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
             << "Started controller.\n"
@@ -67,6 +106,20 @@ int main()
     MPI_Status status;
     MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
 
+    // Binary packets are always requests
+    if (status.MPI_TAG == ARBFN_MPI_TAG_BINARY) {
+      int count;
+      MPI_Get_count(&status, MPI_BYTE, &count);
+      std::vector<char> request(count);
+      MPI_Recv(request.data(), count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
+
+      ++requests;
+      if (requests % 1000 == 0) { std::cerr << "Request #" << requests << "\n" << std::flush; }
+
+      binary_fix(request, status.MPI_SOURCE, comm);
+      continue;
+    }
+
     // Create buffer, load into it, then free it
     char *const buffer = new char[status._ucount + 1];
     MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
@@ -79,8 +132,10 @@ int main()
 
     // Register a new worker
     if (json["type"] == "register") {
+      const bool binary = json.contains("format") && json["format"] == "binary";
       json.clear();
       json["type"] = "ack";
+      if (binary) { json["format"] = "binary"; }
       ++num_registered;
 
       std::stringstream s;
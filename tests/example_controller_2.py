@@ -1,55 +1,41 @@
 #!/usr/bin/python3
 
 '''
-An example controller written in Python. This is a force
-dampener.
+An example controller written in Python, using the vectorized
+controller library in `python/arbfn`. This is a force dampener.
+Pass `bulk` to answer all workers' requests at once.
 '''
 
-import json
-from typing import Any, Tuple
-from mpi4py import MPI as mpi
+import sys
+from os import path
+from typing import List
 
+# Use the library from this checkout unless it is installed
+sys.path.insert(1, path.join(path.dirname(path.abspath(__file__)),
+                             '..', 'python'))
 
-ARBFN_MPI_COLOR: int = 56789
+from arbfn import Controller, WorkerRequest  # noqa: E402
 
 
-def send_json(comm: mpi.Comm, json_obj: object,
-              prev_status: mpi.Status) -> None:
+def atom_fix(request: WorkerRequest) -> None:
     '''
-    Send a JSON packet to the sender of the previous packet
-    :param comm: The MPI communicator to use
-    :param json_obj: The JSON object to encode
-    :param prev_status: The status of the previous recv from the now-target
+    Determine the (dfx, dfy, dfz) values for every atom at once.
+    :param request: The request to fill the fixes of
     '''
 
-    s: str = json.dumps(json_obj)
-    size_to_encode: int = len(s)
-    buff: bytearray = bytearray(size_to_encode)
+    # Workers may omit forces via `fix arbfn ... fields`
+    if 'f' in request.atoms:
+        request.fixes[:] = -0.99 * request.atoms['f']
 
-    # Add the actual data
-    for i, c in enumerate(s):
-        buff[i] = ord(c)
 
-    assert buff.decode('utf-8') == s
-
-    # Send the raw buffer
-    comm.Send(buff, prev_status.Get_source(), 0)
-
-    del buff
-
-
-def atom_fix(atom: Any) -> Tuple[float, float, float]:
+def bulk_fix(batch: List[WorkerRequest]) -> None:
     '''
-    Determine the (dfx, dfy, dfz) values for the given atom.
-    :param atom: The JSON dictionary representing a single atom
-    :returns: A 3-tuple of force deltas
+    Determine the fixes for every worker's atoms at once.
+    :param batch: The requests to fill the fixes of
     '''
 
-    dfx: float = -0.99 * atom['fx']
-    dfy: float = -0.99 * atom['fy']
-    dfz: float = -0.99 * atom['fz']
-
-    return dfx, dfy, dfz
+    for request in batch:
+        atom_fix(request)
 
 
 def main() -> None:
@@ -57,68 +43,17 @@ def main() -> None:
     Main function
     '''
 
-    num_registered: int = 0
-    requests: int = 0
-
-    # Synchronization
-    mpi.COMM_WORLD.Split(0)
-    comm: mpi.comm = mpi.COMM_WORLD.Split(ARBFN_MPI_COLOR)
-
-    while True:
-        # Await some packet
-        status: mpi.Status = mpi.Status()
-        comm.Probe(status=status)
-
-        # Allocate appropriately-sized buffer
-        buffer = bytearray(status.Get_count())
-
-        # Receive actual data
-        comm.Recv(buffer, status.Get_source(), status.Get_tag(), status=status)
-        msg: str = buffer[:status.Get_count()].decode('utf-8')
-
-        # Parse to json
-        j = json.loads(msg)
-
-        # Safety check
-        assert j['type'] not in ['waiting', 'ack', 'response']
-
-        # Book keeping
-        if j['type'] == 'register':
-            # Register a new worker
-            to_send = {'type': 'ack'}
-            num_registered += 1
-            send_json(comm, to_send, status)
-        elif j['type'] == 'deregister':
-            # Erase a worker
-            num_registered -= 1
-            if num_registered == 0:
-                break
-
-        # Data processing
-        elif j['type'] == 'request':
-            if requests % 1000 == 0:
-                print(f'On request {requests}')
-            requests += 1
-
-            # Determine fix to send back
-            to_send = {
-                'type': 'response',
-                'atoms': []
-            }
-            for item in j['atoms']:
-                dfx, dfy, dfz = atom_fix(item)
-                to_send['atoms'].append(
-                    {
-                        'dfx': dfx,
-                        'dfy': dfy,
-                        'dfz': dfz
-                    }
-                )
-
-            # Send fix data back
-            send_json(comm, to_send, status)
-
-    mpi.COMM_WORLD.Barrier()
+    controller: Controller = Controller()
+
+    if 'bulk' in sys.argv[1:]:
+        ok: bool = controller.serve_bulk(bulk_fix)
+    else:
+        ok = controller.serve(atom_fix)
+
+    print(f'Answered {controller.requests} requests')
+    controller.free()
+    if not ok:
+        sys.exit(1)
 
 
 main()
@@ -0,0 +1,57 @@
+/*
+A C++ port of the `python` example controller (a force dampener),
+built upon the controller library in `ARBFN/controller.h`. The
+library handles the protocol in either wire format, so that only
+the physics is left here.
+
+Each request is answered as soon as its fixes are ready: Pass a
+thread count as the first argument to spread requests over that
+many threads.
+*/
+
+#include "../ARBFN/controller.h"
+#include <cstddef>
+#include <iostream>
+#include <mpi.h>
+#include <string>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+/// Cancels out most of each atom's force
+void dampen(WorkerRequest &request)
+{
+  // Workers may omit forces via `fix arbfn ... fields`
+  if (!(request.atoms->fields & ARBFN_FIELD_F)) { return; }
+
+  for (size_t c = 0; c < 3; ++c) {
+    const double *const f = request.atoms->column(ARBFN_FIELD_F, c);
+    double *const df = request.fixes->column(c);
+    for (size_t i = 0; i < request.atoms->n; ++i) { df[i] = -0.99 * f[i]; }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t num_threads = (argc > 1 ? std::stoul(argv[1]) : 1);
+
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+
+  bool result;
+  {
+    Controller controller(true, num_threads);
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Started controller w/ " << num_threads << " thread(s).\n"
+              << std::flush;
+
+    result = controller.serve(dampen);
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Halting controller after " << controller.requests << " requests\n"
+              << std::flush;
+  }
+
+  MPI_Finalize();
+  return (result ? 0 : 1);
+}
@@ -0,0 +1,125 @@
+/*
+A controller for workers in grid mode, built upon the controller
+library in `ARBFN/controller.h`. It tabulates a spring pulling
+every atom towards the origin, which workers interpolate locally
+instead of sending their atoms. Each worker fetches only the
+tiles of the grid around its own atoms.
+
+Workers in request mode may be mixed in: They are answered from
+the same field (with its rate of change, energy and virial, if
+they ask for them), and every so often their requests stiffen the
+spring, which pushes a new grid to the workers in grid mode. The
+spring starts at `k = 0.01` and doubles with every change, which
+`example_worker ... spring` checks its fixes against.
+*/
+
+#include "../ARBFN/controller.h"
+#include <cstddef>
+#include <iostream>
+#include <mpi.h>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+/// The number of requests between changes to the spring
+const static uintmax_t requests_per_change = 500;
+
+/// The stiffness of the spring
+static double k = 0.01;
+
+/**
+ * @brief Tabulates the spring on a coarse grid. The field is linear,
+ * so trilinear interpolation reproduces it exactly.
+ */
+void tabulate(ForceGrid &_grid)
+{
+  _grid.resize(9, 9, 9);
+  for (size_t d = 0; d < 3; ++d) {
+    _grid.lo[d] = -200.0;
+    _grid.hi[d] = 200.0;
+  }
+
+  for (size_t k_i = 0; k_i < _grid.dims[2]; ++k_i) {
+    for (size_t j = 0; j < _grid.dims[1]; ++j) {
+      for (size_t i = 0; i < _grid.dims[0]; ++i) {
+        const size_t index = _grid.index(i, j, k_i);
+        _grid.column(0)[index] = -k * _grid.node(0, i);
+        _grid.column(1)[index] = -k * _grid.node(1, j);
+        _grid.column(2)[index] = -k * _grid.node(2, k_i);
+      }
+    }
+  }
+}
+
+int main()
+{
+  int provided;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+
+  bool result;
+  {
+    Controller controller;
+    tabulate(controller.grid);
+
+    // Small tiles, so that workers hold only part of the grid
+    controller.tile_size = 2;
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Started grid controller.\n"
+              << std::flush;
+
+    result = controller.serve([&controller](WorkerRequest &request) {
+      if (request.atoms->fields & ARBFN_FIELD_X) {
+        for (size_t c = 0; c < 3; ++c) {
+          const double *const x = request.atoms->column(ARBFN_FIELD_X, c);
+          double *const df = request.fixes->column(c);
+          for (size_t i = 0; i < request.atoms->n; ++i) { df[i] = -k * x[i]; }
+        }
+      }
+
+      // The spring changes as the atoms move
+      FixBuffer &fixes = *request.fixes;
+      if ((fixes.terms & ARBFN_TERM_RATES) && (request.atoms->fields & ARBFN_FIELD_V)) {
+        for (size_t c = 0; c < 3; ++c) {
+          const double *const v = request.atoms->column(ARBFN_FIELD_V, c);
+          double *const rate = fixes.column(fixes.term_column(ARBFN_TERM_RATES) + c);
+          for (size_t i = 0; i < request.atoms->n; ++i) { rate[i] = -k * v[i]; }
+        }
+      }
+
+      // The spring stores k |x|^2 / 2 (as fixes are zeroed
+      // beforehand), and its virial is x_a df_b
+      const bool has_x = (request.atoms->fields & ARBFN_FIELD_X);
+      if (has_x && (fixes.terms & ARBFN_TERM_ENERGY)) {
+        double *const energy = fixes.column(fixes.term_column(ARBFN_TERM_ENERGY));
+        for (size_t c = 0; c < 3; ++c) {
+          const double *const x = request.atoms->column(ARBFN_FIELD_X, c);
+          const double *const df = fixes.column(c);
+          for (size_t i = 0; i < request.atoms->n; ++i) { energy[i] -= 0.5 * x[i] * df[i]; }
+        }
+      }
+      if (has_x && (fixes.terms & ARBFN_TERM_VIRIAL)) {
+        static const size_t pairs[6][2] = {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+        for (size_t p = 0; p < 6; ++p) {
+          const double *const x = request.atoms->column(ARBFN_FIELD_X, pairs[p][0]);
+          const double *const df = fixes.column(pairs[p][1]);
+          double *const virial = fixes.column(fixes.term_column(ARBFN_TERM_VIRIAL) + p);
+          for (size_t i = 0; i < request.atoms->n; ++i) { virial[i] = x[i] * df[i]; }
+        }
+      }
+
+      // Without a thread pool, handlers run on the serving thread
+      if ((controller.requests + 1) % requests_per_change == 0) {
+        k *= 2.0;
+        tabulate(controller.grid);
+        controller.push_grid();
+      }
+    });
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Halting grid controller after " << controller.requests << " requests\n"
+              << std::flush;
+  }
+
+  MPI_Finalize();
+  return (result ? 0 : 1);
+}
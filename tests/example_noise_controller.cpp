@@ -0,0 +1,147 @@
+/*
+An example controller which keeps state for each atom between
+steps, built upon the controller library in `ARBFN/controller.h`.
+
+Every atom feels its own colored noise, whose history is looked up
+by atom ID. Workers must send IDs (EG `fix arbfn ... fields x id`),
+and then tell the controller which atoms arrive and leave as they
+migrate, so that each step only costs as much bookkeeping as the
+atoms which moved. Requests are answered in bulk, so that an atom
+which leaves one worker and arrives at another within a step keeps
+its history.
+*/
+
+#include "../ARBFN/controller.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mpi.h>
+#include <random>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+/// How much of its noise each atom keeps from one step to the next
+const static double memory = 0.9;
+
+/// The standard deviation of the noise
+const static double sigma = 0.1;
+
+/**
+ * @struct Noise
+ * @brief The noise felt by one atom
+ */
+struct Noise {
+  double eta[3] = {0.0, 0.0, 0.0};
+};
+
+/**
+ * @class NoiseController
+ * @brief Tracks the atoms held by every worker, and the noise felt
+ * by each of them
+ */
+class NoiseController {
+ public:
+  NoiseController() : rng(1234), normal(0.0, 1.0), batches(0), num_strays(0) {}
+
+  /// Advances the noise of every atom and hands it out as fixes
+  void operator()(std::vector<WorkerRequest> &requests)
+  {
+    migrate(requests);
+
+    const double kick = sigma * std::sqrt(1.0 - memory * memory);
+    size_t num_atoms = 0, num_untracked = 0;
+    for (WorkerRequest &request : requests) {
+      if (!(request.atoms->fields & ARBFN_FIELD_ID)) { continue; }
+
+      const double *const ids = request.atoms->column(ARBFN_FIELD_ID, 0);
+      for (size_t i = 0; i < request.atoms->n; ++i) {
+        // Atoms which never arrived start afresh
+        auto it = state.find((int64_t) ids[i]);
+        if (it == state.end()) {
+          it = state.emplace((int64_t) ids[i], Noise()).first;
+          ++num_untracked;
+        }
+        Noise &noise = it->second;
+        for (size_t c = 0; c < 3; ++c) {
+          noise.eta[c] = memory * noise.eta[c] + kick * normal(rng);
+          request.fixes->column(c)[i] = noise.eta[c];
+        }
+      }
+      num_atoms += request.atoms->n;
+    }
+
+    // Every atom held should have arrived somewhere and not left.
+    // The first batch may hold atoms sent before any notices.
+    if (++batches % 100 == 0 || num_untracked > 0) {
+      std::cerr << __FILE__ << ":" << __LINE__ << "> "
+                << "Tracking noise for " << state.size() << " of " << num_atoms << " atoms ("
+                << num_untracked << " untracked)\n"
+                << std::flush;
+    }
+    if (batches > 1) { num_strays += num_untracked; }
+  }
+
+  /// The atoms sent after the first batch without having arrived,
+  /// which means the migration notices were wrong
+  uintmax_t strays() const { return num_strays; }
+
+ protected:
+  /**
+   * @brief Forgets the atoms which have left every worker, and
+   * starts the noise of those which are new
+   */
+  void migrate(const std::vector<WorkerRequest> &requests)
+  {
+    arrived.clear();
+    for (const WorkerRequest &request : requests) {
+      for (const double &tag : *request.arrived) { arrived.insert((int64_t) tag); }
+    }
+    for (const WorkerRequest &request : requests) {
+      for (const double &tag : *request.departed) {
+        if (arrived.count((int64_t) tag) == 0) { state.erase((int64_t) tag); }
+      }
+    }
+    for (const int64_t &tag : arrived) { state[tag]; }
+  }
+
+  std::unordered_map<int64_t, Noise> state;
+  std::set<int64_t> arrived;
+  std::mt19937 rng;
+  std::normal_distribution<double> normal;
+  uintmax_t batches, num_strays;
+};
+
+int main()
+{
+  MPI_Init(NULL, NULL);
+
+  bool result;
+  {
+    Controller controller;
+    NoiseController noise;
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Started noise controller.\n"
+              << std::flush;
+
+    result = controller.serve_bulk(std::ref(noise));
+    if (noise.strays() > 0) {
+      std::cerr << __FILE__ << ":" << __LINE__ << "> "
+                << noise.strays() << " atoms were sent without arriving\n"
+                << std::flush;
+      result = false;
+    }
+
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Halting noise controller after " << controller.requests << " requests\n"
+              << std::flush;
+  }
+
+  MPI_Finalize();
+  return (result ? 0 : 1);
+}
@@ -1,10 +1,16 @@
 #include "../ARBFN/interchange.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <iostream>
+#include <limits>
 #include <mpi.h>
 #include <random>
+#include <string>
+#include <thread>
 #include <vector>
 
 const static size_t num_updates = 1000;
@@ -12,8 +18,272 @@ const static size_t num_atoms = 128;
 const static double dt = 0.01;
 const static double max_ms = 50.0;
 
-int main()
+/// How far atoms may stray beyond the tiles held in grid mode
+const static double grid_margin = 10.0;
+
+/// How much values may drift before an atom is resent in delta mode
+const static double delta_tolerance = 0.5;
+
+/// How many steps each atom sits out for when sending IDs
+const static size_t away_steps = 100;
+
+/// The stiffness `example_grid_controller` starts its spring at,
+/// doubling it with every change it pushes
+const static double spring_k = 0.01;
+
+/// How long to wait for a change to the spring after the last step
+const static double max_push_wait_s = 60.0;
+
+/**
+ * @brief Copies the atoms into a staging buffer
+ * @param _atoms The atoms to stage
+ * @param _into The buffer to stage them into
+ * @param _fields The fields to stage
+ * @param _away The index of an atom to leave out, if any
+ * @param _first_id The ID of the first atom, those of the others
+ * following on from it
+ */
+void stage(const std::vector<AtomData> &_atoms, AtomBuffer &_into,
+           const uint64_t &_fields = ARBFN_DEFAULT_FIELDS, const size_t &_away = (size_t) -1,
+           const size_t &_first_id = 1)
+{
+  _into.resize(_atoms.size() - (_away < _atoms.size() ? 1 : 0), _fields);
+  size_t k = 0;
+  for (size_t j = 0; j < _atoms.size(); ++j) {
+    if (j == _away) { continue; }
+    _into.column(ARBFN_FIELD_X, 0)[k] = _atoms[j].x;
+    _into.column(ARBFN_FIELD_X, 1)[k] = _atoms[j].y;
+    _into.column(ARBFN_FIELD_X, 2)[k] = _atoms[j].z;
+    _into.column(ARBFN_FIELD_V, 0)[k] = _atoms[j].vx;
+    _into.column(ARBFN_FIELD_V, 1)[k] = _atoms[j].vy;
+    _into.column(ARBFN_FIELD_V, 2)[k] = _atoms[j].vz;
+    _into.column(ARBFN_FIELD_F, 0)[k] = _atoms[j].fx;
+    _into.column(ARBFN_FIELD_F, 1)[k] = _atoms[j].fy;
+    _into.column(ARBFN_FIELD_F, 2)[k] = _atoms[j].fz;
+    if (_fields & ARBFN_FIELD_ID) {
+      _into.column(ARBFN_FIELD_ID, 0)[k] = (double) (_first_id + j);
+    }
+    ++k;
+  }
+}
+
+/**
+ * @brief Finds the stiffness of the spring tabulated by
+ * `example_grid_controller` in the cached tiles
+ * @param _tiles The tiles held
+ * @param _k Where to save the stiffness
+ * @return True if every tile holds the same spring, false while a
+ * change is still arriving
+ */
+bool spring_stiffness(const TileCache &_tiles, double &_k)
+{
+  bool found = false;
+  for (const auto &p : _tiles.tiles) {
+    // Any node off the origin along x gives the stiffness
+    const ForceGrid &tile = p.second;
+    for (size_t i = 0; i < tile.dims[0]; ++i) {
+      const double x = tile.node(0, i);
+      if (x == 0.0) { continue; }
+
+      const double k = -tile.column(0)[tile.index(i, 0, 0)] / x;
+      if (found && std::fabs(k - _k) > 1e-9 * _k) { return false; }
+      _k = k;
+      found = true;
+      break;
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief Checks interpolated fixes against the spring tabulated by
+ * `example_grid_controller`, which pulls each atom by -k times its
+ * position, clamped to the grid
+ * @param _atoms The atoms interpolated at
+ * @param _fixes The interpolated fixes
+ * @param _layout The layout of the whole grid
+ * @param _k The stiffness of the spring
+ * @return True if every fix matches, false (with a message) if not
+ */
+bool check_spring(const AtomBuffer &_atoms, const FixBuffer &_fixes, const ForceGrid &_layout,
+                  const double &_k)
+{
+  const double doublings = std::log2(_k / spring_k);
+  if (std::fabs(doublings - std::round(doublings)) > 1e-9) {
+    std::cerr << "The grid holds a spring of stiffness " << _k << ", which was never pushed\n";
+    return false;
+  }
+
+  for (size_t c = 0; c < 3; ++c) {
+    const double *const x = _atoms.column(ARBFN_FIELD_X, c);
+    const double *const df = _fixes.column(c);
+    const double tolerance =
+        1e-9 * _k * std::max(std::fabs(_layout.lo[c]), std::fabs(_layout.hi[c]));
+    for (size_t j = 0; j < _atoms.n; ++j) {
+      const double expected = -_k * std::min(std::max(x[j], _layout.lo[c]), _layout.hi[c]);
+      if (std::fabs(df[j] - expected) > tolerance) {
+        std::cerr << "Atom " << j << " got " << df[j] << " along axis " << c << " rather than "
+                  << expected << " from a spring of stiffness " << _k << "\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Checks that the cached tiles were assembled into the local
+ * grid where they belong, by comparing every node (including those
+ * along the borders between tiles) with the spring of stiffness `k`
+ * @param _tiles The tiles held
+ * @param _k The stiffness of the spring
+ * @return True if the local grid matches, false (with a message) if
+ * not
+ */
+bool check_tiles(const TileCache &_tiles, const double &_k)
+{
+  const ForceGrid &local = _tiles.local;
+  for (size_t d = 0; d < 3; ++d) {
+    const uint64_t first = _tiles.tile_lo[d] * _tiles.tile_size;
+    const uint64_t last = std::min((_tiles.tile_hi[d] + 1) * _tiles.tile_size,
+                                   _tiles.layout.dims[d]) - 1;
+    if (local.dims[d] != last - first + 1 || local.lo[d] != _tiles.layout.node(d, first) ||
+        local.hi[d] != _tiles.layout.node(d, last)) {
+      std::cerr << "The local grid does not span tiles " << _tiles.tile_lo[d] << " to "
+                << _tiles.tile_hi[d] << " along axis " << d << "\n";
+      return false;
+    }
+  }
+
+  const double tolerance = 1e-9 * _k * std::fabs(_tiles.layout.hi[0] - _tiles.layout.lo[0]);
+  for (size_t k_i = 0; k_i < local.dims[2]; ++k_i) {
+    for (size_t j = 0; j < local.dims[1]; ++j) {
+      for (size_t i = 0; i < local.dims[0]; ++i) {
+        const size_t node[3] = {i, j, k_i};
+        for (size_t c = 0; c < 3; ++c) {
+          const double expected = -_k * local.node(c, node[c]);
+          if (std::fabs(local.column(c)[local.index(i, j, k_i)] - expected) > tolerance) {
+            std::cerr << "Node (" << i << ", " << j << ", " << k_i
+                      << ") of the local grid was misplaced\n";
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Yields the spread of a column of values
+ */
+double spread(const double *_values, const size_t &_n)
+{
+  if (_n == 0) { return 0.0; }
+  const auto range = std::minmax_element(_values, _values + _n);
+  return *range.second - *range.first;
+}
+
+/**
+ * @brief Checks fixes against those of `example_damping_controller`,
+ * which cancels out 99% of each atom's force as sent. Both the force
+ * sent and the fix received may be off by as much as their precision
+ * allows: 2^-24 of themselves at single precision (or half the
+ * least float, once they underflow), or 1/131070 of the spread of
+ * their column when quantized (give or take a step which underflows).
+ * @param _sent The atoms as the controller holds them, in the order
+ * of the fixes
+ * @param _fixes The fixes received
+ * @param _precision The precision the packets travelled at
+ * @return True if every fix matches, false (with a message) if not
+ */
+bool check_damped(const AtomBuffer &_sent, const FixBuffer &_fixes,
+                  const ARBFNPrecision &_precision)
 {
+  if (_sent.n != _fixes.n) {
+    std::cerr << "Got " << _fixes.n << " fixes for " << _sent.n << " atoms\n";
+    return false;
+  }
+
+  for (size_t c = 0; c < 3; ++c) {
+    const double *const f = _sent.column(ARBFN_FIELD_F, c);
+    const double *const df = _fixes.column(c);
+    const double spreads =
+        0.99 * spread(f, _sent.n) + spread(df, _fixes.n) * (1.0 + 1e-12);
+    for (size_t j = 0; j < _sent.n; ++j) {
+      const double expected = -0.99 * f[j];
+      double tolerance = 1e-12 * std::fabs(expected);
+      if (_precision == ARBFN_PRECISION_SINGLE) {
+        tolerance += std::ldexp(0.99 * std::fabs(f[j]) + std::fabs(df[j]), -24) +
+            std::numeric_limits<float>::denorm_min();
+      } else if (_precision == ARBFN_PRECISION_QUANTIZED) {
+        tolerance += spreads / (2.0 * ARBFN_QUANTIZED_MAX) +
+            2.0 * ARBFN_QUANTIZED_MAX * std::numeric_limits<double>::denorm_min();
+      }
+
+      if (std::fabs(df[j] - expected) > tolerance) {
+        std::cerr << "Atom " << j << " got " << df[j] << " along axis " << c << " rather than "
+                  << expected << " (to within " << tolerance << ") at "
+                  << precision_name(_precision) << " precision\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  // Optionally request the binary (shared or collective) format, overlap
+  // the interchange with the next step's work, pick a wait strategy,
+  // interpolate from the controller's grid, send IDs, send only
+  // changes and/or ask for the rates of change of the fixes, or the
+  // energy and virial of the controller's field, pick the precision
+  // of binary packets, or run two fixes over one channel. In grid
+  // mode, the fixes may be checked against the spring of
+  // `example_grid_controller`, and otherwise against the damping of
+  // `example_damping_controller`.
+  ARBFNFormat format = ARBFN_FORMAT_JSON;
+  ARBFNMode mode = ARBFN_MODE_REQUEST;
+  ARBFNPrecision precision = ARBFN_PRECISION_DOUBLE;
+  bool is_async = false, send_ids = false, is_multiplexed = false, is_spring = false;
+  bool is_damped = false;
+  uint64_t terms = 0;
+  Waiter waiter;
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "binary") {
+      format = ARBFN_FORMAT_BINARY;
+    } else if (std::string(argv[i]) == "shared") {
+      format = ARBFN_FORMAT_SHARED;
+    } else if (std::string(argv[i]) == "collective") {
+      format = ARBFN_FORMAT_COLLECTIVE;
+    } else if (std::string(argv[i]) == "async") {
+      is_async = true;
+    } else if (std::string(argv[i]) == "poll") {
+      waiter.strategy = ARBFN_WAIT_POLL;
+    } else if (std::string(argv[i]) == "block") {
+      waiter.strategy = ARBFN_WAIT_BLOCK;
+    } else if (std::string(argv[i]) == "grid") {
+      mode = ARBFN_MODE_GRID;
+    } else if (std::string(argv[i]) == "delta") {
+      mode = ARBFN_MODE_DELTA;
+    } else if (std::string(argv[i]) == "ids") {
+      send_ids = true;
+    } else if (std::string(argv[i]) == "rates") {
+      terms |= ARBFN_TERM_RATES;
+    } else if (std::string(argv[i]) == "energy") {
+      terms |= ARBFN_TERM_ENERGY | ARBFN_TERM_VIRIAL;
+    } else if (std::string(argv[i]) == "multiplex") {
+      is_multiplexed = true;
+    } else if (std::string(argv[i]) == "spring") {
+      is_spring = true;
+    } else if (std::string(argv[i]) == "damped") {
+      is_damped = true;
+    } else {
+      precision_from_name(argv[i], precision);
+    }
+  }
+
   std::uniform_real_distribution<double> dist(-100.0, 100.0);
   std::uniform_int_distribution<uint> time_dist(0, 10000);
   std::random_device rng;
@@ -31,7 +301,10 @@ int main()
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
             << "Comm split 2 (ARBFN alignment)...\n"
             << std::flush;
-  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
+  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, ARBFN_MPI_KEY_WORKER, &comm);
+
+  bool res = discover_controller(controller_rank, comm);
+  assert(res);
 
   // Randomize initial atom data
   for (size_t i = 0; i < num_atoms; ++i) {
@@ -52,14 +325,56 @@ int main()
     atoms.push_back(cur);
   }
 
-  const bool res = send_registration(controller_rank, comm);
-  assert(res);
+  // Controllers may not support delta mode, in which case all atoms
+  // are sent (still with their IDs)
+  const ARBFNMode requested_mode = mode;
+  if (mode == ARBFN_MODE_DELTA) { send_ids = true; }
+  const uint64_t fields = ARBFN_DEFAULT_FIELDS | (send_ids ? ARBFN_FIELD_ID : 0);
+  TileCache tiles;
+  Migration migration;
+  SharedSegment segment;
+  MPI_Comm group = MPI_COMM_NULL;
+
+  // Two fixes may register together: The second sends the first half
+  // of the atoms every other step, with any terms asked for
+  std::vector<MultiplexedFix> parts(is_multiplexed ? 2 : 0);
+  AtomBuffer part_atoms[2];
+  FixBuffer part_fixes[2];
+  if (is_multiplexed) {
+    parts[0].id = "arbfn_all";
+    parts[1].id = "arbfn_half";
+    parts[1].terms = terms;
+    for (size_t k = 0; k < parts.size(); ++k) {
+      parts[k].atoms = &part_atoms[k];
+      parts[k].fixes = &part_fixes[k];
+    }
+    res = send_registration(controller_rank, comm, format, parts);
+    assert(res);
+    for (size_t k = 0; k < parts.size(); ++k) { part_fixes[k].set_terms(parts[k].terms); }
+  } else {
+    res = send_registration(controller_rank, comm, format, fields, mode, &tiles, &migration,
+                            &terms, &segment, &group, &precision);
+    assert(res && (mode == requested_mode || requested_mode == ARBFN_MODE_DELTA));
+  }
+
+  // Collective workers send over their group, led by the controller
+  MPI_Comm &link = (format == ARBFN_FORMAT_COLLECTIVE ? group : comm);
+  const uint link_rank = (format == ARBFN_FORMAT_COLLECTIVE ? 0 : controller_rank);
 
   int my_rank;
   MPI_Comm_rank(comm, &my_rank);
 
+  // IDs must be unique across workers
+  const size_t first_id = my_rank * num_atoms + 1;
+
   std::cout << __FILE__ << ":" << __LINE__ << "> "
-            << "Got controller rank " << controller_rank << '\n';
+            << "Got controller rank " << controller_rank << " w/ "
+            << (format == ARBFN_FORMAT_COLLECTIVE
+                    ? "collective"
+                    : (format == ARBFN_FORMAT_SHARED
+                           ? "shared"
+                           : (format == ARBFN_FORMAT_BINARY ? "binary" : "JSON")))
+            << " format at " << precision_name(precision) << " precision\n";
 
   std::cout << __FILE__ << ":" << __LINE__ << "> "
             << "Worker with rank " << my_rank << " launched\n";
@@ -71,6 +386,22 @@ int main()
   std::vector<AtomData> atom_info_send(n);
   std::vector<FixData> fix_info_recv(n);
 
+  // Asynchronous variables
+  AtomBuffer atom_buffer;
+  FixBuffer fix_buffer;
+  fix_buffer.set_terms(terms);
+  double energy = 0.0, virial_trace = 0.0;
+  PendingInterchange pending;
+  InterchangeStats stats;
+
+  // Delta variables
+  AtomDelta delta;
+  delta.tolerance = delta_tolerance;
+  size_t num_changed = 0;
+
+  // Binary packets travel at the precision agreed at registration
+  fix_buffer.precision = atom_buffer.precision = delta.changed.precision = precision;
+
   for (size_t step = 0; step < num_updates; ++step) {
     // Simulate work
     for (size_t j = 0; j < n; ++j) {
@@ -85,9 +416,174 @@ int main()
     }
 
     // Interchange
-    const bool res =
-        interchange(n, atom_info_send.data(), fix_info_recv.data(), max_ms, controller_rank, comm);
-    assert(res);
+    if (is_multiplexed) {
+      // Both fixes send in one request when both are due
+      std::vector<size_t> due(1, 0);
+      stage(atoms, part_atoms[0]);
+      if (step % 2 == 0) {
+        stage(std::vector<AtomData>(atoms.begin(), atoms.begin() + n / 2), part_atoms[1]);
+        due.push_back(1);
+      }
+      res = interchange(parts, due, max_ms, controller_rank, comm, format, waiter, &stats);
+      assert(res && part_fixes[0].n == n && (due.size() == 1 || part_fixes[1].n == n / 2));
+
+      for (size_t j = 0; j < n; ++j) {
+        fix_info_recv[j].dfx = part_fixes[0].column(0)[j];
+        fix_info_recv[j].dfy = part_fixes[0].column(1)[j];
+        fix_info_recv[j].dfz = part_fixes[0].column(2)[j];
+      }
+      for (size_t j = 0; j < n / 2 && due.size() > 1; ++j) {
+        fix_info_recv[j].dfx += part_fixes[1].column(0)[j];
+        fix_info_recv[j].dfy += part_fixes[1].column(1)[j];
+        fix_info_recv[j].dfz += part_fixes[1].column(2)[j];
+      }
+    } else if (mode == ARBFN_MODE_GRID) {
+      // Hold the tiles around our atoms, which only changes as they
+      // spread out. Otherwise, only the grid's owner talks, and only
+      // when it changes.
+      double lo[3] = {atoms[0].x, atoms[0].y, atoms[0].z};
+      double hi[3] = {atoms[0].x, atoms[0].y, atoms[0].z};
+      for (const AtomData &atom : atoms) {
+        const double at[3] = {atom.x, atom.y, atom.z};
+        for (size_t d = 0; d < 3; ++d) {
+          lo[d] = std::min(lo[d], at[d] - grid_margin);
+          hi[d] = std::max(hi[d], at[d] + grid_margin);
+        }
+      }
+      const size_t num_cached = tiles.tiles.size();
+      res = fetch_tiles(tiles, lo, hi, max_ms, controller_rank, comm, waiter);
+      assert(res);
+      if (tiles.tiles.size() != num_cached) {
+        std::cout << __FILE__ << ":" << __LINE__ << "> "
+                  << "Worker " << my_rank << " holds " << tiles.tiles.size() << " tiles at step "
+                  << step << "\n";
+      }
+
+      bool updated;
+      res = poll_grid(tiles, controller_rank, comm, updated);
+      assert(res);
+      if (updated) {
+        std::cout << __FILE__ << ":" << __LINE__ << "> "
+                  << "Worker " << my_rank << " got new grid at step " << step << "\n";
+      }
+
+      stage(atoms, atom_buffer);
+      interpolate(tiles.local, atom_buffer, fix_buffer);
+
+      // The spring is known unless a change is still arriving
+      double k;
+      if (is_spring && spring_stiffness(tiles, k)) {
+        res = check_tiles(tiles, k) && check_spring(atom_buffer, fix_buffer, tiles.layout, k);
+        assert(res);
+      }
+
+      for (size_t j = 0; j < n; ++j) {
+        fix_info_recv[j].dfx = fix_buffer.column(0)[j];
+        fix_info_recv[j].dfy = fix_buffer.column(1)[j];
+        fix_info_recv[j].dfz = fix_buffer.column(2)[j];
+      }
+    } else if (send_ids) {
+      // Each atom in turn sits out for a while, as though it had
+      // migrated to another worker, and the controller is told
+      const size_t away = (step / away_steps) % n;
+      stage(atoms, atom_buffer, fields, away, first_id);
+      notify_migration(atom_buffer, migration, controller_rank, comm, &stats);
+
+      // Send only the atoms which changed, if possible
+      const AtomBuffer *sent;
+      if (mode == ARBFN_MODE_DELTA) {
+        stage_delta(atom_buffer, delta);
+        num_changed += delta.changed.n;
+        res = interchange(delta, fix_buffer, max_ms, controller_rank, comm, format, waiter,
+                          &stats, &segment);
+        sent = &delta.snapshot;
+      } else {
+        res = interchange(atom_buffer, fix_buffer, max_ms, link_rank, link, format, waiter,
+                          &stats, &segment);
+        sent = &atom_buffer;
+      }
+      assert(res && fix_buffer.n == n - 1);
+
+      // Atoms left out of a delta are answered as last sent
+      if (is_damped) {
+        res = check_damped(*sent, fix_buffer, precision);
+        assert(res);
+      }
+      const double *const ids = sent->column(ARBFN_FIELD_ID, 0);
+
+      // The fixes are for every atom present, in order of ID in
+      // delta mode
+      fix_info_recv[away] = FixData();
+      for (size_t k = 0; k < fix_buffer.n; ++k) {
+        const size_t j = (size_t) ids[k] - first_id;
+        fix_info_recv[j].dfx = fix_buffer.column(0)[k];
+        fix_info_recv[j].dfy = fix_buffer.column(1)[k];
+        fix_info_recv[j].dfz = fix_buffer.column(2)[k];
+      }
+    } else if (is_async) {
+      // Receive the last step's fix data, then send this step's atoms
+      if (pending.active) {
+        const bool res = finish_interchange(fix_buffer, pending);
+        assert(res);
+        stats.add(pending.stats);
+        for (size_t j = 0; j < n; ++j) {
+          fix_info_recv[j].dfx = fix_buffer.column(0)[j];
+          fix_info_recv[j].dfy = fix_buffer.column(1)[j];
+          fix_info_recv[j].dfz = fix_buffer.column(2)[j];
+        }
+      }
+
+      stage(atoms, atom_buffer, fields);
+      const bool res = begin_interchange(atom_buffer, fix_buffer, max_ms, link_rank, link, format,
+                                         pending, waiter, &segment);
+      assert(res);
+    } else if (waiter.strategy != ARBFN_WAIT_BACKOFF || terms != 0 ||
+               precision != ARBFN_PRECISION_DOUBLE || format == ARBFN_FORMAT_SHARED ||
+               format == ARBFN_FORMAT_COLLECTIVE) {
+      stage(atoms, atom_buffer, fields);
+      bool res = interchange(atom_buffer, fix_buffer, max_ms, link_rank, link, format, waiter,
+                             &stats, &segment);
+      assert(res);
+      if (is_damped) {
+        res = check_damped(atom_buffer, fix_buffer, precision);
+        assert(res);
+      }
+
+      for (size_t j = 0; j < n; ++j) {
+        fix_info_recv[j].dfx = fix_buffer.column(0)[j];
+        fix_info_recv[j].dfy = fix_buffer.column(1)[j];
+        fix_info_recv[j].dfz = fix_buffer.column(2)[j];
+      }
+
+      // Rates of change carry the fixes on to the middle of the step
+      if (terms & ARBFN_TERM_RATES) {
+        const size_t c = fix_buffer.term_column(ARBFN_TERM_RATES);
+        for (size_t j = 0; j < n; ++j) {
+          fix_info_recv[j].dfx += 0.5 * dt * fix_buffer.column(c)[j];
+          fix_info_recv[j].dfy += 0.5 * dt * fix_buffer.column(c + 1)[j];
+          fix_info_recv[j].dfz += 0.5 * dt * fix_buffer.column(c + 2)[j];
+        }
+      }
+
+      // Total the energy and the trace of the virial, as of the
+      // latest step
+      if (terms & ARBFN_TERM_ENERGY) {
+        const double *const e = fix_buffer.column(fix_buffer.term_column(ARBFN_TERM_ENERGY));
+        energy = 0.0;
+        for (size_t j = 0; j < n; ++j) { energy += e[j]; }
+      }
+      if (terms & ARBFN_TERM_VIRIAL) {
+        const size_t c = fix_buffer.term_column(ARBFN_TERM_VIRIAL);
+        virial_trace = 0.0;
+        for (size_t d = 0; d < 3; ++d) {
+          for (size_t j = 0; j < n; ++j) { virial_trace += fix_buffer.column(c + d)[j]; }
+        }
+      }
+    } else {
+      const bool res = interchange(n, atom_info_send.data(), fix_info_recv.data(), max_ms,
+                                   controller_rank, comm, format);
+      assert(res);
+    }
 
     if (step % 10 == 0) {
       std::cout << __FILE__ << ":" << __LINE__ << "> "
@@ -102,7 +598,64 @@ int main()
     }
   }
 
-  send_deregistration(controller_rank, comm);
+  // Don't leave a response in flight past deregistration
+  if (pending.active) {
+    const bool res = finish_interchange(fix_buffer, pending);
+    assert(res);
+    stats.add(pending.stats);
+  }
+
+  // Other workers' requests stiffen the spring, so a change must be
+  // pushed eventually
+  if (is_spring && mode == ARBFN_MODE_GRID) {
+    const double deadline = MPI_Wtime() + max_push_wait_s;
+    double k = spring_k;
+    bool is_settled = spring_stiffness(tiles, k);
+    while (!(is_settled && k > spring_k) && MPI_Wtime() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      bool updated;
+      res = poll_grid(tiles, controller_rank, comm, updated);
+      assert(res);
+      is_settled = spring_stiffness(tiles, k);
+    }
+
+    stage(atoms, atom_buffer);
+    interpolate(tiles.local, atom_buffer, fix_buffer);
+    res = is_settled && k > spring_k && check_tiles(tiles, k) &&
+          check_spring(atom_buffer, fix_buffer, tiles.layout, k);
+    assert(res);
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Worker " << my_rank << " saw the spring stiffen to " << k << "\n";
+  }
+
+  if (waiter.stats.count > 0) {
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Worker " << my_rank << " waited " << waiter.stats.total_us / waiter.stats.count
+              << " us on average (min " << waiter.stats.min_us << ", max " << waiter.stats.max_us
+              << ")\n";
+  }
+
+  if (mode == ARBFN_MODE_DELTA) {
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Worker " << my_rank << " sent " << num_changed << " of "
+              << num_updates * (n - 1) << " atoms as deltas\n";
+  }
+
+  if (terms & (ARBFN_TERM_ENERGY | ARBFN_TERM_VIRIAL)) {
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Worker " << my_rank << " ended with energy " << energy << " and virial trace "
+              << virial_trace << "\n";
+  }
+
+  if (stats.interchanges > 0) {
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Worker " << my_rank << " sent " << stats.bytes_sent << " bytes, received "
+              << stats.bytes_received << " bytes (" << stats.waiting_packets
+              << " waiting packets); wait " << stats.wait_s << " s, parse " << stats.parse_s
+              << " s\n";
+  }
+
+  send_deregistration(controller_rank, comm, mode, &group);
 
   // Final sync
   MPI_Barrier(MPI_COMM_WORLD);